@@ -439,6 +439,20 @@ Window {
                 online_user_list_model.append({ "name": users[i] });
             }
         }
+        function onOnline_user_joined(username) {
+            online_user_list_model.append({ "name": username });
+        }
+        function onOnline_user_left(username) {
+            for (var i = 0; i < online_user_list_model.count; i++) {
+                if (online_user_list_model.get(i).name === username) {
+                    online_user_list_model.remove(i);
+                    break;
+                }
+            }
+        }
+        function onHistory_loaded(count, has_more, is_latest) {
+            if (is_latest && list_view.count > 0) list_view.positionViewAtEnd();
+        }
         function onMessage_received(from, text, ts) {
             if (is_connected && current_user.length == 0) return;
             if (list_view.count > 0) list_view.positionViewAtEnd();
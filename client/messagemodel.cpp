@@ -33,4 +33,20 @@ void MessageModel::add_message(const QString& sender, const QString& text, const
     items_.append({sender, text, time});
     endInsertRows();
     qDebug() << "[MessageModel] new rowCount=" << items_.size();
+}
+
+void MessageModel::insert_messages(int row, const QList<ChatMessageItem>& items) {
+    if (items.isEmpty()) return;
+    row = qBound(0, row, static_cast<int>(items_.size()));
+    beginInsertRows(QModelIndex(), row, row + items.size() - 1);
+    for (int i = 0; i < items.size(); ++i) items_.insert(row + i, items.at(i));
+    endInsertRows();
+    qDebug() << "[MessageModel] insert_messages count=" << items.size() << "new rowCount=" << items_.size();
+}
+
+void MessageModel::reset_messages(const QList<ChatMessageItem>& items) {
+    beginResetModel();
+    items_ = items;
+    endResetModel();
+    qDebug() << "[MessageModel] reset_messages rowCount=" << items_.size();
 }
\ No newline at end of file
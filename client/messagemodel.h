@@ -19,6 +19,9 @@ public:
     QHash<int, QByteArray> roleNames() const override;
 
     Q_INVOKABLE void add_message(const QString& sender, const QString& text, const QDateTime& time);
+    // 历史批量：一次 beginInsertRows 插入整页；reset_messages 用于登录回放，替换整个列表
+    void insert_messages(int row, const QList<ChatMessageItem>& items);
+    void reset_messages(const QList<ChatMessageItem>& items);
 
 private:
     QList<ChatMessageItem> items_;
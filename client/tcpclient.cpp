@@ -2,14 +2,25 @@
 #include "messagemodel.h"
 #include <QAbstractSocket>
 #include <QJsonDocument>
+#include <QCborMap>
+#include <QCborValue>
 #include <QDateTime>
 #include <QDataStream>
 #include <QJsonArray>
 #include <QStringList>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <zlib.h>
 
 static QString g_current_user;
 
+// 与服务端约定：长度头最高位表示压缩帧；每帧 Z_SYNC_FLUSH 后去掉固定的 00 00 FF FF 尾
+static constexpr quint32 kFrameCompressedFlag = 0x80000000u;
+static constexpr quint32 kFrameLengthMask = 0x7FFFFFFFu;
+// 单帧（解压后）上限：服务端单个连接的写队列不超过 16 MiB，超过这个长度的帧它根本发不出来
+static constexpr qsizetype kMaxFrameBytes = 16 * 1024 * 1024;
+static const char kSyncFlushTail[4] = { 0x00, 0x00, static_cast<char>(0xFF), static_cast<char>(0xFF) };
+
 TcpClient::TcpClient(QObject* parent) : QObject(parent) {
     connect(&socket_, &QTcpSocket::readyRead, this, &TcpClient::on_ready_read);
     connect(&socket_, &QTcpSocket::connected, this, &TcpClient::on_connected);
@@ -20,6 +31,10 @@ TcpClient::TcpClient(QObject* parent) : QObject(parent) {
     connect(&heartbeat_timer_, &QTimer::timeout, this, &TcpClient::send_heartbeat);
 }
 
+TcpClient::~TcpClient() {
+    reset_compression();
+}
+
 void TcpClient::connect_to_host(const QString& host, quint16 port) {
     if (socket_.state() == QAbstractSocket::ConnectedState) socket_.disconnectFromHost();
     socket_.connectToHost(host, port);
@@ -33,6 +48,12 @@ void TcpClient::disconnect_from_host() {
 
 void TcpClient::on_connected() {
     heartbeat_timer_.start();
+    // 能力握手：老服务端不认识 hello，会忽略它，双方继续用 JSON
+    QJsonObject hello;
+    hello["type"] = "hello";
+    hello["formats"] = QJsonArray{ "cbor", "json" };
+    hello["compression"] = QJsonArray{ "deflate" };
+    send_json(hello);
     emit connected();
 }
 
@@ -40,6 +61,11 @@ void TcpClient::on_disconnected() {
     heartbeat_timer_.stop();
     emit disconnected();
     g_current_user.clear();
+    oldest_message_id_ = 0;
+    online_users_.clear();
+    presence_version_ = -1;
+    is_cbor_ = false;
+    reset_compression();
 }
 
 void TcpClient::on_error_occurred(QAbstractSocket::SocketError socket_error) {
@@ -58,12 +84,20 @@ void TcpClient::send_json(const QJsonObject& json_object) {
         g_current_user.clear();
     }
 
-    QJsonDocument doc(json_object);
-    QByteArray payload = doc.toJson(QJsonDocument::Compact);
+    QByteArray payload = is_cbor_ ? QCborValue(QCborMap::fromJsonObject(json_object)).toCbor()
+                                  : QJsonDocument(json_object).toJson(QJsonDocument::Compact);
+    quint32 header_value = static_cast<quint32>(payload.size());
+    if (deflate_stream_ && payload.size() >= compression_min_bytes_) {
+        QByteArray compressed;
+        if (deflate_payload(payload, compressed)) {
+            payload = compressed;
+            header_value = static_cast<quint32>(payload.size()) | kFrameCompressedFlag;
+        }
+    }
     QByteArray frame;
     QDataStream ds(&frame, QIODevice::WriteOnly);
     ds.setByteOrder(QDataStream::BigEndian);
-    ds << static_cast<quint32>(payload.size());
+    ds << header_value;
     frame.append(payload);
     socket_.write(frame);
 }
@@ -74,22 +108,52 @@ void TcpClient::on_ready_read() {
     while (buffer_.size() >= 4) {
         QDataStream ds(buffer_);
         ds.setByteOrder(QDataStream::BigEndian);
-        quint32 len = 0;
-        ds >> len;
-        if (buffer_.size() < 4 + static_cast<int>(len)) break;
+        quint32 header_value = 0;
+        ds >> header_value;
+        quint32 len = header_value & kFrameLengthMask;
+        if (static_cast<qsizetype>(len) > kMaxFrameBytes) {
+            emit error_occurred(QStringLiteral("frame too large"));
+            socket_.abort();
+            return;
+        }
+        if (buffer_.size() < 4 + static_cast<qint64>(len)) break;
         QByteArray payload = buffer_.mid(4, len);
         buffer_.remove(0, 4 + len);
+        if (header_value & kFrameCompressedFlag) {
+            QByteArray inflated;
+            if (!inflate_payload(payload, inflated)) {
+                // 解压流一旦出错（含解压后超长），后面的帧都无法还原，只能重连
+                emit error_occurred(QStringLiteral("bad compressed frame"));
+                socket_.abort();
+                return;
+            }
+            payload = inflated;
+        }
         process_frame(payload);
     }
 }
 
 void TcpClient::process_frame(const QByteArray& payload) {
-    QJsonDocument doc = QJsonDocument::fromJson(payload);
-    if (!doc.isObject()) return;
-    QJsonObject json_obj = doc.object();
+    // 顶层永远是对象：'{' 开头是 JSON，否则是 CBOR map
+    QJsonObject json_obj;
+    if (!payload.isEmpty() && payload.at(0) != '{') {
+        QCborValue cbor_value = QCborValue::fromCbor(payload);
+        if (!cbor_value.isMap()) return;
+        json_obj = cbor_value.toMap().toJsonObject();
+    } else {
+        QJsonDocument doc = QJsonDocument::fromJson(payload);
+        if (!doc.isObject()) return;
+        json_obj = doc.object();
+    }
     QString type = json_obj.value("type").toString();
 
-    if (type == "message" || type == "private") {
+    if (type == "hello_ack") {
+        is_cbor_ = json_obj.value("format").toString() == "cbor";
+        if (json_obj.value("compression").toString() == "deflate")
+            start_compression(json_obj.value("compression_min_bytes").toInt(512));
+    } else if (type == "history_batch") {
+        process_history_batch(json_obj);
+    } else if (type == "message" || type == "private") {
         QString from = json_obj.value("from").toString();
         QString text = json_obj.value("text").toString();
         qint64 timestamp = json_obj.value("ts").toVariant().toLongLong();
@@ -110,18 +174,180 @@ void TcpClient::process_frame(const QByteArray& payload) {
             if (ok) emit register_succeeded();
             else emit register_failed(reason);
         }
+    } else if (type == "resync") {
+        // 服务端因为我们读得太慢丢过帧：重新拿在线列表快照和最新一页历史
+        QJsonObject list_request;
+        list_request["type"] = "list_users";
+        send_json(list_request);
+        QJsonObject history_request;
+        history_request["type"] = "history";
+        history_request["n"] = 100;
+        send_json(history_request);
     } else if (type == "pong") {
         // Ignore
+    } else if (type == "presence") {
+        process_presence(json_obj);
     } else if (json_obj.contains("users") && json_obj.value("users").isArray()) {
         QJsonArray arr = json_obj.value("users").toArray();
         QStringList users_list;
         for (const QJsonValue& v : arr) users_list << v.toString();
+        online_users_ = users_list;
+        presence_version_ = json_obj.value("version").toVariant().toLongLong();
         emit online_users_updated(users_list);
     }
 }
 
+void TcpClient::process_history_batch(const QJsonObject& json_obj) {
+    QJsonArray arr = json_obj.value("messages").toArray();
+    qint64 before_id = json_obj.value("before_id").toVariant().toLongLong();
+    bool has_more = json_obj.value("has_more").toBool();
+    QList<ChatMessageItem> items;
+    items.reserve(arr.size());
+    for (const QJsonValue& v : arr) {
+        QJsonObject msg_obj = v.toObject();
+        QString from = msg_obj.value("from").toString();
+        qint64 timestamp = msg_obj.value("ts").toVariant().toLongLong();
+        QDateTime datetime = QDateTime::fromMSecsSinceEpoch(timestamp ? timestamp : QDateTime::currentMSecsSinceEpoch());
+        items.append({ from == g_current_user ? QStringLiteral("me") : from, msg_obj.value("text").toString(), datetime });
+    }
+    if (!arr.isEmpty()) {
+        qint64 first_id = arr.first().toObject().value("id").toVariant().toLongLong();
+        if (first_id > 0 && (before_id == 0 || oldest_message_id_ == 0 || first_id < oldest_message_id_))
+            oldest_message_id_ = first_id;
+    }
+    if (message_model_) {
+        // before_id == 0 是最新一页（登录回放），整体替换；否则是向前翻页，插到最前面
+        if (before_id == 0) message_model_->reset_messages(items);
+        else message_model_->insert_messages(0, items);
+    }
+    emit history_loaded(items.size(), has_more, before_id == 0);
+}
+
+// 增量按“设为最终状态”应用；版本不连续说明丢了增量，重新要一次快照
+void TcpClient::process_presence(const QJsonObject& json_obj) {
+    qint64 from_version = json_obj.value("from_version").toVariant().toLongLong();
+    qint64 version = json_obj.value("version").toVariant().toLongLong();
+    if (presence_version_ < 0 || version <= presence_version_) return;
+    if (from_version != presence_version_) {
+        QJsonObject j;
+        j["type"] = "list_users";
+        send_json(j);
+        return;
+    }
+    for (const QJsonValue& v : json_obj.value("left").toArray()) {
+        QString username = v.toString();
+        if (online_users_.removeAll(username) > 0) emit online_user_left(username);
+    }
+    for (const QJsonValue& v : json_obj.value("joined").toArray()) {
+        QString username = v.toString();
+        if (!online_users_.contains(username)) {
+            online_users_.append(username);
+            emit online_user_joined(username);
+        }
+    }
+    presence_version_ = version;
+}
+
+void TcpClient::request_older_history(int count) {
+    if (oldest_message_id_ <= 0) return;
+    QJsonObject j;
+    j["type"] = "history";
+    j["n"] = count;
+    j["before_id"] = oldest_message_id_;
+    send_json(j);
+}
+
 void TcpClient::send_heartbeat() {
     QJsonObject j;
     j["type"] = "heartbeat";
     send_json(j);
-}
\ No newline at end of file
+}
+
+void TcpClient::start_compression(int min_bytes) {
+    compression_min_bytes_ = min_bytes;
+    if (deflate_stream_) return;   // 已启用：流状态必须与服务端保持连续
+    deflate_stream_ = new z_stream{};
+    inflate_stream_ = new z_stream{};
+    if (deflateInit2(deflate_stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete deflate_stream_;
+        deflate_stream_ = nullptr;
+    }
+    if (inflateInit2(inflate_stream_, -15) != Z_OK) {
+        delete inflate_stream_;
+        inflate_stream_ = nullptr;
+    }
+}
+
+void TcpClient::reset_compression() {
+    if (deflate_stream_) {
+        deflateEnd(deflate_stream_);
+        delete deflate_stream_;
+        deflate_stream_ = nullptr;
+    }
+    if (inflate_stream_) {
+        inflateEnd(inflate_stream_);
+        delete inflate_stream_;
+        inflate_stream_ = nullptr;
+    }
+}
+
+bool TcpClient::deflate_payload(const QByteArray& payload, QByteArray& out) {
+    QElapsedTimer timer;
+    timer.start();
+    out.resize(static_cast<qsizetype>(deflateBound(deflate_stream_, payload.size()) + 16));
+    deflate_stream_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(payload.data()));
+    deflate_stream_->avail_in = static_cast<uInt>(payload.size());
+    deflate_stream_->next_out = reinterpret_cast<Bytef*>(out.data());
+    deflate_stream_->avail_out = static_cast<uInt>(out.size());
+    int result = deflate(deflate_stream_, Z_SYNC_FLUSH);
+    if (result != Z_OK || deflate_stream_->avail_out == 0) {
+        // 流状态已不可信，之后都发原文；服务端的解压流没收到这帧，不受影响
+        deflateEnd(deflate_stream_);
+        delete deflate_stream_;
+        deflate_stream_ = nullptr;
+        return false;
+    }
+    out.resize(out.size() - static_cast<qsizetype>(deflate_stream_->avail_out));
+    if (out.endsWith(QByteArray(kSyncFlushTail, 4))) out.chop(4);
+    compress_bytes_in_ += payload.size();
+    compress_bytes_out_ += out.size();
+    compress_ns_ += timer.nsecsElapsed();
+    return true;
+}
+
+bool TcpClient::inflate_payload(const QByteArray& payload, QByteArray& out) {
+    if (!inflate_stream_) return false;
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray input = payload + QByteArray(kSyncFlushTail, 4);
+    inflate_stream_->next_in = reinterpret_cast<Bytef*>(input.data());
+    inflate_stream_->avail_in = static_cast<uInt>(input.size());
+    out.clear();
+    char chunk[16384];
+    do {
+        inflate_stream_->next_out = reinterpret_cast<Bytef*>(chunk);
+        inflate_stream_->avail_out = sizeof(chunk);
+        int result = inflate(inflate_stream_, Z_SYNC_FLUSH);
+        if (result != Z_OK && result != Z_BUF_ERROR) return false;
+        qsizetype produced = static_cast<qsizetype>(sizeof(chunk) - inflate_stream_->avail_out);
+        // 压缩比没有上限，一小段输入就能展开成任意长；超过单帧上限即按坏帧处理
+        if (out.size() + produced > kMaxFrameBytes) return false;
+        out.append(chunk, produced);
+        if (result == Z_BUF_ERROR) break;
+    } while (inflate_stream_->avail_in > 0 || inflate_stream_->avail_out == 0);
+    inflate_bytes_in_ += payload.size();
+    inflate_bytes_out_ += out.size();
+    inflate_ns_ += timer.nsecsElapsed();
+    return true;
+}
+
+QVariantMap TcpClient::compression_stats() const {
+    return {
+        { "compress_bytes_in", compress_bytes_in_ },
+        { "compress_bytes_out", compress_bytes_out_ },
+        { "compress_ns", compress_ns_ },
+        { "inflate_bytes_in", inflate_bytes_in_ },
+        { "inflate_bytes_out", inflate_bytes_out_ },
+        { "inflate_ns", inflate_ns_ },
+    };
+}
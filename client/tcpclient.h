@@ -4,17 +4,24 @@
 #include <QTimer>
 #include <QJsonObject>
 #include <QStringList>
+#include <QVariantMap>
 
 class MessageModel;
+struct z_stream_s;
 
 class TcpClient : public QObject {
     Q_OBJECT
 public:
     explicit TcpClient(QObject* parent = nullptr);
+    ~TcpClient() override;
     Q_INVOKABLE void connect_to_host(const QString& host, quint16 port);
     Q_INVOKABLE void disconnect_from_host();
     Q_INVOKABLE void send_json(const QJsonObject& json_object);
+    // 以当前最旧一条消息的 id 为游标向前翻页
+    Q_INVOKABLE void request_older_history(int count = 50);
     void set_message_model(MessageModel* model) { message_model_ = model; }
+    // 压缩收益与耗时：原始/压缩字节数、纳秒
+    Q_INVOKABLE QVariantMap compression_stats() const;
 
 signals:
     void connected();
@@ -27,7 +34,10 @@ signals:
     void register_failed(const QString& reason);
 
     void online_users_updated(const QStringList& users);
+    void online_user_joined(const QString& username);
+    void online_user_left(const QString& username);
     void message_received(const QString& from, const QString& text, qint64 timestamp);
+    void history_loaded(int count, bool has_more, bool is_latest);
 
 private slots:
     void on_ready_read();
@@ -39,8 +49,28 @@ private slots:
 
 private:
     void process_frame(const QByteArray& payload);
+    void process_history_batch(const QJsonObject& json_obj);
+    void process_presence(const QJsonObject& json_obj);
+    void start_compression(int min_bytes);
+    void reset_compression();
+    bool deflate_payload(const QByteArray& payload, QByteArray& out);
+    bool inflate_payload(const QByteArray& payload, QByteArray& out);
     QTcpSocket socket_;
     QByteArray buffer_;
     MessageModel* message_model_ = nullptr;
     QTimer heartbeat_timer_;
+    qint64 oldest_message_id_ = 0;
+    QStringList online_users_;
+    qint64 presence_version_ = -1;   // -1：尚未收到快照
+    bool is_cbor_ = false;           // 服务端在 hello_ack 里同意 CBOR 后，发送改用 CBOR
+    // hello_ack 同意 deflate 后创建：两个方向各一条跨帧保留字典的 raw deflate 流
+    z_stream_s* deflate_stream_ = nullptr;
+    z_stream_s* inflate_stream_ = nullptr;
+    int compression_min_bytes_ = 512;
+    qint64 compress_bytes_in_ = 0;
+    qint64 compress_bytes_out_ = 0;
+    qint64 compress_ns_ = 0;
+    qint64 inflate_bytes_in_ = 0;
+    qint64 inflate_bytes_out_ = 0;
+    qint64 inflate_ns_ = 0;
 };
\ No newline at end of file
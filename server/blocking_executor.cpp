@@ -0,0 +1,93 @@
+﻿#include "blocking_executor.hpp"
+#include "logger.hpp"
+#include <iostream>
+
+static void update_max(std::atomic<uint64_t>& max_value, uint64_t value) {
+    uint64_t prev_max = max_value.load(std::memory_order_relaxed);
+    while (value > prev_max && !max_value.compare_exchange_weak(prev_max, value)) {}
+}
+
+BlockingExecutor::BlockingExecutor(size_t thread_count) {
+    if (thread_count == 0) thread_count = 1;
+    for (size_t i = 0; i < thread_count; ++i) {
+        worker_threads_.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+BlockingExecutor::~BlockingExecutor() {
+    stop();
+}
+
+// 停止时把已提交的任务跑完再退出
+void BlockingExecutor::stop() {
+    {
+        std::lock_guard<std::mutex> lock_guard(queue_mutex_);
+        if (is_stopping_) return;
+        is_stopping_ = true;
+    }
+    not_empty_cv_.notify_all();
+    for (auto& thread : worker_threads_) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+void BlockingExecutor::submit(std::function<void()> job) {
+    uint64_t queue_depth = 0;
+    {
+        std::lock_guard<std::mutex> lock_guard(queue_mutex_);
+        pending_jobs_.push_back(Job{ std::move(job), std::chrono::steady_clock::now() });
+        queue_depth = pending_jobs_.size();
+    }
+    submitted_count_.fetch_add(1, std::memory_order_relaxed);
+    update_max(max_queue_depth_, queue_depth);
+    not_empty_cv_.notify_one();
+}
+
+void BlockingExecutor::worker_loop() {
+    std::unique_lock<std::mutex> lock_guard(queue_mutex_);
+    while (true) {
+        not_empty_cv_.wait(lock_guard, [this]() { return is_stopping_ || !pending_jobs_.empty(); });
+        if (pending_jobs_.empty()) break;   // is_stopping_ 且已排空
+        Job job = std::move(pending_jobs_.front());
+        pending_jobs_.pop_front();
+        lock_guard.unlock();
+
+        auto start_time = std::chrono::steady_clock::now();
+        uint64_t wait_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            start_time - job.enqueued_at).count());
+        try {
+            job.function();
+        } catch (const std::exception& ex) {
+            CHAT_LOG_ERROR("Exception in blocking job", { {"what", ex.what()} });
+            std::cerr << "[fatal] blocking job error: " << ex.what() << std::endl;
+        } catch (...) {
+            CHAT_LOG_ERROR("Unknown exception in blocking job");
+            std::cerr << "[fatal] Unknown blocking job error" << std::endl;
+        }
+        uint64_t run_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time).count());
+        completed_count_.fetch_add(1, std::memory_order_relaxed);
+        wait_us_total_.fetch_add(wait_us, std::memory_order_relaxed);
+        run_us_total_.fetch_add(run_us, std::memory_order_relaxed);
+        update_max(wait_us_max_, wait_us);
+        update_max(run_us_max_, run_us);
+
+        lock_guard.lock();
+    }
+}
+
+BlockingExecutorStats BlockingExecutor::stats() const {
+    BlockingExecutorStats snapshot;
+    snapshot.submitted = submitted_count_.load(std::memory_order_relaxed);
+    snapshot.completed = completed_count_.load(std::memory_order_relaxed);
+    snapshot.max_queue_depth = max_queue_depth_.load(std::memory_order_relaxed);
+    snapshot.wait_us_total = wait_us_total_.load(std::memory_order_relaxed);
+    snapshot.wait_us_max = wait_us_max_.load(std::memory_order_relaxed);
+    snapshot.run_us_total = run_us_total_.load(std::memory_order_relaxed);
+    snapshot.run_us_max = run_us_max_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock_guard(queue_mutex_);
+        snapshot.queue_depth = pending_jobs_.size();
+    }
+    return snapshot;
+}
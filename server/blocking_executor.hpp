@@ -0,0 +1,57 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct BlockingExecutorStats {
+    uint64_t submitted = 0;
+    uint64_t completed = 0;
+    uint64_t queue_depth = 0;
+    uint64_t max_queue_depth = 0;
+    uint64_t wait_us_total = 0;         // 入队到开始执行
+    uint64_t wait_us_max = 0;
+    uint64_t run_us_total = 0;
+    uint64_t run_us_max = 0;
+};
+
+// 跑阻塞任务的有界线程池，让 I/O 线程只做读写。服务器用两个实例：
+// DB 调用（线程数与 DBPool 连接数一致，连接都在用时排队的是这里的任务）和口令哈希
+class BlockingExecutor {
+public:
+    explicit BlockingExecutor(size_t thread_count);
+    ~BlockingExecutor();
+    BlockingExecutor(const BlockingExecutor&) = delete;
+    BlockingExecutor& operator=(const BlockingExecutor&) = delete;
+
+    // 任务里抛出的异常只记日志；完成后要回到会话上的工作由任务自己 post 回去
+    void submit(std::function<void()> job);
+    void stop();
+    BlockingExecutorStats stats() const;
+
+private:
+    struct Job {
+        std::function<void()> function;
+        std::chrono::steady_clock::time_point enqueued_at;
+    };
+    void worker_loop();
+
+    mutable std::mutex queue_mutex_;
+    std::condition_variable not_empty_cv_;
+    std::deque<Job> pending_jobs_;
+    bool is_stopping_ = false;
+    std::vector<std::thread> worker_threads_;
+
+    std::atomic<uint64_t> submitted_count_{0};
+    std::atomic<uint64_t> completed_count_{0};
+    std::atomic<uint64_t> max_queue_depth_{0};
+    std::atomic<uint64_t> wait_us_total_{0};
+    std::atomic<uint64_t> wait_us_max_{0};
+    std::atomic<uint64_t> run_us_total_{0};
+    std::atomic<uint64_t> run_us_max_{0};
+};
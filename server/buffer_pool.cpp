@@ -0,0 +1,79 @@
+﻿#include "buffer_pool.hpp"
+
+void PooledBuffer::reset() {
+    if (data_) pool_->release(data_, capacity_, class_index_);
+    pool_ = nullptr;
+    data_ = nullptr;
+    capacity_ = 0;
+}
+
+BufferPool::BufferPool(const BufferPoolOptions& options) : options_(options) {
+    if (options_.min_class_bytes < 64) options_.min_class_bytes = 64;
+    if (options_.max_class_bytes < options_.min_class_bytes) options_.max_class_bytes = options_.min_class_bytes;
+    for (size_t capacity = options_.min_class_bytes; ; capacity *= 2) {
+        auto size_class = std::make_unique<SizeClass>();
+        size_class->capacity = capacity;
+        classes_.push_back(std::move(size_class));
+        if (capacity >= options_.max_class_bytes) break;
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (auto& size_class : classes_) {
+        for (uint8_t* data : size_class->free_list) delete[] data;
+    }
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    acquires_.fetch_add(1, std::memory_order_relaxed);
+    buffers_in_use_.fetch_add(1, std::memory_order_relaxed);
+    size_t class_index = 0;
+    while (class_index < classes_.size() && classes_[class_index]->capacity < size) ++class_index;
+    if (class_index == classes_.size()) {
+        bytes_in_use_.fetch_add(size, std::memory_order_relaxed);
+        return PooledBuffer(this, new uint8_t[size], size, kUnpooled);
+    }
+
+    SizeClass& size_class = *classes_[class_index];
+    uint8_t* data = nullptr;
+    {
+        std::lock_guard<std::mutex> lock_guard(size_class.mutex);
+        if (!size_class.free_list.empty()) {
+            data = size_class.free_list.back();
+            size_class.free_list.pop_back();
+        }
+    }
+    if (data) {
+        cache_hits_.fetch_add(1, std::memory_order_relaxed);
+        bytes_cached_.fetch_sub(size_class.capacity, std::memory_order_relaxed);
+    } else {
+        data = new uint8_t[size_class.capacity];   // 不做值初始化，省掉清零
+    }
+    bytes_in_use_.fetch_add(size_class.capacity, std::memory_order_relaxed);
+    return PooledBuffer(this, data, size_class.capacity, class_index);
+}
+
+void BufferPool::release(uint8_t* data, size_t capacity, size_t class_index) {
+    buffers_in_use_.fetch_sub(1, std::memory_order_relaxed);
+    bytes_in_use_.fetch_sub(capacity, std::memory_order_relaxed);
+    if (class_index != kUnpooled && bytes_cached_.load(std::memory_order_relaxed) + capacity <= options_.max_cached_bytes) {
+        SizeClass& size_class = *classes_[class_index];
+        std::lock_guard<std::mutex> lock_guard(size_class.mutex);
+        if (size_class.free_list.size() < options_.max_cached_per_class) {
+            size_class.free_list.push_back(data);
+            bytes_cached_.fetch_add(capacity, std::memory_order_relaxed);
+            return;
+        }
+    }
+    delete[] data;
+}
+
+BufferPoolStats BufferPool::stats() const {
+    BufferPoolStats snapshot;
+    snapshot.acquires = acquires_.load(std::memory_order_relaxed);
+    snapshot.cache_hits = cache_hits_.load(std::memory_order_relaxed);
+    snapshot.bytes_in_use = bytes_in_use_.load(std::memory_order_relaxed);
+    snapshot.bytes_cached = bytes_cached_.load(std::memory_order_relaxed);
+    snapshot.buffers_in_use = buffers_in_use_.load(std::memory_order_relaxed);
+    return snapshot;
+}
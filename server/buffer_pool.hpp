@@ -0,0 +1,91 @@
+﻿#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct BufferPoolOptions {
+    size_t min_class_bytes = 256;               // 最小档位；档位按 2 的幂递增
+    size_t max_class_bytes = 1024 * 1024;       // 超过最大档位的请求直接分配、用完即还给系统
+    size_t max_cached_per_class = 256;          // 每档最多缓存多少块空闲缓冲
+    size_t max_cached_bytes = 64 * 1024 * 1024; // 所有档位缓存总量上限
+};
+
+struct BufferPoolStats {
+    uint64_t acquires = 0;
+    uint64_t cache_hits = 0;
+    uint64_t bytes_in_use = 0;     // 已借出（按档位容量计）
+    uint64_t bytes_cached = 0;     // 空闲、留在池里
+    uint64_t buffers_in_use = 0;
+};
+
+class BufferPool;
+
+// 从池里借出的一块未初始化内存；析构或 reset 时还回去。只能移动
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer&& other) noexcept { swap(other); }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) { reset(); swap(other); }
+        return *this;
+    }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer() { reset(); }
+
+    uint8_t* data() const { return data_; }
+    size_t capacity() const { return capacity_; }
+    explicit operator bool() const { return data_ != nullptr; }
+    void reset();
+
+private:
+    friend class BufferPool;
+    PooledBuffer(BufferPool* pool, uint8_t* data, size_t capacity, size_t class_index)
+        : pool_(pool), data_(data), capacity_(capacity), class_index_(class_index) {}
+    void swap(PooledBuffer& other) noexcept {
+        std::swap(pool_, other.pool_);
+        std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(class_index_, other.class_index_);
+    }
+
+    BufferPool* pool_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t class_index_ = 0;
+};
+
+// 按大小分档的接收缓冲池，全部会话共享。借出不清零；空闲会话把缓冲还回来，
+// 大量空闲连接只占 socket 和会话对象本身
+class BufferPool {
+public:
+    explicit BufferPool(const BufferPoolOptions& options = BufferPoolOptions());
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    PooledBuffer acquire(size_t size);
+    BufferPoolStats stats() const;
+
+private:
+    friend class PooledBuffer;
+    static constexpr size_t kUnpooled = static_cast<size_t>(-1);
+    void release(uint8_t* data, size_t capacity, size_t class_index);
+
+    struct SizeClass {
+        size_t capacity = 0;
+        std::mutex mutex;
+        std::vector<uint8_t*> free_list;
+    };
+
+    BufferPoolOptions options_;
+    std::vector<std::unique_ptr<SizeClass>> classes_;
+    std::atomic<uint64_t> acquires_{0};
+    std::atomic<uint64_t> cache_hits_{0};
+    std::atomic<uint64_t> bytes_in_use_{0};
+    std::atomic<uint64_t> bytes_cached_{0};
+    std::atomic<uint64_t> buffers_in_use_{0};
+};
@@ -0,0 +1,28 @@
+﻿#pragma once
+#include <string>
+#include <memory>
+#include <cstdint>
+
+// users.id；0 不是合法 id，表示“无”（未登录、公共频道的收件人）
+using UserId = uint32_t;
+// 驻留的用户名：同一 id 全进程共享一份只读字符串，见 UserNames
+using UserName = std::shared_ptr<const std::string>;
+
+inline const std::string& user_name_text(const UserName& name) {
+    static const std::string kEmpty;
+    return name ? *name : kEmpty;
+}
+
+struct ChatMsg {
+    UserId from_id = 0;
+    UserId to_id = 0;  // 0 表示公共频道
+    UserName from;
+    UserName to;
+    std::string text;
+    uint64_t ts = 0;
+    uint64_t id = 0;   // messages.id，分页游标；0 表示尚未分配
+
+    bool is_private() const { return to_id != 0; }
+    const std::string& from_name() const { return user_name_text(from); }
+    const std::string& to_name() const { return user_name_text(to); }
+};
@@ -0,0 +1,75 @@
+﻿#include "compression.hpp"
+#include <algorithm>
+
+static const unsigned char kSyncFlushTail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+DeflateStream::DeflateStream(int level) {
+    // windowBits 取负值：raw deflate，不带 zlib 头和校验和
+    is_ready_ = deflateInit2(&stream_, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+DeflateStream::~DeflateStream() {
+    if (is_ready_) deflateEnd(&stream_);
+}
+
+bool DeflateStream::compress(const char* data, size_t length, std::string& out) {
+    if (!is_ready_) return false;
+    size_t start_size = out.size();
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = static_cast<uInt>(length);
+    do {
+        size_t chunk_size = deflateBound(&stream_, stream_.avail_in) + 16;
+        size_t used_size = out.size();
+        out.resize(used_size + chunk_size);
+        stream_.next_out = reinterpret_cast<Bytef*>(&out[used_size]);
+        stream_.avail_out = static_cast<uInt>(chunk_size);
+        int result = deflate(&stream_, Z_SYNC_FLUSH);
+        out.resize(used_size + chunk_size - stream_.avail_out);
+        if (result != Z_OK && result != Z_BUF_ERROR) {
+            is_ready_ = false;
+            out.resize(start_size);
+            return false;
+        }
+    } while (stream_.avail_out == 0);
+    if (out.size() - start_size >= 4 && out.compare(out.size() - 4, 4, reinterpret_cast<const char*>(kSyncFlushTail), 4) == 0) {
+        out.resize(out.size() - 4);
+    }
+    return true;
+}
+
+InflateStream::InflateStream() {
+    is_ready_ = inflateInit2(&stream_, -15) == Z_OK;
+}
+
+InflateStream::~InflateStream() {
+    if (is_ready_) inflateEnd(&stream_);
+}
+
+bool InflateStream::decompress(const uint8_t* data, size_t length, size_t max_output, std::string& out) {
+    if (!is_ready_) return false;
+    out.clear();
+    // 先喂帧数据，再补回发送端去掉的同步刷新尾
+    const struct { const uint8_t* data; size_t length; } inputs[2] = {
+        { data, length }, { kSyncFlushTail, sizeof(kSyncFlushTail) }
+    };
+    for (const auto& input : inputs) {
+        stream_.next_in = const_cast<Bytef*>(input.data);
+        stream_.avail_in = static_cast<uInt>(input.length);
+        do {
+            size_t used_size = out.size();
+            size_t chunk_size = std::max<size_t>(input.length * 4, 4096);
+            if (used_size + chunk_size > max_output + 1) chunk_size = max_output + 1 - used_size;
+            out.resize(used_size + chunk_size);
+            stream_.next_out = reinterpret_cast<Bytef*>(&out[used_size]);
+            stream_.avail_out = static_cast<uInt>(chunk_size);
+            int result = inflate(&stream_, Z_SYNC_FLUSH);
+            out.resize(used_size + chunk_size - stream_.avail_out);
+            if (out.size() > max_output || (result != Z_OK && result != Z_BUF_ERROR)) {
+                is_ready_ = false;
+                return false;
+            }
+            if (result == Z_BUF_ERROR) break;   // 没有可继续的输入
+        } while (stream_.avail_in > 0 || stream_.avail_out == 0);
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <zlib.h>
+
+// 每连接一条持续的 raw deflate 流。每帧以 Z_SYNC_FLUSH 结束并去掉末尾固定的 00 00 FF FF
+// （与 WebSocket permessage-deflate 相同），滑动窗口跨帧保留，
+// 反复出现的用户名、字段名在后续帧里只剩回溯引用
+class DeflateStream {
+public:
+    explicit DeflateStream(int level);
+    ~DeflateStream();
+    DeflateStream(const DeflateStream&) = delete;
+    DeflateStream& operator=(const DeflateStream&) = delete;
+
+    // 把 data 压缩后追加到 out；流已损坏时返回 false，调用方应改发原文并停用压缩
+    bool compress(const char* data, size_t length, std::string& out);
+
+private:
+    z_stream stream_{};
+    bool is_ready_ = false;
+};
+
+class InflateStream {
+public:
+    InflateStream();
+    ~InflateStream();
+    InflateStream(const InflateStream&) = delete;
+    InflateStream& operator=(const InflateStream&) = delete;
+
+    // 解压一帧到 out（覆盖）；数据损坏或解压后超过 max_output 字节返回 false
+    bool decompress(const uint8_t* data, size_t length, size_t max_output, std::string& out);
+
+private:
+    z_stream stream_{};
+    bool is_ready_ = false;
+};
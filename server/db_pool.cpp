@@ -0,0 +1,257 @@
+﻿#include "db_pool.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <exception>
+#include <vector>
+
+DBPool::DBPool(const std::string& host, unsigned port, const std::string& username, const std::string& password,
+               const DBPoolOptions& options)
+    : host_(host), username_(username), password_(password), port_(port), options_(options) {
+    if (options_.max_size == 0) options_.max_size = 1;
+    if (options_.min_size > options_.max_size) options_.min_size = options_.max_size;
+    // 预热交给后台线程：MySQL 晚启动也不影响服务器起来
+    maintenance_thread_ = std::thread([this]() { maintenance_loop(); });
+}
+
+DBPool::~DBPool() {
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex_);
+        is_stopping_ = true;
+    }
+    maintenance_cv_.notify_all();
+    if (maintenance_thread_.joinable()) maintenance_thread_.join();
+}
+
+DbConnection::DbConnection(const std::string& host, unsigned port, const std::string& username, const std::string& password,
+                           std::chrono::milliseconds connect_timeout)
+    : session(mysqlx::SessionOption::HOST, host, mysqlx::SessionOption::PORT, port,
+              mysqlx::SessionOption::USER, username, mysqlx::SessionOption::PWD, password,
+              mysqlx::SessionOption::CONNECT_TIMEOUT, static_cast<unsigned>(connect_timeout.count())),
+      schema(session.getSchema("chatdb")),
+      users_table(schema.getTable("users")),
+      messages_table(schema.getTable("messages")),
+      user_password_lookup(users_table.select("id", "password").where("username = :username")),
+      user_id_lookup(users_table.select("id").where("username = :username")),
+      recent_page(messages_table.select("id", "sender_id", "recipient_id", "text", "ts")
+                      .where("recipient_id IS NULL AND id < :bound").orderBy("id DESC")) {
+}
+
+std::shared_ptr<DbConnection> DBPool::create_connection(std::chrono::milliseconds connect_timeout) {
+    try {
+        auto connection_ptr = options_.connection_factory
+            ? options_.connection_factory()
+            : std::make_shared<DbConnection>(host_, port_, username_, password_, connect_timeout);
+        connect_count_.fetch_add(1, std::memory_order_relaxed);
+        return connection_ptr;
+    } catch (const std::exception& e) {
+        connect_failure_count_.fetch_add(1, std::memory_order_relaxed);
+        throw DBUnavailable(std::string("Failed to connect to MySQL: ") + e.what());
+    }
+}
+
+bool DBPool::validate(const std::shared_ptr<DbConnection>& connection) {
+    if (!connection) return true;   // connection_factory 给的占位连接
+    try {
+        connection->session.sql("SELECT 1").execute();
+        return true;
+    } catch (const std::exception& ex) {
+        validation_failure_count_.fetch_add(1, std::memory_order_relaxed);
+        CHAT_LOG_WARN("DB session failed validation", { {"error", ex.what()} });
+        return false;
+    }
+}
+
+std::shared_ptr<DbConnection> DBPool::acquire() {
+    auto wait_start = Clock::now();
+    auto deadline = wait_start + options_.acquire_timeout;
+    std::unique_lock<std::mutex> lock_guard(mutex_);
+    while (true) {
+        if (!idle_sessions_.empty()) {
+            PooledSession pooled = std::move(idle_sessions_.back());
+            idle_sessions_.pop_back();
+            ++in_use_count_;
+            bool needs_check = pooled.is_suspect || Clock::now() - pooled.last_used > options_.validate_after_idle;
+            if (!needs_check) {
+                lock_guard.unlock();
+                return lend(std::move(pooled), wait_start);
+            }
+            lock_guard.unlock();
+            if (validate(pooled.connection)) {
+                pooled.last_validated = Clock::now();
+                return lend(std::move(pooled), wait_start);
+            }
+            lock_guard.lock();
+            --in_use_count_;
+            discard_locked();
+            continue;   // 换一个空闲连接，或者新开一个
+        }
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+        if (total_count_ < options_.max_size && remaining.count() > 0) {
+            ++total_count_;
+            ++in_use_count_;
+            lock_guard.unlock();
+            // 建连同样受 acquire_timeout 约束：MySQL 不响应时调用方最多等到截止时刻
+            std::shared_ptr<DbConnection> connection_ptr;
+            try {
+                connection_ptr = create_connection(std::min(options_.connect_timeout, remaining));
+            } catch (...) {
+                lock_guard.lock();
+                --total_count_;
+                --in_use_count_;
+                available_cv_.notify_one();
+                throw;
+            }
+            lock_guard.lock();
+            on_connected_locked();
+            lock_guard.unlock();
+            auto now = Clock::now();
+            return lend(PooledSession{ std::move(connection_ptr), now, now, false }, wait_start);
+        }
+        ++waiting_count_;
+        bool is_ready = available_cv_.wait_until(lock_guard, deadline, [this]() {
+            return !idle_sessions_.empty() || total_count_ < options_.max_size;
+        });
+        --waiting_count_;
+        if (!is_ready) {
+            acquire_timeout_count_.fetch_add(1, std::memory_order_relaxed);
+            throw DBUnavailable("Timed out waiting for a MySQL session");
+        }
+    }
+}
+
+// 归还时若调用方正因异常退栈（多半是连接出错），标记为可疑，下次借出前先校验
+std::shared_ptr<DbConnection> DBPool::lend(PooledSession pooled, Clock::time_point wait_start) {
+    uint64_t wait_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - wait_start).count());
+    acquire_count_.fetch_add(1, std::memory_order_relaxed);
+    wait_us_total_.fetch_add(wait_us, std::memory_order_relaxed);
+    uint64_t prev_max = wait_us_max_.load(std::memory_order_relaxed);
+    while (wait_us > prev_max && !wait_us_max_.compare_exchange_weak(prev_max, wait_us)) {}
+    Metrics::instance().db_acquire_wait_us.record(wait_us);
+
+    DbConnection* raw_connection = pooled.connection.get();
+    int exceptions_at_acquire = std::uncaught_exceptions();
+    Clock::time_point lent_at = Clock::now();
+    // 连接从借出到归还的时长记为一次查询耗时（含调用方在同一次借用里做的多条语句）
+    return std::shared_ptr<DbConnection>(raw_connection, [this, pooled, exceptions_at_acquire, lent_at](DbConnection*) mutable {
+        pooled.is_suspect = std::uncaught_exceptions() > exceptions_at_acquire;
+        pooled.last_used = Clock::now();
+        Metrics::instance().db_query_us.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(pooled.last_used - lent_at).count()));
+        release(std::move(pooled));
+    });
+}
+
+void DBPool::release(PooledSession pooled) {
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex_);
+        --in_use_count_;
+        idle_sessions_.push_back(std::move(pooled));
+    }
+    available_cv_.notify_one();
+}
+
+// 调用方已把该连接从计数里移出（不在 idle 也不在 in_use）。
+// 一个连接坏了多半是 MySQL 重启过，其余空闲连接也都先校验再借出
+void DBPool::discard_locked() {
+    --total_count_;
+    ++pending_replacements_;
+    for (auto& pooled : idle_sessions_) pooled.is_suspect = true;
+    available_cv_.notify_one();
+    maintenance_cv_.notify_one();
+}
+
+void DBPool::on_connected_locked() {
+    if (pending_replacements_ == 0) return;
+    --pending_replacements_;
+    reconnect_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 后台：补足 min_size、校验久未验证或可疑的空闲连接、回收多余的冷连接
+void DBPool::maintenance_loop() {
+    bool was_connect_failing = false;
+    std::unique_lock<std::mutex> lock_guard(mutex_);
+    while (!is_stopping_) {
+        auto now = Clock::now();
+        std::vector<PooledSession> to_check;
+        std::vector<PooledSession> to_close;
+        for (auto it = idle_sessions_.begin(); it != idle_sessions_.end();) {
+            if (total_count_ - to_close.size() > options_.min_size && now - it->last_used > options_.idle_timeout) {
+                to_close.push_back(std::move(*it));
+                it = idle_sessions_.erase(it);
+            } else if (it->is_suspect || now - it->last_validated > options_.idle_check_interval) {
+                to_check.push_back(std::move(*it));
+                it = idle_sessions_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        total_count_ -= to_close.size();
+        size_t shortfall = total_count_ < options_.min_size ? options_.min_size - total_count_ : 0;
+        total_count_ += shortfall;  // 先占位，避免与按需增长一起超出 max_size
+        lock_guard.unlock();
+
+        to_close.clear();
+        std::vector<PooledSession> healthy;
+        size_t broken_count = 0;
+        for (auto& pooled : to_check) {
+            if (validate(pooled.connection)) {
+                pooled.last_validated = Clock::now();
+                pooled.is_suspect = false;
+                healthy.push_back(std::move(pooled));
+            } else {
+                ++broken_count;
+            }
+        }
+        to_check.clear();
+        std::vector<std::shared_ptr<DbConnection>> opened;
+        size_t failed_count = 0;
+        for (size_t i = 0; i < shortfall; ++i) {
+            try {
+                opened.push_back(create_connection(options_.connect_timeout));
+            } catch (const std::exception& ex) {
+                // MySQL 不可达时剩下的也不用试了；只在开始失败时记一次日志
+                if (!was_connect_failing) CHAT_LOG_ERROR("DBPool cannot reach MySQL", { {"error", ex.what()} });
+                failed_count = shortfall - i;
+                break;
+            }
+        }
+        if (failed_count == 0 && was_connect_failing) CHAT_LOG_INFO("DBPool reconnected to MySQL");
+        was_connect_failing = failed_count > 0;
+
+        lock_guard.lock();
+        total_count_ -= failed_count;
+        for (size_t i = 0; i < broken_count; ++i) discard_locked();
+        auto opened_at = Clock::now();
+        for (auto& connection_ptr : opened) {
+            on_connected_locked();
+            idle_sessions_.push_front(PooledSession{ std::move(connection_ptr), opened_at, opened_at, false });
+        }
+        for (auto& pooled : healthy) idle_sessions_.push_back(std::move(pooled));
+        if (!opened.empty() || !healthy.empty() || failed_count > 0) available_cv_.notify_all();
+        // 有坏连接待替换时立刻再来一轮，否则按周期醒来
+        if (pending_replacements_ > 0 && broken_count > 0 && failed_count == 0) continue;
+        maintenance_cv_.wait_for(lock_guard, options_.maintenance_interval, [this]() { return is_stopping_; });
+    }
+}
+
+DBPoolStats DBPool::stats() const {
+    DBPoolStats snapshot;
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex_);
+        snapshot.total = total_count_;
+        snapshot.idle = idle_sessions_.size();
+        snapshot.in_use = in_use_count_;
+        snapshot.waiting = waiting_count_;
+    }
+    snapshot.acquires = acquire_count_.load(std::memory_order_relaxed);
+    snapshot.acquire_timeouts = acquire_timeout_count_.load(std::memory_order_relaxed);
+    snapshot.wait_us_total = wait_us_total_.load(std::memory_order_relaxed);
+    snapshot.wait_us_max = wait_us_max_.load(std::memory_order_relaxed);
+    snapshot.connects = connect_count_.load(std::memory_order_relaxed);
+    snapshot.connect_failures = connect_failure_count_.load(std::memory_order_relaxed);
+    snapshot.validation_failures = validation_failure_count_.load(std::memory_order_relaxed);
+    snapshot.reconnects = reconnect_count_.load(std::memory_order_relaxed);
+    return snapshot;
+}
@@ -1,53 +1,122 @@
 ﻿#pragma once
 #include <mysqlx/xdevapi.h>
 #include <string>
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
 #include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 
-// 高可靠/无野指针的 MySQL Session 连接池
+struct DbConnection;
+
+struct DBPoolOptions {
+    size_t min_size = 2;                                    // 后台维持的最少连接数，启动时不阻塞
+    size_t max_size = 10;                                   // 按需增长的上限
+    std::chrono::milliseconds acquire_timeout{2000};        // 借不到连接时最多等这么久，超时抛 DBUnavailable
+    std::chrono::milliseconds connect_timeout{2000};        // 建一条连接的上限；acquire 里新开时再受剩余等待时间限制
+    std::chrono::milliseconds validate_after_idle{5000};    // 空闲超过该时长的连接借出前先 SELECT 1
+    std::chrono::milliseconds idle_check_interval{30000};   // 后台校验空闲连接的周期
+    std::chrono::milliseconds idle_timeout{60000};          // 超过 min_size 的连接空闲这么久就关闭
+    std::chrono::milliseconds maintenance_interval{1000};   // 后台线程醒来的间隔，也是连不上时的重试间隔
+    // 为空时连 MySQL。基准测试换成不连库的替身：返回空指针表示一条没有会话的占位连接，借还照常、不做校验
+    std::function<std::shared_ptr<DbConnection>()> connection_factory;
+};
+
+struct DBPoolStats {
+    uint64_t total = 0;                 // 已打开（含借出、空闲、正在校验）
+    uint64_t idle = 0;
+    uint64_t in_use = 0;
+    uint64_t waiting = 0;               // 正在等连接的线程数
+    uint64_t acquires = 0;
+    uint64_t acquire_timeouts = 0;
+    uint64_t wait_us_total = 0;
+    uint64_t wait_us_max = 0;
+    uint64_t connects = 0;
+    uint64_t connect_failures = 0;
+    uint64_t validation_failures = 0;
+    uint64_t reconnects = 0;            // 坏连接被丢弃后重新打开的次数
+};
+
+// 池里的一条连接：schema/表句柄和热路径上的参数化语句在建连时构造一次，之后每次借出直接复用。
+// X DevAPI 对同一个 CRUD 语句对象改 bind 值再执行时会在服务端预编译，只改 limit 不会重新预编译
+struct DbConnection {
+    DbConnection(const std::string& host, unsigned port, const std::string& username, const std::string& password,
+                 std::chrono::milliseconds connect_timeout);
+
+    mysqlx::Session session;
+    mysqlx::Schema schema;
+    mysqlx::Table users_table;
+    mysqlx::Table messages_table;
+    mysqlx::TableSelect user_password_lookup;   // :username -> id, password
+    mysqlx::TableSelect user_id_lookup;         // :username -> id
+    mysqlx::TableSelect recent_page;            // :bound -> 公共频道 id < bound 的一页，调用方设 limit
+};
+
+// 连接池暂时给不出连接（MySQL 不可达或等待超时）；调用方应当按请求失败处理
+struct DBUnavailable : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// MySQL 连接池：懒打开、按需增长、后台校验并替换坏连接。
+// 借出的是带归还删除器的 shared_ptr，析构即归还
 class DBPool {
 public:
-    DBPool(const std::string& host, unsigned port, const std::string& username, const std::string& password, size_t connection_pool_size)
-        : host_(host), port_(port), username_(username), password_(password), connection_pool_size_(connection_pool_size) {
-        for (size_t i = 0; i < connection_pool_size_; ++i) {
-            available_sessions_.push(create_session());
-        }
-    }
-
-    // 线程安全获取 session：只返回管理好生命周期的 shared_ptr，析构即归还
-    std::shared_ptr<mysqlx::Session> acquire_session() {
-        std::unique_lock<std::mutex> lock_guard(mutex_);
-        while (available_sessions_.empty()) condition_variable_.wait(lock_guard);
-        auto session_ptr = available_sessions_.front();
-        available_sessions_.pop();
-        // 归还池时一定用原始 shared_ptr归队，避免裸指针包装问题
-        return std::shared_ptr<mysqlx::Session>(
-            session_ptr.get(),
-            [this, session_ptr](mysqlx::Session* /*ptr*/) mutable {
-                std::unique_lock<std::mutex> lock_guard(mutex_);
-                available_sessions_.push(session_ptr);
-                condition_variable_.notify_one();
-            }
-        );
-    }
+    DBPool(const std::string& host, unsigned port, const std::string& username, const std::string& password,
+           const DBPoolOptions& options = DBPoolOptions());
+    ~DBPool();
+    DBPool(const DBPool&) = delete;
+    DBPool& operator=(const DBPool&) = delete;
+
+    // 线程安全；超时或连不上时抛 DBUnavailable
+    std::shared_ptr<DbConnection> acquire();
+    // 池外单独开一条连接，不计入 max_size、也不校验，由调用方一直持有（会话级的命名锁用）。连不上时抛 DBUnavailable
+    std::shared_ptr<DbConnection> open_connection() { return create_connection(options_.connect_timeout); }
+    size_t max_size() const { return options_.max_size; }
+    DBPoolStats stats() const;
 
 private:
-    std::shared_ptr<mysqlx::Session> create_session() {
-        try {
-            auto* raw_session = new mysqlx::Session(host_, port_, username_, password_);
-            return std::shared_ptr<mysqlx::Session>(raw_session, [](mysqlx::Session* s){ if(s) delete s; });
-        } catch (const mysqlx::Error& e) {
-            throw std::runtime_error(std::string("Failed to connect to MySQL: ") + e.what());
-        }
-    }
+    using Clock = std::chrono::steady_clock;
+    struct PooledSession {
+        std::shared_ptr<DbConnection> connection;
+        Clock::time_point last_used;
+        Clock::time_point last_validated;
+        bool is_suspect = false;        // 归还时调用方正在因异常退栈，下次借出前必须先校验
+    };
+
+    std::shared_ptr<DbConnection> create_connection(std::chrono::milliseconds connect_timeout);
+    bool validate(const std::shared_ptr<DbConnection>& connection);
+    std::shared_ptr<DbConnection> lend(PooledSession pooled, Clock::time_point wait_start);
+    void release(PooledSession pooled);
+    void discard_locked();
+    void on_connected_locked();
+    void maintenance_loop();
 
     std::string host_, username_, password_;
     unsigned port_;
-    size_t connection_pool_size_;
-    std::queue<std::shared_ptr<mysqlx::Session>> available_sessions_;
-    std::mutex mutex_;
-    std::condition_variable condition_variable_;
-};
\ No newline at end of file
+    DBPoolOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable available_cv_;
+    std::condition_variable maintenance_cv_;
+    std::deque<PooledSession> idle_sessions_;       // 从尾部借还，冷连接沉在头部等着被回收
+    size_t total_count_ = 0;
+    size_t in_use_count_ = 0;
+    size_t waiting_count_ = 0;
+    size_t pending_replacements_ = 0;               // 丢弃了但还没重新打开的坏连接数
+    bool is_stopping_ = false;
+    std::thread maintenance_thread_;
+
+    std::atomic<uint64_t> acquire_count_{0};
+    std::atomic<uint64_t> acquire_timeout_count_{0};
+    std::atomic<uint64_t> wait_us_total_{0};
+    std::atomic<uint64_t> wait_us_max_{0};
+    std::atomic<uint64_t> connect_count_{0};
+    std::atomic<uint64_t> connect_failure_count_{0};
+    std::atomic<uint64_t> validation_failure_count_{0};
+    std::atomic<uint64_t> reconnect_count_{0};
+};
@@ -0,0 +1,208 @@
+﻿#include "history_cache.hpp"
+#include <algorithm>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+static bool entry_id_less(const HistoryEntryPtr& entry, uint64_t id) { return entry->message.id < id; }
+
+HistoryCache::HistoryCache(const HistoryCacheOptions& options) : options_(options) {
+    if (options_.public_capacity == 0) options_.public_capacity = 1;
+    if (options_.private_capacity == 0) options_.private_capacity = 1;
+    if (options_.max_users == 0) options_.max_users = 1;
+}
+
+static json message_json(const ChatMsg& message) {
+    return {
+        {"type", message.is_private() ? "private" : "message"},
+        {"id", message.id},
+        {"from", message.from_name()},
+        {"to", message.to_name()},
+        {"text", message.text},
+        {"ts", message.ts}
+    };
+}
+
+const std::string& HistoryEntry::cbor_bytes() const {
+    std::call_once(cbor_once_, [this]() { json::to_cbor(message_json(message), cbor_bytes_); });
+    return cbor_bytes_;
+}
+
+HistoryEntryPtr HistoryCache::make_entry(const ChatMsg& message) {
+    auto entry = std::make_shared<HistoryEntry>();
+    entry->message = message;
+    entry->json_text = message_json(message).dump();
+    return entry;
+}
+
+void HistoryCache::trim(Sequence& sequence, size_t capacity) {
+    if (sequence.entries.size() <= capacity) return;
+    while (sequence.entries.size() > capacity) {
+        sequence.entries.pop_front();
+        eviction_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 淘汰后覆盖区间从剩余最旧一条开始
+    sequence.has_all = false;
+    sequence.covered_from = sequence.entries.front()->message.id;
+}
+
+// id 基本单调递增，但多个 I/O 线程分配 id 与写入缓存之间没有锁，偶尔会乱序
+void HistoryCache::insert_sorted(Sequence& sequence, const HistoryEntryPtr& entry, size_t capacity) {
+    uint64_t id = entry->message.id;
+    auto& entries = sequence.entries;
+    if (entries.empty() || entries.back()->message.id < id) {
+        entries.push_back(entry);
+    } else {
+        auto pos = std::lower_bound(entries.begin(), entries.end(), id, entry_id_less);
+        if (pos != entries.end() && (*pos)->message.id == id) return;
+        entries.insert(pos, entry);
+    }
+    sequence.covered_from = std::min(sequence.covered_from, id);
+    trim(sequence, capacity);
+}
+
+void HistoryCache::merge_page(Sequence& sequence, const std::vector<HistoryEntryPtr>& page,
+                              uint64_t page_floor, bool is_complete, size_t capacity) {
+    std::deque<HistoryEntryPtr> merged;
+    auto old_it = sequence.entries.begin();
+    auto page_it = page.begin();
+    while (old_it != sequence.entries.end() || page_it != page.end()) {
+        if (page_it == page.end()) { merged.push_back(*old_it++); continue; }
+        if (old_it == sequence.entries.end()) { merged.push_back(*page_it++); continue; }
+        uint64_t old_id = (*old_it)->message.id;
+        uint64_t page_id = (*page_it)->message.id;
+        if (old_id < page_id) merged.push_back(*old_it++);
+        else if (page_id < old_id) merged.push_back(*page_it++);
+        else { merged.push_back(*old_it++); ++page_it; }
+    }
+    sequence.entries.swap(merged);
+    if (is_complete) sequence.has_all = true;
+    else sequence.covered_from = std::min(sequence.covered_from, page_floor);
+    trim(sequence, capacity);
+}
+
+HistoryCache::UserTail& HistoryCache::touch_user(UserId user_id) {
+    auto it = user_tails_.find(user_id);
+    if (it != user_tails_.end()) {
+        user_lru_.splice(user_lru_.begin(), user_lru_, it->second.lru_it);
+        return it->second;
+    }
+    while (user_tails_.size() >= options_.max_users && !user_lru_.empty()) {
+        user_tails_.erase(user_lru_.back());
+        user_lru_.pop_back();
+        eviction_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    user_lru_.push_front(user_id);
+    UserTail& tail = user_tails_[user_id];
+    tail.lru_it = user_lru_.begin();
+    return tail;
+}
+
+void HistoryCache::append(const HistoryEntryPtr& entry) {
+    const ChatMsg& message = entry->message;
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    if (!message.is_private()) {
+        insert_sorted(public_, entry, options_.public_capacity);
+        return;
+    }
+    // 私信同时进入收发双方的尾部；对方不在缓存里也建一段，保证尚未落库的消息不会漏掉
+    insert_sorted(touch_user(message.from_id).sequence, entry, options_.private_capacity);
+    if (message.to_id != message.from_id)
+        insert_sorted(touch_user(message.to_id).sequence, entry, options_.private_capacity);
+}
+
+bool HistoryCache::lookup(UserId user_id, size_t count, uint64_t before_id,
+                          std::vector<HistoryEntryPtr>& out, bool record_stats) {
+    out.clear();
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    auto miss = [&]() {
+        if (record_stats) miss_count_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    };
+    if (!is_public_loaded_) return miss();
+
+    static const std::deque<HistoryEntryPtr> kEmpty;
+    const std::deque<HistoryEntryPtr>* private_entries = &kEmpty;
+    uint64_t floor = public_.floor();
+    if (user_id != 0) {
+        // 未登录（user_id 为 0）只看公共频道；否则必须有该用户的私信尾部
+        if (user_tails_.find(user_id) == user_tails_.end()) return miss();
+        const Sequence& tail = touch_user(user_id).sequence;
+        private_entries = &tail.entries;
+        floor = std::max(floor, tail.floor());
+    }
+    if (floor == UINT64_MAX) return miss();
+
+    uint64_t upper = before_id ? before_id : UINT64_MAX;
+    auto public_end = std::lower_bound(public_.entries.begin(), public_.entries.end(), upper, entry_id_less);
+    auto private_end = std::lower_bound(private_entries->begin(), private_entries->end(), upper, entry_id_less);
+    size_t public_index = static_cast<size_t>(public_end - public_.entries.begin());
+    size_t private_index = static_cast<size_t>(private_end - private_entries->begin());
+
+    // 从新到旧归并两段序列，只使用覆盖区间 [floor, upper) 内的条目
+    while (out.size() < count && (public_index > 0 || private_index > 0)) {
+        const HistoryEntryPtr* pick;
+        if (private_index == 0) pick = &public_.entries[--public_index];
+        else if (public_index == 0) pick = &(*private_entries)[--private_index];
+        else if (public_.entries[public_index - 1]->message.id > (*private_entries)[private_index - 1]->message.id)
+            pick = &public_.entries[--public_index];
+        else pick = &(*private_entries)[--private_index];
+        if ((*pick)->message.id < floor) break;
+        out.push_back(*pick);
+    }
+    if (out.size() < count && floor > 0) {
+        out.clear();
+        return miss();
+    }
+    std::reverse(out.begin(), out.end());
+    if (record_stats) hit_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool HistoryCache::is_public_warm() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return is_public_loaded_;
+}
+
+void HistoryCache::fill_public(const std::vector<ChatMsg>& newest_page, size_t requested) {
+    std::vector<HistoryEntryPtr> page;
+    page.reserve(newest_page.size());
+    for (const auto& message : newest_page) page.push_back(make_entry(message));
+    uint64_t page_floor = page.empty() ? UINT64_MAX : page.front()->message.id;
+
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    merge_page(public_, page, page_floor, newest_page.size() < requested, options_.public_capacity);
+    is_public_loaded_ = true;
+}
+
+void HistoryCache::fill_user(UserId user_id, const std::vector<ChatMsg>& newest_page, size_t requested) {
+    if (user_id == 0 || requested == 0) return;
+    // 页内最旧一条（无论公共还是私信）以上的私信都已包含在页中
+    std::vector<HistoryEntryPtr> page;
+    for (const auto& message : newest_page) {
+        if (message.is_private()) page.push_back(make_entry(message));
+    }
+    uint64_t page_floor = newest_page.empty() ? UINT64_MAX : newest_page.front().id;
+
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    merge_page(touch_user(user_id).sequence, page, page_floor, newest_page.size() < requested, options_.private_capacity);
+}
+
+void HistoryCache::clear() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    public_ = Sequence();
+    is_public_loaded_ = false;
+    user_tails_.clear();
+    user_lru_.clear();
+}
+
+HistoryCacheStats HistoryCache::stats() {
+    HistoryCacheStats snapshot;
+    snapshot.hits = hit_count_.load(std::memory_order_relaxed);
+    snapshot.misses = miss_count_.load(std::memory_order_relaxed);
+    snapshot.evictions = eviction_count_.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    snapshot.public_size = public_.entries.size();
+    snapshot.user_count = user_tails_.size();
+    return snapshot;
+}
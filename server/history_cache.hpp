@@ -0,0 +1,91 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include "chat_msg.hpp"
+
+// 缓存条目：消息本身 + 预先序列化好的 JSON，登录回放时直接下发。
+// CBOR 编码在第一次有 CBOR 客户端翻到这条时才生成
+struct HistoryEntry {
+    ChatMsg message;
+    std::string json_text;
+
+    const std::string& cbor_bytes() const;
+
+private:
+    mutable std::once_flag cbor_once_;
+    mutable std::string cbor_bytes_;
+};
+using HistoryEntryPtr = std::shared_ptr<const HistoryEntry>;
+
+struct HistoryCacheOptions {
+    size_t public_capacity = 1000;   // 公共频道环形缓冲长度
+    size_t private_capacity = 200;   // 每个用户私信尾部长度
+    size_t max_users = 10000;        // 私信尾部最多缓存的用户数（LRU 淘汰）
+};
+
+struct HistoryCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t public_size = 0;
+    uint64_t user_count = 0;
+};
+
+// 按会话分的热历史缓存：公共频道一个环形缓冲，每个用户一段私信尾部。
+// 每段序列记录自己“完整覆盖”的 id 下界，只有在覆盖范围内才能命中，
+// 否则回落到 MySQL，再用查询结果回填。
+class HistoryCache {
+public:
+    explicit HistoryCache(const HistoryCacheOptions& options = HistoryCacheOptions());
+
+    static HistoryEntryPtr make_entry(const ChatMsg& message);
+
+    // 写穿：push 时调用
+    void append(const HistoryEntryPtr& entry);
+    // 命中返回 true，out 为按 id 正序的最多 count 条
+    bool lookup(UserId user_id, size_t count, uint64_t before_id,
+                std::vector<HistoryEntryPtr>& out, bool record_stats = true);
+    bool is_public_warm();
+    // 用 MySQL 查询结果回填（仅 before_id == 0 的最新一页能与已有覆盖区间拼接）
+    void fill_public(const std::vector<ChatMsg>& newest_page, size_t requested);
+    void fill_user(UserId user_id, const std::vector<ChatMsg>& newest_page, size_t requested);
+    void clear();
+
+    HistoryCacheStats stats();
+
+private:
+    struct Sequence {
+        std::deque<HistoryEntryPtr> entries;        // 按 id 递增
+        uint64_t covered_from = UINT64_MAX;         // [covered_from, +inf) 内的消息都在 entries 里
+        bool has_all = false;                       // 该序列的全部消息都在 entries 里
+        uint64_t floor() const { return has_all ? 0 : covered_from; }
+    };
+    struct UserTail {
+        Sequence sequence;
+        std::list<UserId>::iterator lru_it;
+    };
+
+    void insert_sorted(Sequence& sequence, const HistoryEntryPtr& entry, size_t capacity);
+    void merge_page(Sequence& sequence, const std::vector<HistoryEntryPtr>& page,
+                    uint64_t page_floor, bool is_complete, size_t capacity);
+    void trim(Sequence& sequence, size_t capacity);
+    UserTail& touch_user(UserId user_id);
+
+    HistoryCacheOptions options_;
+    std::mutex mutex_;
+    Sequence public_;
+    bool is_public_loaded_ = false;
+    std::unordered_map<UserId, UserTail> user_tails_;
+    std::list<UserId> user_lru_;        // 头部最近使用
+
+    std::atomic<uint64_t> hit_count_{0};
+    std::atomic<uint64_t> miss_count_{0};
+    std::atomic<uint64_t> eviction_count_{0};
+};
@@ -0,0 +1,72 @@
+﻿#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "io_context_pool.hpp"
+#include "logger.hpp"
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// 把当前线程绑到第 cpu_index 个逻辑核上；失败只记日志
+static void pin_current_thread(size_t cpu_index) {
+#ifdef _WIN32
+    if (cpu_index < 64 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu_index) == 0) {
+        CHAT_LOG_WARN("Failed to pin worker thread", { {"cpu", static_cast<uint64_t>(cpu_index)} });
+    }
+#elif defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu_index % CPU_SETSIZE, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+        CHAT_LOG_WARN("Failed to pin worker thread", { {"cpu", static_cast<uint64_t>(cpu_index)} });
+    }
+#else
+    (void)cpu_index;
+#endif
+}
+
+IoContextPool::IoContextPool(size_t context_count, size_t threads_per_context, bool pin_threads)
+    : threads_per_context_(threads_per_context == 0 ? 1 : threads_per_context), pin_threads_(pin_threads) {
+    if (context_count == 0) context_count = 1;
+    for (size_t i = 0; i < context_count; ++i) {
+        // 每核模式下每个 context 只有一个线程，告诉 asio 省掉内部锁的并发提示
+        int concurrency_hint = threads_per_context_ == 1 ? 1 : static_cast<int>(threads_per_context_);
+        contexts_.push_back(std::make_unique<Context>(concurrency_hint));
+        work_guards_.push_back(boost::asio::make_work_guard(*contexts_.back()));
+    }
+}
+
+void IoContextPool::run() {
+    size_t worker_index = 0;
+    for (size_t context_index = 0; context_index < contexts_.size(); ++context_index) {
+        for (size_t i = 0; i < threads_per_context_; ++i, ++worker_index) {
+            threads_.emplace_back([this, context_index, worker_index]() {
+                if (pin_threads_) pin_current_thread(worker_index);
+                std::cout << "[worker " << worker_index << "] thread running on context " << context_index << "!" << std::endl;
+                contexts_[context_index]->run();
+                std::cout << "[worker " << worker_index << "] thread exiting!" << std::endl;
+            });
+        }
+    }
+}
+
+void IoContextPool::stop() {
+    work_guards_.clear();
+    for (auto& context : contexts_) context->stop();
+}
+
+void IoContextPool::join() {
+    for (auto& thread : threads_) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+void IoContextPool::shutdown() {
+    for (auto& context : contexts_) context->shutdown();
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+#include <boost/asio.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// 一组 io_context 及其工作线程。
+// 共享模式：1 个 context × N 个线程（原来的模型）；
+// 每核模式：N 个 context × 各 1 个线程，可选绑核，连接从接入到断开都留在同一个线程上
+class IoContextPool {
+public:
+    IoContextPool(size_t context_count, size_t threads_per_context, bool pin_threads);
+    IoContextPool(const IoContextPool&) = delete;
+    IoContextPool& operator=(const IoContextPool&) = delete;
+
+    size_t size() const { return contexts_.size(); }
+    bool is_per_core() const { return contexts_.size() > 1; }
+    boost::asio::io_context& context(size_t index) { return *contexts_[index]; }
+
+    void run();    // 启动全部工作线程
+    void stop();
+    void join();
+    // join 之后调用：销毁各 context 里尚未执行的回调和挂起的异步操作，释放其中持有的会话。
+    // 即 io_context 析构的前半段，context 本身仍在，绑在上面的 socket / 定时器之后照常析构
+    void shutdown();
+
+private:
+    using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+    // execution_context::shutdown() 是 protected，这里公开出来
+    struct Context : boost::asio::io_context {
+        using boost::asio::io_context::io_context;
+        using boost::asio::execution_context::shutdown;
+    };
+
+    std::vector<std::unique_ptr<Context>> contexts_;
+    std::vector<WorkGuard> work_guards_;
+    std::vector<std::thread> threads_;
+    size_t threads_per_context_;
+    bool pin_threads_;
+};
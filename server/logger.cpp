@@ -4,9 +4,80 @@
 #include <sstream>
 #include <cstdlib>
 #include <cctype>
+#include <cstdio>
+#include <vector>
 
 namespace fs = std::filesystem;
 
+// 有界多生产者队列（Vyukov MPMC 环形缓冲）：入队只有一次 CAS，不加锁
+class Logger::RecordQueue {
+public:
+    explicit RecordQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask_ = size - 1;
+        slots_.reset(new Slot[size]);
+        for (size_t i = 0; i < size; ++i) slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(LogRecord& record) {
+        Slot* slot;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &slots_[pos & mask_];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->record = std::move(record);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(LogRecord& record) {
+        Slot* slot;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            slot = &slots_[pos & mask_];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        record = std::move(slot->record);
+        slot->record = LogRecord();
+        slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size_approx() const {
+        size_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        LogRecord record;
+    };
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<size_t> dequeue_pos_{0};
+};
+
 Logger& Logger::instance() {
     static Logger inst;
     return inst;
@@ -14,23 +85,33 @@ Logger& Logger::instance() {
 
 Logger::Logger()
     : file_path_("logs/server.log"),
-      log_level_(LogLevel::Info),
+      service_name_("chat_server"),
+      log_level_(static_cast<int>(LogLevel::Info)),
       max_file_size_(10ull * 1024 * 1024),
+      current_file_size_(0),
       file_rotate_count_(5),
       is_initialized_(false) {
 }
 
 Logger::~Logger() {
+    shutdown();
     std::lock_guard<std::mutex> lock_guard(log_mutex_);
     if (output_file_stream_.is_open()) output_file_stream_.close();
 }
 
 void Logger::init(const std::string& file_path, LogLevel level, std::uint64_t max_size_bytes, int rotate_count) {
     std::lock_guard<std::mutex> lock_guard(log_mutex_);
+    init_locked(file_path, level, max_size_bytes, rotate_count);
+}
+
+void Logger::init_locked(const std::string& file_path, LogLevel level, std::uint64_t max_size_bytes, int rotate_count) {
     file_path_ = file_path;
-    log_level_ = level;
+    log_level_.store(static_cast<int>(level), std::memory_order_relaxed);
     max_file_size_ = max_size_bytes;
     file_rotate_count_ = rotate_count;
+    // 环境变量只在初始化时读一次
+    const char* service_env = std::getenv("SERVICE_NAME");
+    service_name_ = service_env ? service_env : "chat_server";
 
     fs::path dir = fs::path(file_path_).parent_path();
     if (!dir.empty() && !fs::exists(dir)) {
@@ -40,10 +121,79 @@ void Logger::init(const std::string& file_path, LogLevel level, std::uint64_t ma
     }
 
     if (output_file_stream_.is_open()) output_file_stream_.close();
-    output_file_stream_.open(file_path_, std::ios::app);
+    open_file_locked();
     is_initialized_ = true;
 }
 
+void Logger::init_from_env_locked() {
+    const char* env_file = std::getenv("LOG_FILE");
+    std::string file = env_file ? env_file : file_path_;
+    const char* env_level = std::getenv("LOG_LEVEL");
+    LogLevel env_log_level = static_cast<LogLevel>(log_level_.load(std::memory_order_relaxed));
+    if (env_level) {
+        std::string s(env_level);
+        for (auto &c: s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (s == "debug") env_log_level = LogLevel::Debug;
+        else if (s == "info") env_log_level = LogLevel::Info;
+        else if (s == "warn") env_log_level = LogLevel::Warn;
+        else if (s == "error") env_log_level = LogLevel::Err;
+    }
+    const char* env_max = std::getenv("LOG_MAX_SIZE");
+    std::uint64_t maxsz = max_file_size_;
+    if (env_max) {
+        try { maxsz = static_cast<std::uint64_t>(std::stoull(env_max)); } catch(...) {}
+    }
+    const char* env_rot = std::getenv("LOG_ROTATE_COUNT");
+    int rc = file_rotate_count_;
+    if (env_rot) {
+        try { rc = std::stoi(env_rot); } catch(...) {}
+    }
+    init_locked(file, env_log_level, maxsz, rc);
+}
+
+void Logger::enable_async(const AsyncLogOptions& options) {
+    std::lock_guard<std::mutex> lock_guard(log_mutex_);
+    if (is_async_.load()) return;
+    if (!is_initialized_) init_from_env_locked();
+    async_options_ = options;
+    if (async_options_.max_batch == 0) async_options_.max_batch = 1;
+    async_queue_ = std::make_unique<RecordQueue>(async_options_.queue_capacity);
+    is_stopping_.store(false);
+    writer_thread_ = std::thread([this]() { writer_loop(); });
+    is_async_.store(true, std::memory_order_release);
+}
+
+void Logger::shutdown() {
+    if (!is_async_.exchange(false)) return;
+    is_stopping_.store(true);
+    {
+        std::lock_guard<std::mutex> wake_lock(wake_mutex_);
+    }
+    wake_cv_.notify_one();
+    if (writer_thread_.joinable()) writer_thread_.join();
+
+    // 停止瞬间仍在入队的记录，这里同步写掉
+    std::string batch_text;
+    LogRecord record;
+    uint64_t record_count = 0;
+    while (async_queue_->try_pop(record)) {
+        format_record(record, batch_text);
+        ++record_count;
+    }
+    std::lock_guard<std::mutex> lock_guard(log_mutex_);
+    if (record_count) write_locked(batch_text, record_count);
+    if (output_file_stream_.is_open()) output_file_stream_.flush();
+}
+
+LoggerStats Logger::stats() const {
+    LoggerStats snapshot;
+    snapshot.written = written_count_.load(std::memory_order_relaxed);
+    snapshot.dropped = dropped_count_.load(std::memory_order_relaxed);
+    snapshot.rotations = rotation_count_.load(std::memory_order_relaxed);
+    if (is_async_.load(std::memory_order_acquire) && async_queue_) snapshot.queue_depth = async_queue_->size_approx();
+    return snapshot;
+}
+
 std::string Logger::level_to_string(LogLevel level) const {
     switch (level) {
         case LogLevel::Debug: return "debug";
@@ -54,9 +204,8 @@ std::string Logger::level_to_string(LogLevel level) const {
     }
 }
 
-std::string Logger::timestamp_iso() const {
+std::string Logger::timestamp_iso(std::chrono::system_clock::time_point now) const {
     using namespace std::chrono;
-    auto now = system_clock::now();
     auto ms = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
 
     std::time_t t = system_clock::to_time_t(now);
@@ -72,19 +221,23 @@ std::string Logger::timestamp_iso() const {
     return oss.str();
 }
 
-void Logger::rotate_if_needed_locked() {
+void Logger::open_file_locked() {
+    output_file_stream_.open(file_path_, std::ios::app);
+    std::error_code ec;
+    auto sz = fs::file_size(file_path_, ec);
+    current_file_size_ = ec ? 0 : static_cast<std::uint64_t>(sz);
+}
+
+void Logger::rotate_if_needed_locked(std::uint64_t incoming_bytes) {
     if (!output_file_stream_.is_open()) {
-        output_file_stream_.open(file_path_, std::ios::app);
+        open_file_locked();
         if (!output_file_stream_.is_open()) return;
     }
-
-    std::error_code ec;
-    auto sz = fs::file_size(file_path_, ec);
-    if (ec) return;
-    if (sz < max_file_size_) return;
+    if (current_file_size_ == 0 || current_file_size_ + incoming_bytes <= max_file_size_) return;
 
     output_file_stream_.close();
 
+    std::error_code ec;
     for (int i = file_rotate_count_ - 1; i >= 0; --i) {
         fs::path src = (i == 0) ? fs::path(file_path_) : fs::path(file_path_ + "." + std::to_string(i));
         fs::path dst = fs::path(file_path_ + "." + std::to_string(i + 1));
@@ -95,59 +248,105 @@ void Logger::rotate_if_needed_locked() {
         }
     }
 
-    output_file_stream_.open(file_path_, std::ios::app);
+    open_file_locked();
+    rotation_count_.fetch_add(1, std::memory_order_relaxed);
 }
 
-void Logger::log(LogLevel level, const std::string& message, const nlohmann::json& extra) {
-    if (static_cast<int>(level) < static_cast<int>(log_level_)) return;
+void Logger::format_record(const LogRecord& record, std::string& out) const {
+    nlohmann::json json_obj;
+    json_obj["timestamp"] = timestamp_iso(record.time);
+    json_obj["level"] = level_to_string(record.level);
+    json_obj["service"] = service_name_;
+    json_obj["thread_id"] = std::to_string(record.thread_hash);
+    json_obj["message"] = record.message;
+    if (!record.extra.is_null()) json_obj["extra"] = record.extra;
+    out += json_obj.dump();
+    out += '\n';
+}
 
-    std::lock_guard<std::mutex> lock_guard(log_mutex_);
-    if (!is_initialized_) {
-        const char* env_file = std::getenv("LOG_FILE");
-        std::string file = env_file ? env_file : file_path_;
-        const char* env_level = std::getenv("LOG_LEVEL");
-        LogLevel env_log_level = log_level_;
-        if (env_level) {
-            std::string s(env_level);
-            for (auto &c: s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
-            if (s == "debug") env_log_level = LogLevel::Debug;
-            else if (s == "info") env_log_level = LogLevel::Info;
-            else if (s == "warn") env_log_level = LogLevel::Warn;
-            else if (s == "error") env_log_level = LogLevel::Err;
-        }
-        const char* env_max = std::getenv("LOG_MAX_SIZE");
-        std::uint64_t maxsz = max_file_size_;
-        if (env_max) {
-            try { maxsz = static_cast<std::uint64_t>(std::stoull(env_max)); } catch(...) {}
+void Logger::write_locked(const std::string& text, uint64_t record_count) {
+    rotate_if_needed_locked(text.size());
+    if (output_file_stream_.is_open()) {
+        output_file_stream_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        current_file_size_ += text.size();
+    } else {
+        std::fwrite(text.data(), 1, text.size(), stderr);
+    }
+    written_count_.fetch_add(record_count, std::memory_order_relaxed);
+}
+
+// 后台写线程：批量取出、格式化、一次写入；按 flush_interval 落盘
+void Logger::writer_loop() {
+    std::string batch_text;
+    LogRecord record;
+    auto last_flush = std::chrono::steady_clock::now();
+    while (true) {
+        size_t record_count = 0;
+        while (record_count < async_options_.max_batch && async_queue_->try_pop(record)) {
+            format_record(record, batch_text);
+            ++record_count;
         }
-        const char* env_rot = std::getenv("LOG_ROTATE_COUNT");
-        int rc = file_rotate_count_;
-        if (env_rot) {
-            try { rc = std::stoi(env_rot); } catch(...) {}
+        auto now = std::chrono::steady_clock::now();
+        bool should_flush = now - last_flush >= async_options_.flush_interval;
+        if (record_count || should_flush) {
+            std::lock_guard<std::mutex> lock_guard(log_mutex_);
+            if (record_count) write_locked(batch_text, record_count);
+            if (should_flush && output_file_stream_.is_open()) output_file_stream_.flush();
         }
-        init(file, env_log_level, maxsz, rc);
+        if (should_flush) last_flush = now;
+        batch_text.clear();
+        if (record_count == async_options_.max_batch) continue;
+        if (is_stopping_.load() && async_queue_->size_approx() == 0) break;
+
+        std::unique_lock<std::mutex> wake_lock(wake_mutex_);
+        is_writer_idle_.store(true);
+        wake_cv_.wait_for(wake_lock, async_options_.flush_interval, [this]() {
+            return is_stopping_.load() || async_queue_->size_approx() > 0;
+        });
+        is_writer_idle_.store(false);
     }
+    std::lock_guard<std::mutex> lock_guard(log_mutex_);
+    if (output_file_stream_.is_open()) output_file_stream_.flush();
+}
 
-    rotate_if_needed_locked();
+void Logger::log(LogLevel level, const std::string& message, const nlohmann::json& extra) {
+    if (!is_enabled(level)) return;
 
-    nlohmann::json json_obj;
-    json_obj["timestamp"] = timestamp_iso();
-    json_obj["level"] = level_to_string(level);
-    const char* service_env = std::getenv("SERVICE_NAME");
-    json_obj["service"] = service_env ? service_env : "chat_server";
-    json_obj["thread_id"] = std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
-    json_obj["message"] = message;
-    if (!extra.is_null()) json_obj["extra"] = extra;
+    LogRecord record;
+    record.level = level;
+    record.time = std::chrono::system_clock::now();
+    record.thread_hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    record.message = message;
+    record.extra = extra;
 
-    if (output_file_stream_.is_open()) {
-        output_file_stream_ << json_obj.dump() << "\n";
-        output_file_stream_.flush();
-    } else {
-        std::fprintf(stderr, "%s\n", json_obj.dump().c_str());
+    if (is_async_.load(std::memory_order_acquire)) {
+        if (!async_queue_->try_push(record)) {
+            if (async_options_.overflow_policy == LogOverflowPolicy::Drop) {
+                dropped_count_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            while (!async_queue_->try_push(record)) {
+                if (is_stopping_.load()) {
+                    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                wake_cv_.notify_one();
+                std::this_thread::yield();
+            }
+        }
+        if (is_writer_idle_.load(std::memory_order_relaxed)) wake_cv_.notify_one();
+        return;
     }
+
+    std::lock_guard<std::mutex> lock_guard(log_mutex_);
+    if (!is_initialized_) init_from_env_locked();
+    std::string line;
+    format_record(record, line);
+    write_locked(line, 1);
+    if (output_file_stream_.is_open()) output_file_stream_.flush();
 }
 
 void Logger::debug(const std::string& message, const nlohmann::json& extra) { log(LogLevel::Debug, message, extra); }
 void Logger::info(const std::string& message, const nlohmann::json& extra)  { log(LogLevel::Info,  message, extra); }
 void Logger::warn(const std::string& message, const nlohmann::json& extra)  { log(LogLevel::Warn,  message, extra); }
-void Logger::error(const std::string& message, const nlohmann::json& extra) { log(LogLevel::Err, message, extra); }
\ No newline at end of file
+void Logger::error(const std::string& message, const nlohmann::json& extra) { log(LogLevel::Err, message, extra); }
@@ -4,10 +4,35 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <nlohmann/json.hpp>
 
 enum class LogLevel { Debug = 0, Info = 1, Warn = 2, Err = 3 };
 
+// 编译期最低日志级别：低于它的 CHAT_LOG_* 调用整个被编译器删掉（0=Debug ... 3=Err）
+#ifndef CHAT_LOG_MIN_LEVEL
+#define CHAT_LOG_MIN_LEVEL 0
+#endif
+
+// 异步队列满时的策略：丢弃并计数，或阻塞调用方直到有空位
+enum class LogOverflowPolicy { Drop, Block };
+
+struct AsyncLogOptions {
+    size_t queue_capacity = 16384;                       // 向上取整到 2 的幂
+    size_t max_batch = 1024;                             // 后台线程一次最多取出的记录数
+    std::chrono::milliseconds flush_interval{200};       // 落盘（flush）间隔
+    LogOverflowPolicy overflow_policy = LogOverflowPolicy::Drop;
+};
+
+struct LoggerStats {
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+    uint64_t queue_depth = 0;
+    uint64_t rotations = 0;
+};
+
 class Logger {
 public:
     static Logger& instance();
@@ -17,6 +42,18 @@ public:
               std::uint64_t max_size_bytes = 10ull * 1024 * 1024,
               int rotate_count = 5);
 
+    // 切换到异步模式：调用方只把记录放进无锁队列，由后台线程格式化、批量写入和轮转
+    void enable_async(const AsyncLogOptions& options = AsyncLogOptions());
+    // 停止后台线程，写完队列里剩余的记录
+    void shutdown();
+    LoggerStats stats() const;
+
+    // 运行期级别检查：一次 relaxed 原子读，不构造任何参数
+    bool is_enabled(LogLevel level) const {
+        return static_cast<int>(level) >= log_level_.load(std::memory_order_relaxed);
+    }
+    void set_level(LogLevel level) { log_level_.store(static_cast<int>(level), std::memory_order_relaxed); }
+
     void log(LogLevel level, const std::string& message, const nlohmann::json& extra = nlohmann::json());
 
     void debug(const std::string& message, const nlohmann::json& extra = nlohmann::json());
@@ -25,20 +62,64 @@ public:
     void error(const std::string& message, const nlohmann::json& extra = nlohmann::json());
 
 private:
+    struct LogRecord {
+        LogLevel level = LogLevel::Info;
+        std::chrono::system_clock::time_point time;
+        std::size_t thread_hash = 0;
+        std::string message;
+        nlohmann::json extra;
+    };
+    class RecordQueue;
+
     Logger();
     ~Logger();
     Logger(const Logger&) = delete;
     Logger& operator=(const Logger&) = delete;
 
     std::string level_to_string(LogLevel level) const;
-    std::string timestamp_iso() const;
-    void rotate_if_needed_locked();
+    std::string timestamp_iso(std::chrono::system_clock::time_point now) const;
+    void init_locked(const std::string& file_path, LogLevel level, std::uint64_t max_size_bytes, int rotate_count);
+    void init_from_env_locked();
+    void open_file_locked();
+    void rotate_if_needed_locked(std::uint64_t incoming_bytes);
+    void format_record(const LogRecord& record, std::string& out) const;
+    void write_locked(const std::string& text, uint64_t record_count);
+    void writer_loop();
 
     std::mutex log_mutex_;
     std::ofstream output_file_stream_;
     std::string file_path_;
-    LogLevel log_level_;
+    std::string service_name_;
+    std::atomic<int> log_level_;
     std::uint64_t max_file_size_;
+    std::uint64_t current_file_size_;     // 自己累计写入字节数，轮转判断不再每行 stat 文件
     int file_rotate_count_;
     bool is_initialized_;
-};
\ No newline at end of file
+
+    AsyncLogOptions async_options_;
+    std::unique_ptr<RecordQueue> async_queue_;
+    std::atomic<bool> is_async_{false};
+    std::atomic<bool> is_writer_idle_{false};
+    std::atomic<bool> is_stopping_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::thread writer_thread_;
+
+    std::atomic<uint64_t> written_count_{0};
+    std::atomic<uint64_t> dropped_count_{0};
+    std::atomic<uint64_t> rotation_count_{0};
+};
+
+// 推荐的调用方式：先判断级别，再求值 message / extra。
+// 级别关闭时 extra 里的 json 构造、dump()、脱敏等表达式都不会执行
+#define CHAT_LOG(level, ...)                                                           \
+    do {                                                                               \
+        if (static_cast<int>(level) >= CHAT_LOG_MIN_LEVEL &&                           \
+            Logger::instance().is_enabled(level))                                      \
+            Logger::instance().log(level, __VA_ARGS__);                                \
+    } while (0)
+
+#define CHAT_LOG_DEBUG(...) CHAT_LOG(LogLevel::Debug, __VA_ARGS__)
+#define CHAT_LOG_INFO(...)  CHAT_LOG(LogLevel::Info, __VA_ARGS__)
+#define CHAT_LOG_WARN(...)  CHAT_LOG(LogLevel::Warn, __VA_ARGS__)
+#define CHAT_LOG_ERROR(...) CHAT_LOG(LogLevel::Err, __VA_ARGS__)
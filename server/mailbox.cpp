@@ -0,0 +1,46 @@
+﻿#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "mailbox.hpp"
+#include "session.hpp"
+
+Mailbox::~Mailbox() {
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    while (node) {
+        Node* next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+void Mailbox::push(std::shared_ptr<Session> session, FramePtr frame, FrameClass frame_class) {
+    Node* node = new Node{ std::move(session), std::move(frame), frame_class, head_.load(std::memory_order_relaxed) };
+    while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+    deliveries_.fetch_add(1, std::memory_order_relaxed);
+    if (!is_drain_scheduled_.exchange(true, std::memory_order_acq_rel)) {
+        boost::asio::post(io_context_, [this]() { drain(); });
+    }
+}
+
+void Mailbox::drain() {
+    // 先清标志再摘链：之后压入的投递会再安排一次 drain，不会被漏掉
+    is_drain_scheduled_.store(false, std::memory_order_release);
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+    if (!node) return;
+    drains_.fetch_add(1, std::memory_order_relaxed);
+    Node* ordered = nullptr;
+    while (node) {
+        Node* next = node->next;
+        node->next = ordered;
+        ordered = node;
+        node = next;
+    }
+    while (ordered) {
+        Node* next = ordered->next;
+        ordered->session->enqueue(ordered->frame, ordered->frame_class);
+        delete ordered;
+        ordered = next;
+    }
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <boost/asio.hpp>
+#include "protocol.hpp"
+
+class Session;
+
+// 每核模式下每个 io_context 一个投递信箱：其他线程往这里无锁压入 (会话, 帧)，
+// 一批只向目标 context post 一次 drain，由属主线程按 FIFO 交给各会话入队。
+// 广播扇出到 N 个会话时，跨线程的 post 次数从 N 次降到每个 context 一次
+class Mailbox {
+public:
+    explicit Mailbox(boost::asio::io_context& io_context) : io_context_(io_context) {}
+    ~Mailbox();
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    // 任意线程可调用
+    void push(std::shared_ptr<Session> session, FramePtr frame, FrameClass frame_class);
+    // 只能在属主线程上调用：把已压入的投递全部交付
+    void drain();
+    bool is_owner_thread() const { return io_context_.get_executor().running_in_this_thread(); }
+    boost::asio::io_context& context() { return io_context_; }
+    uint64_t deliveries() const { return deliveries_.load(std::memory_order_relaxed); }
+    uint64_t drains() const { return drains_.load(std::memory_order_relaxed); }
+
+private:
+    struct Node {
+        std::shared_ptr<Session> session;
+        FramePtr frame;
+        FrameClass frame_class;
+        Node* next;
+    };
+
+    boost::asio::io_context& io_context_;
+    std::atomic<Node*> head_{nullptr};              // 后进先出的栈，drain 时整体摘下再反转
+    std::atomic<bool> is_drain_scheduled_{false};
+    std::atomic<uint64_t> deliveries_{0};           // 经信箱转交的帧数
+    std::atomic<uint64_t> drains_{0};               // 实际交付过帧的 drain 次数，deliveries/drains 即平均批量
+};
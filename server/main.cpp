@@ -1,11 +1,13 @@
 ﻿#include <iostream>
 #include <boost/asio.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <thread>
 #include <mysqlx/xdevapi.h>
 #include "server.hpp"
 #include "logger.hpp"
 #include "db_pool.hpp"
+#include "io_context_pool.hpp"
+#include "blocking_executor.hpp"
+#include "metrics_server.hpp"
 
 // 全局未捕获异常钩子
 void custom_terminate_handler() {
@@ -19,10 +21,21 @@ int main(int argc, char** argv) {
     try {
         unsigned short server_port = 9000;
         if (argc > 1) server_port = static_cast<unsigned short>(std::stoi(argv[1]));
+        // 指标端口只监听本机，第三个参数可改
+        unsigned short metrics_port = 9100;
+        if (argc > 3) metrics_port = static_cast<unsigned short>(std::stoi(argv[3]));
+        // 执行模型：默认共享一个 io_context；第二个参数为 per_core 时每个线程一个 io_context 并绑核
+        bool is_context_per_core = argc > 2 && std::string(argv[2]) == "per_core";
+        bool pin_worker_threads = true;
         std::cout << "Starting server..." << std::endl;
 
         try {
             Logger::instance().init("logs/server.log", LogLevel::Debug, 10ull * 1024 * 1024, 5);
+            AsyncLogOptions log_options;
+            log_options.queue_capacity = 16384;
+            log_options.flush_interval = std::chrono::milliseconds(200);
+            log_options.overflow_policy = LogOverflowPolicy::Drop;
+            Logger::instance().enable_async(log_options);
             std::cout << "Logger initialized" << std::endl;
         } catch (...) {
             std::cout << "Logger initialization failed!" << std::endl;
@@ -30,49 +43,100 @@ int main(int argc, char** argv) {
 
         std::unique_ptr<DBPool> db_pool_ptr;
         try {
-            db_pool_ptr = std::make_unique<DBPool>("127.0.0.1", 33060, "root", "mypassword", 10);
+            DBPoolOptions db_pool_options;
+            db_pool_options.min_size = 2;
+            db_pool_options.max_size = 10;
+            db_pool_options.acquire_timeout = std::chrono::milliseconds(2000);
+            db_pool_options.connect_timeout = std::chrono::milliseconds(2000);
+            db_pool_options.validate_after_idle = std::chrono::milliseconds(5000);
+            db_pool_options.idle_check_interval = std::chrono::milliseconds(30000);
+            db_pool_options.idle_timeout = std::chrono::milliseconds(60000);
+            db_pool_options.maintenance_interval = std::chrono::milliseconds(1000);
+            db_pool_ptr = std::make_unique<DBPool>("127.0.0.1", 33060, "root", "mypassword", db_pool_options);
             std::cout << "DBPool created OK!" << std::endl;
         } catch (const std::exception& ex) {
             std::cerr << "Fatal error: DBPool construction failed: " << ex.what() << std::endl;
             return 1;
         }
-        UserStore user_store(db_pool_ptr.get());
-        MessageStore message_store(db_pool_ptr.get());
+        // users.id <-> 用户名的驻留表，UserStore 和 MessageStore 共用
+        UserNames user_names(db_pool_ptr.get());
+        // 口令校验值的 PBKDF2 派生在独立的小线程池里跑，登录风暴时不占 DB 线程也不占 I/O 线程
+        BlockingExecutor auth_executor(2);
+        UserDirectoryOptions directory_options;
+        directory_options.positive_ttl = std::chrono::minutes(10);
+        directory_options.negative_ttl = std::chrono::seconds(5);
+        directory_options.max_entries = 100000;
+        directory_options.verifier_iterations = 10000;
+        UserStore user_store(db_pool_ptr.get(), &user_names, &auth_executor, directory_options);
+        MessageStoreOptions store_options;
+        store_options.batch_size = 256;
+        store_options.linger = std::chrono::milliseconds(5);
+        store_options.queue_capacity = 65536;
+        MessageStore message_store(db_pool_ptr.get(), &user_names, store_options);
+        // 阻塞的 MySQL 调用都在这里跑，线程数与连接池一致
+        BlockingExecutor db_executor(db_pool_ptr->max_size());
 
-        boost::asio::io_context io_context;
-        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_guard(io_context.get_executor());
-
-        auto keep_alive_timer = std::make_shared<boost::asio::steady_timer>(io_context, std::chrono::seconds(1));
-        std::function<void()> tick_function;
-        tick_function = [keep_alive_timer, &tick_function]() {
-            keep_alive_timer->expires_after(std::chrono::seconds(1));
-            keep_alive_timer->async_wait([keep_alive_timer, &tick_function](const boost::system::error_code& ec) {
-                std::cout << "[dummy timer] keepalive tick, error='" << ec.message() << "'" << std::endl;
-                tick_function();
-            });
-        };
-        tick_function();
+        size_t thread_count = std::thread::hardware_concurrency();
+        if (thread_count == 0) thread_count = 2;
+        IoContextPool context_pool(is_context_per_core ? thread_count : 1, is_context_per_core ? 1 : thread_count,
+                                   is_context_per_core && pin_worker_threads);
+        boost::asio::io_context& io_context = context_pool.context(0);
 
-        Server server(io_context, server_port, &user_store, &message_store);
+        ServerOptions server_options;
+        server_options.write_coalesce_max_bytes = 256 * 1024;
+        server_options.write_coalesce_max_buffers = 64;
+        server_options.presence_flush_interval = std::chrono::milliseconds(100);
+        server_options.write_queue_high_bytes = 4 * 1024 * 1024;
+        server_options.write_queue_low_bytes = 1024 * 1024;
+        server_options.write_queue_high_frames = 8192;
+        server_options.write_queue_low_frames = 1024;
+        server_options.write_queue_max_bytes = 16 * 1024 * 1024;
+        server_options.slow_consumer_policy = SlowConsumerPolicy::Resync;
+        server_options.total_queued_bytes_high = 256 * 1024 * 1024;
+        server_options.max_frame_bytes = 1024 * 1024;
+        server_options.receive_chunk_bytes = 4096;
+        server_options.receive_pool.max_class_bytes = 1024 * 1024;
+        server_options.receive_pool.max_cached_bytes = 64 * 1024 * 1024;
+        server_options.max_deferred_requests = 256;
+        Server server(context_pool, server_port, &user_store, &message_store, &db_executor, &auth_executor, server_options);
         server.run_accept();
 
-        size_t thread_count = std::thread::hardware_concurrency();
-        if (thread_count == 0) thread_count = 2;
-        std::vector<std::thread> worker_threads;
-        for (size_t i = 0; i < thread_count; ++i) {
-            worker_threads.emplace_back([&io_context, i]() {
-                std::cout << "[worker " << i << "] thread running!" << std::endl;
-                io_context.run();
-                std::cout << "[worker " << i << "] thread exiting!" << std::endl;
-            });
+        // 原来的 keepalive 空转定时器已去掉：IoContextPool 的 work guard 保证 run() 不会提前返回
+        MetricsSources metrics_sources;
+        metrics_sources.server = &server;
+        metrics_sources.db_pool = db_pool_ptr.get();
+        std::unique_ptr<MetricsServer> metrics_server;
+        try {
+            metrics_server = std::make_unique<MetricsServer>(io_context, "127.0.0.1", metrics_port, metrics_sources);
+            metrics_server->run_accept();
+            std::cout << "Metrics endpoint on 127.0.0.1:" << metrics_port << "/metrics" << std::endl;
+        } catch (const std::exception& ex) {
+            // 指标端口被占用不影响聊天服务
+            CHAT_LOG_ERROR("Metrics endpoint failed to start", { {"port", static_cast<uint64_t>(metrics_port)}, {"what", ex.what()} });
+            std::cerr << "Metrics endpoint failed to start: " << ex.what() << std::endl;
         }
+
+        // SIGINT/SIGTERM：停掉全部 io_context，工作线程退出后关监听 socket、把写后队列里的消息落库
+        boost::asio::signal_set signals(io_context, SIGINT, SIGTERM);
+        signals.async_wait([&context_pool](const boost::system::error_code& ec, int signal_number) {
+            if (ec) return;
+            std::cout << "Signal " << signal_number << " received, shutting down..." << std::endl;
+            context_pool.stop();
+        });
+
+        context_pool.run();
         std::cout << "Waiting for worker threads to exit..." << std::endl;
-        for (auto& thread : worker_threads) thread.join();
+        context_pool.join();
 
-        while (true) {
-            std::cout << "[main] thread still alive!" << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(10));
-        }
+        // 按所有权倒序收尾：先跑完阻塞任务（它们会把结果 post 回已停下的 context），
+        // 再把写后队列落库，最后销毁 context 里挂着的回调，让其中的会话在 Server 之前释放
+        db_executor.stop();
+        auth_executor.stop();
+        server.stop_accept();
+        message_store.stop();
+        context_pool.shutdown();
+        CHAT_LOG_INFO("Server stopped", { {"committed", message_store.stats().committed}, {"failed", message_store.stats().failed} });
+        std::cout << "Server stopped" << std::endl;
     }
     catch (const std::exception& ex) {
         std::cerr << "Fatal error (main): " << ex.what() << std::endl;
@@ -0,0 +1,256 @@
+﻿#include "message_codec.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+
+using json = nlohmann::json;
+
+namespace {
+
+// 顶层字段一次收集，类型字段可能出现在任意位置，解析完再组装成具体请求
+struct RequestFields {
+    std::string type;
+    std::string username;
+    std::string password;
+    std::string to;
+    std::string text;
+    std::optional<uint64_t> n;
+    std::optional<uint64_t> before_id;
+    std::vector<std::string> formats;
+    std::vector<std::string> compression;
+};
+
+enum class FieldKey { Type, Username, Password, To, Text, N, BeforeId, Formats, Compression, Other };
+
+FieldKey lookup_key(const std::string& key) {
+    static const std::unordered_map<std::string, FieldKey> kKeys = {
+        {"type", FieldKey::Type}, {"username", FieldKey::Username}, {"password", FieldKey::Password},
+        {"to", FieldKey::To}, {"text", FieldKey::Text}, {"n", FieldKey::N}, {"before_id", FieldKey::BeforeId},
+        {"formats", FieldKey::Formats}, {"compression", FieldKey::Compression}
+    };
+    auto it = kKeys.find(key);
+    return it != kKeys.end() ? it->second : FieldKey::Other;
+}
+
+class RequestSax {
+public:
+    explicit RequestSax(RequestFields& fields) : fields_(fields) {}
+
+    bool null() { return value_done(); }
+    bool boolean(bool) { return value_done(); }
+    bool number_integer(json::number_integer_t value) {
+        if (value >= 0) set_number(static_cast<uint64_t>(value));
+        return value_done();
+    }
+    bool number_unsigned(json::number_unsigned_t value) {
+        set_number(value);
+        return value_done();
+    }
+    bool number_float(json::number_float_t value, const json::string_t&) {
+        // NaN 和 >= 2^64 的值转 uint64_t 是未定义行为，按解析错误拒绝
+        if (std::isnan(value) || value >= 18446744073709551616.0) {
+            error_ = "number out of range";
+            return false;
+        }
+        if (value >= 0) set_number(static_cast<uint64_t>(value));
+        return value_done();
+    }
+    bool string(json::string_t& value) {
+        if (depth_ == 2 && array_key_ == FieldKey::Formats) {
+            fields_.formats.push_back(std::move(value));
+            return true;
+        }
+        if (depth_ == 2 && array_key_ == FieldKey::Compression) {
+            fields_.compression.push_back(std::move(value));
+            return true;
+        }
+        if (depth_ == 1) {
+            switch (current_key_) {
+                case FieldKey::Type:     fields_.type = std::move(value); break;
+                case FieldKey::Username: fields_.username = std::move(value); break;
+                case FieldKey::Password: fields_.password = std::move(value); break;
+                case FieldKey::To:       fields_.to = std::move(value); break;
+                case FieldKey::Text:     fields_.text = std::move(value); break;
+                default: break;
+            }
+        }
+        return value_done();
+    }
+    bool binary(json::binary_t&) { return value_done(); }
+    bool start_object(std::size_t) {
+        if (depth_ == 0 && is_root_seen_) return false;
+        is_root_seen_ = true;
+        ++depth_;
+        return true;
+    }
+    bool key(json::string_t& key) {
+        if (depth_ == 1) current_key_ = lookup_key(key);
+        return true;
+    }
+    bool end_object() {
+        --depth_;
+        return value_done();
+    }
+    bool start_array(std::size_t) {
+        if (depth_ == 0) return false;   // 顶层必须是对象
+        if (depth_ == 1) array_key_ = current_key_;   // 顶层字符串数组（formats / compression）
+        ++depth_;
+        return true;
+    }
+    bool end_array() {
+        --depth_;
+        if (depth_ == 1) array_key_ = FieldKey::Other;
+        return value_done();
+    }
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) {
+        error_ = ex.what();
+        return false;
+    }
+
+    bool is_object() const { return is_root_seen_ && depth_ == 0; }
+    const std::string& error() const { return error_; }
+
+private:
+    void set_number(uint64_t value) {
+        if (depth_ != 1) return;
+        if (current_key_ == FieldKey::N) fields_.n = value;
+        else if (current_key_ == FieldKey::BeforeId) fields_.before_id = value;
+    }
+    bool value_done() {
+        if (depth_ == 1) current_key_ = FieldKey::Other;
+        return true;
+    }
+
+    RequestFields& fields_;
+    FieldKey current_key_ = FieldKey::Other;
+    int depth_ = 0;
+    bool is_root_seen_ = false;
+    FieldKey array_key_ = FieldKey::Other;
+    std::string error_;
+};
+
+RequestType lookup_type(const std::string& type_name) {
+    static const std::unordered_map<std::string, RequestType> kTypes = {
+        {"register", RequestType::Register}, {"login", RequestType::Login},
+        {"message", RequestType::Message}, {"private", RequestType::Private},
+        {"heartbeat", RequestType::Heartbeat}, {"history", RequestType::History},
+        {"list_users", RequestType::ListUsers}, {"logout", RequestType::Logout},
+        {"hello", RequestType::Hello}
+    };
+    auto it = kTypes.find(type_name);
+    return it != kTypes.end() ? it->second : RequestType::Unknown;
+}
+
+// 每个请求都要打点，用按线程分片的计数，多个 I/O 线程之间不争同一条缓存行
+struct DecodeCounters {
+    std::array<Counter, kRequestTypeCount> per_type;
+    Counter parse_errors;
+    Histogram parse_ns{1000ull * 1000 * 1000};
+};
+
+DecodeCounters& counters() {
+    static DecodeCounters instance;
+    return instance;
+}
+
+void record_parse_time(uint64_t elapsed_ns) {
+    counters().parse_ns.record(elapsed_ns);
+}
+
+} // namespace
+
+bool decode_request(const uint8_t* data, size_t length, DecodedRequest& out, std::string& error) {
+    auto start_time = std::chrono::steady_clock::now();
+    RequestFields fields;
+    RequestSax sax(fields);
+    auto input_format = detect_wire_format(data, length) == WireFormat::Cbor ? json::input_format_t::cbor : json::input_format_t::json;
+    bool is_parsed = json::sax_parse(data, data + length, &sax, input_format) && sax.is_object();
+    record_parse_time(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time).count()));
+    if (!is_parsed) {
+        counters().parse_errors.add();
+        error = sax.error().empty() ? "top-level value is not an object" : sax.error();
+        return false;
+    }
+
+    out.type = lookup_type(fields.type);
+    out.type_name = std::move(fields.type);
+    switch (out.type) {
+        case RequestType::Register:
+            out.body = RegisterRequest{ std::move(fields.username), std::move(fields.password) };
+            break;
+        case RequestType::Login:
+            out.body = LoginRequest{ std::move(fields.username), std::move(fields.password) };
+            break;
+        case RequestType::Message:
+            out.body = ChatRequest{ std::move(fields.text) };
+            break;
+        case RequestType::Private:
+            out.body = PrivateRequest{ std::move(fields.to), std::move(fields.text) };
+            break;
+        case RequestType::History:
+            out.body = HistoryRequest{ fields.n, fields.before_id.value_or(0) };
+            break;
+        case RequestType::Hello:
+            out.body = HelloRequest{ std::move(fields.formats), std::move(fields.compression) };
+            break;
+        default:
+            out.body = EmptyRequest{};
+            break;
+    }
+    counters().per_type[static_cast<size_t>(out.type)].add();
+    return true;
+}
+
+const char* request_type_name(RequestType type) {
+    switch (type) {
+        case RequestType::Register:  return "register";
+        case RequestType::Login:     return "login";
+        case RequestType::Message:   return "message";
+        case RequestType::Private:   return "private";
+        case RequestType::Heartbeat: return "heartbeat";
+        case RequestType::History:   return "history";
+        case RequestType::ListUsers: return "list_users";
+        case RequestType::Logout:    return "logout";
+        case RequestType::Hello:     return "hello";
+        default: return "unknown";
+    }
+}
+
+std::string preview_text(const std::string& text, size_t max_length) {
+    if (text.size() <= max_length) return text;
+    return text.substr(0, max_length) + "...";
+}
+
+nlohmann::json request_log_view(const DecodedRequest& request) {
+    json view_json = { {"type", request.type_name} };
+    if (auto* reg = std::get_if<RegisterRequest>(&request.body)) {
+        view_json["username"] = reg->username;
+        view_json["password"] = "<REDACTED>";
+    } else if (auto* login = std::get_if<LoginRequest>(&request.body)) {
+        view_json["username"] = login->username;
+        view_json["password"] = "<REDACTED>";
+    } else if (auto* chat = std::get_if<ChatRequest>(&request.body)) {
+        view_json["text"] = preview_text(chat->text, 200);
+    } else if (auto* priv = std::get_if<PrivateRequest>(&request.body)) {
+        view_json["to"] = priv->to;
+        view_json["text"] = preview_text(priv->text, 200);
+    } else if (auto* history = std::get_if<HistoryRequest>(&request.body)) {
+        if (history->count) view_json["n"] = *history->count;
+        view_json["before_id"] = history->before_id;
+    } else if (auto* hello = std::get_if<HelloRequest>(&request.body)) {
+        view_json["formats"] = hello->formats;
+        view_json["compression"] = hello->compression;
+    }
+    return view_json;
+}
+
+DecodeStats decode_stats() {
+    DecodeStats snapshot;
+    for (size_t i = 0; i < kRequestTypeCount; ++i) snapshot.per_type[i] = counters().per_type[i].value();
+    snapshot.parse_errors = counters().parse_errors.value();
+    snapshot.parse_ns = counters().parse_ns.snapshot();
+    snapshot.parse_ns_total = snapshot.parse_ns.sum;
+    return snapshot;
+}
@@ -0,0 +1,54 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "protocol.hpp"
+#include "metrics.hpp"
+
+// 客户端请求类型；Session 按这个枚举索引处理函数表
+enum class RequestType : uint8_t {
+    Register = 0, Login, Message, Private, Heartbeat, History, ListUsers, Logout, Hello, Unknown
+};
+constexpr size_t kRequestTypeCount = 10;
+
+struct RegisterRequest { std::string username; std::string password; };
+struct LoginRequest    { std::string username; std::string password; };
+struct ChatRequest     { std::string text; };
+struct PrivateRequest  { std::string to; std::string text; };
+struct HistoryRequest  { std::optional<uint64_t> count; uint64_t before_id = 0; };
+struct HelloRequest {
+    std::vector<std::string> formats;       // 客户端支持的编码，按偏好排序
+    std::vector<std::string> compression;   // 客户端支持的压缩算法，目前只有 "deflate"
+};
+struct EmptyRequest    {};   // heartbeat / list_users / logout / 未知类型
+
+using RequestBody = std::variant<EmptyRequest, RegisterRequest, LoginRequest, ChatRequest, PrivateRequest, HistoryRequest, HelloRequest>;
+
+struct DecodedRequest {
+    RequestType type = RequestType::Unknown;
+    std::string type_name;
+    RequestBody body;
+};
+
+// 直接在接收缓冲区上做一次 SAX 解析，得到带类型的请求；不构造 json DOM。
+// JSON 和 CBOR 负载都接受，按首字节区分（见 detect_wire_format）。
+// 失败返回 false，error 为解析错误描述
+bool decode_request(const uint8_t* data, size_t length, DecodedRequest& out, std::string& error);
+
+const char* request_type_name(RequestType type);
+// 用于调试日志的已脱敏视图（不含密码，正文截断）
+nlohmann::json request_log_view(const DecodedRequest& request);
+std::string preview_text(const std::string& text, size_t max_length = 200);
+
+struct DecodeStats {
+    std::array<uint64_t, kRequestTypeCount> per_type{};
+    uint64_t parse_errors = 0;
+    uint64_t parse_ns_total = 0;
+    HistogramSnapshot parse_ns;                 // 单个请求的解析耗时（纳秒）
+};
+
+DecodeStats decode_stats();
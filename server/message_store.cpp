@@ -1,67 +1,473 @@
 ﻿#include "message_store.hpp"
 #include "db_pool.hpp"
+#include "user_names.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
 #include <mysqlx/xdevapi.h>
 #include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
 
-void MessageStore::push(const ChatMsg& message) {
-    try {
-        auto session_ptr = db_pool_->acquire_session();
-        auto database_schema = session_ptr->getSchema("chatdb");
-        auto messages_table = database_schema.getTable("messages");
-        messages_table.insert("sender", "recipient", "text", "ts")
-             .values(message.from,
-                     message.to.empty() ? mysqlx::Value() : message.to,
-                     message.text,
-                     static_cast<int64_t>(message.ts))
-             .execute();
-    } catch (const mysqlx::Error& ex) {
-        Logger::instance().error("Insert message failed", {{"error", ex.what()}});
+// 行里只有 id；用户名由 attach_names 统一补
+static ChatMsg row_to_chat_msg(const mysqlx::Row& row) {
+    ChatMsg message;
+    message.id = static_cast<uint64_t>(row[0].get<int64_t>());
+    message.from_id = static_cast<UserId>(row[1].get<int64_t>());
+    message.to_id = row[2].isNull() ? 0 : static_cast<UserId>(row[2].get<int64_t>());
+    message.text = row[3].get<std::string>();
+    message.ts = static_cast<uint64_t>(row[4].get<int64_t>());
+    return message;
+}
+
+static int64_t cursor_bound(uint64_t before_id) {
+    return before_id ? static_cast<int64_t>(before_id) : std::numeric_limits<int64_t>::max();
+}
+
+MessageStore::MessageStore(DBPool* db_pool, UserNames* user_names, const MessageStoreOptions& options)
+    : db_pool_(db_pool), user_names_(user_names), options_(options), history_cache_(options.history_cache) {
+    if (options_.batch_size == 0) options_.batch_size = 1;
+    if (options_.queue_capacity < options_.batch_size) options_.queue_capacity = options_.batch_size;
+    writer_thread_ = std::thread([this]() { writer_loop(); });
+}
+
+MessageStore::~MessageStore() {
+    stop();
+}
+
+void MessageStore::stop() {
+    {
+        std::lock_guard<std::mutex> lock_guard(queue_mutex_);
+        if (is_stopping_) return;
+        is_stopping_ = true;
     }
+    not_empty_cv_.notify_all();
+    not_full_cv_.notify_all();
+    if (writer_thread_.joinable()) writer_thread_.join();
+    CHAT_LOG_INFO("MessageStore writer stopped", {
+        {"committed", committed_count_.load()}, {"failed", failed_count_.load()}
+    });
 }
 
-std::vector<ChatMsg> MessageStore::recent(size_t count) {
-    std::vector<ChatMsg> messages;
+static const char* const kWriterLockName = "chatdb.message_writer";
+
+// 首次使用时先抢写者锁再取 MAX(id)；写线程启动时就先做一次，I/O 线程上的 try_push 通常不必等它。
+// 锁被别的实例占着时不分配 id，消息按 MySQL 不可用处理
+bool MessageStore::ensure_id_sequence() {
+    if (is_id_ready_.load(std::memory_order_acquire)) return true;
+    std::lock_guard<std::mutex> lock_guard(id_mutex_);
+    if (is_id_ready_.load(std::memory_order_relaxed)) return true;
+    return claim_writer_lock_locked();
+}
+
+// GET_LOCK 的锁随会话存在：连接断开（如 MySQL 重启）锁就没了，要在新连接上重新抢。
+// 抢到后再读 MAX(id)，下一个 id 只会往上调，已分配、还在队列里的 id 不受影响
+bool MessageStore::claim_writer_lock_locked() {
+    if (writer_lock_connection_ && !is_writer_lock_suspect_) return true;
+    if (writer_lock_connection_) {
+        bool is_held = false;
+        try {
+            auto row = writer_lock_connection_->session.sql("SELECT IS_USED_LOCK(?) = CONNECTION_ID()")
+                           .bind(kWriterLockName).execute().fetchOne();
+            is_held = !row[0].isNull() && row[0].get<int64_t>() == 1;
+        } catch (const std::exception& ex) {
+            CHAT_LOG_WARN("Message writer lock check failed", {{"error", ex.what()}});
+        }
+        if (is_held) {
+            is_writer_lock_suspect_ = false;
+            return true;
+        }
+        CHAT_LOG_WARN("Message writer lock lost, reclaiming", {{"lock", kWriterLockName}});
+        writer_lock_connection_.reset();
+    }
     try {
-        auto session_ptr = db_pool_->acquire_session();
-        auto database_schema = session_ptr->getSchema("chatdb");
-        auto messages_table = database_schema.getTable("messages");
-        auto row_result = messages_table.select("sender", "recipient", "text", "ts").execute();
-        std::vector<mysqlx::Row> all_rows = row_result.fetchAll();
-        for (size_t i = all_rows.size(); i > 0 && messages.size() < count; --i) {
-            const auto& row = all_rows[i-1];
-            messages.push_back(ChatMsg{
-                row[0].get<std::string>(),
-                row[1].isNull() ? "" : row[1].get<std::string>(),
-                row[2].get<std::string>(),
-                static_cast<uint64_t>(row[3].get<int64_t>())
+        auto connection_ptr = db_pool_->open_connection();
+        auto lock_row = connection_ptr->session.sql("SELECT GET_LOCK(?, 0)").bind(kWriterLockName).execute().fetchOne();
+        if (lock_row[0].isNull() || lock_row[0].get<int64_t>() != 1) {
+            if (!is_writer_lock_contended_) {
+                CHAT_LOG_ERROR("Another server instance holds the message writer lock; refusing messages", {{"lock", kWriterLockName}});
+                std::cerr << "Another server instance holds " << kWriterLockName << "; messages are refused until it exits" << std::endl;
+            }
+            is_writer_lock_contended_ = true;
+            return false;
+        }
+        auto row = connection_ptr->session.sql("SELECT COALESCE(MAX(id), 0) FROM chatdb.messages").execute().fetchOne();
+        uint64_t floor_id = static_cast<uint64_t>(row[0].get<int64_t>()) + 1;
+        uint64_t current_id = next_id_.load(std::memory_order_relaxed);
+        while (current_id < floor_id && !next_id_.compare_exchange_weak(current_id, floor_id)) {}
+        writer_lock_connection_ = std::move(connection_ptr);
+        is_writer_lock_suspect_ = false;
+        if (is_writer_lock_contended_) CHAT_LOG_INFO("Message writer lock acquired", {{"lock", kWriterLockName}});
+        is_writer_lock_contended_ = false;
+        is_id_ready_.store(true, std::memory_order_release);
+        return true;
+    } catch (const std::exception& ex) {
+        // 不能退回 AUTO_INCREMENT：自增 id 与之后显式分配的 id 会撞车，整批回滚。下次 push 再试
+        CHAT_LOG_WARN("Message id sequence unavailable", {{"error", ex.what()}});
+        return false;
+    }
+}
+
+// 每批写入前确认锁仍在手里；没有就不写，批次按暂时性失败留在队首
+bool MessageStore::hold_writer_lock() {
+    std::lock_guard<std::mutex> lock_guard(id_mutex_);
+    return claim_writer_lock_locked();
+}
+
+uint64_t MessageStore::allocate_id() {
+    if (!ensure_id_sequence()) return 0;
+    return next_id_.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void count_message(const ChatMsg& message) {
+    if (message.is_private()) Metrics::instance().messages_private.add();
+    else Metrics::instance().messages_public.add();
+}
+
+uint64_t MessageStore::push(const ChatMsg& message) {
+    ChatMsg stamped_message = message;
+    stamped_message.id = allocate_id();
+    if (!stamped_message.id) {
+        rejected_count_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    count_message(stamped_message);
+    history_cache_.append(HistoryCache::make_entry(stamped_message));
+    std::unique_lock<std::mutex> lock_guard(queue_mutex_);
+    if (is_stopping_) {
+        // 写线程已退出：退化为同步写入，保证不丢消息
+        lock_guard.unlock();
+        std::vector<ChatMsg> batch{ stamped_message };
+        if (!write_batch(batch)) {
+            failed_count_.fetch_add(1, std::memory_order_relaxed);
+            CHAT_LOG_ERROR("Message lost: store stopped and MySQL unavailable", { {"id", stamped_message.id} });
+        }
+        return stamped_message.id;
+    }
+    if (pending_queue_.size() >= options_.queue_capacity) {
+        backpressure_waits_.fetch_add(1, std::memory_order_relaxed);
+        CHAT_LOG_WARN("MessageStore queue full, applying backpressure", {
+            {"queue_depth", static_cast<uint64_t>(pending_queue_.size())}
+        });
+        not_full_cv_.wait(lock_guard, [this]() {
+            return is_stopping_ || pending_queue_.size() < options_.queue_capacity;
+        });
+    }
+    pending_queue_.push_back(stamped_message);
+    enqueued_count_.fetch_add(1, std::memory_order_relaxed);
+    bool should_wake = pending_queue_.size() == 1 || pending_queue_.size() >= options_.batch_size;
+    lock_guard.unlock();
+    if (should_wake) not_empty_cv_.notify_one();
+    return stamped_message.id;
+}
+
+bool MessageStore::try_push(ChatMsg& message) {
+    if (!is_id_ready_.load(std::memory_order_acquire)) return false;
+    std::unique_lock<std::mutex> lock_guard(queue_mutex_);
+    if (is_stopping_ || pending_queue_.size() >= options_.queue_capacity) return false;
+    message.id = next_id_.fetch_add(1, std::memory_order_relaxed);
+    count_message(message);
+    pending_queue_.push_back(message);
+    enqueued_count_.fetch_add(1, std::memory_order_relaxed);
+    bool should_wake = pending_queue_.size() == 1 || pending_queue_.size() >= options_.batch_size;
+    lock_guard.unlock();
+    if (should_wake) not_empty_cv_.notify_one();
+    history_cache_.append(HistoryCache::make_entry(message));
+    return true;
+}
+
+void MessageStore::writer_loop() {
+    ensure_id_sequence();
+    std::vector<ChatMsg> batch;
+    batch.reserve(options_.batch_size);
+    std::chrono::milliseconds backoff = options_.retry_backoff_initial;
+    size_t stop_retries = 0;
+    std::unique_lock<std::mutex> lock_guard(queue_mutex_);
+    while (true) {
+        not_empty_cv_.wait(lock_guard, [this]() { return is_stopping_ || !pending_queue_.empty(); });
+        if (pending_queue_.empty()) break; // is_stopping_ 且已排空
+
+        // 攒批：等到够一批或 linger 超时；停止时不再等待
+        if (!is_stopping_ && pending_queue_.size() < options_.batch_size) {
+            auto deadline = std::chrono::steady_clock::now() + options_.linger;
+            not_empty_cv_.wait_until(lock_guard, deadline, [this]() {
+                return is_stopping_ || pending_queue_.size() >= options_.batch_size;
             });
         }
-    } catch (const mysqlx::Error& ex) {}
-    return messages;
+
+        size_t take = std::min(options_.batch_size, pending_queue_.size());
+        for (size_t i = 0; i < take; ++i) {
+            batch.push_back(std::move(pending_queue_.front()));
+            pending_queue_.pop_front();
+        }
+        lock_guard.unlock();
+        not_full_cv_.notify_all();
+
+        bool is_done = write_batch(batch);
+        if (!is_done && is_stopping_ && ++stop_retries > options_.stop_retry_limit) {
+            // 停止时 MySQL 仍不可用：不能无限期挂住退出，剩下的消息记为丢失
+            failed_count_.fetch_add(batch.size(), std::memory_order_relaxed);
+            CHAT_LOG_ERROR("Dropping message batch at shutdown", { {"batch_size", static_cast<uint64_t>(batch.size())} });
+            is_done = true;
+        }
+        lock_guard.lock();
+        if (is_done) {
+            batch.clear();
+            backoff = options_.retry_backoff_initial;
+            continue;
+        }
+        // 暂时性失败：这些消息已分配 id、进了缓存并已广播，放回队首保持顺序，退避后重试。
+        // 队列可能因此暂时超出容量，push 端照常被背压挡住
+        retry_count_.fetch_add(1, std::memory_order_relaxed);
+        pending_queue_.insert(pending_queue_.begin(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        batch.clear();
+        not_empty_cv_.wait_for(lock_guard, backoff, [this]() { return is_stopping_; });
+        backoff = std::min(backoff * 2, options_.retry_backoff_max);
+    }
 }
 
-std::vector<ChatMsg> MessageStore::for_user(const std::string& username, size_t count) {
-    std::vector<ChatMsg> messages;
+// 服务端因行本身的数据拒绝插入（重复 id、外键、超长等），重试也不会成功；其余（断连、锁超时等）都按暂时性处理
+static bool is_rejected_row_error(const std::string& what) {
+    static const std::string kConnectorPrefix = "CDK Error: ";
+    static const char* const kRowErrors[] = {
+        "Duplicate entry", "Cannot add or update a child row", "Data too long", "Incorrect string value",
+        "Out of range value", "Column '"
+    };
+    size_t start = what.compare(0, kConnectorPrefix.size(), kConnectorPrefix) == 0 ? kConnectorPrefix.size() : 0;
+    for (const char* prefix : kRowErrors) {
+        if (what.compare(start, std::char_traits<char>::length(prefix), prefix) == 0) return true;
+    }
+    return false;
+}
+
+// 主键重复：id 只由本进程分配（见 claim_writer_lock_locked 的写者锁），只可能是之前某次提交其实已成功、只是应答丢了
+static bool is_duplicate_primary(const std::string& what) {
+    return what.find("Duplicate entry") != std::string::npos && what.find("PRIMARY'") != std::string::npos;
+}
+
+// 一个事务内多行 INSERT
+MessageStore::InsertResult MessageStore::insert_rows(const ChatMsg* messages, size_t count, std::string& error) {
     try {
-        auto session_ptr = db_pool_->acquire_session();
-        auto database_schema = session_ptr->getSchema("chatdb");
-        auto messages_table = database_schema.getTable("messages");
-        auto row_result = messages_table.select("sender", "recipient", "text", "ts")
-                        .where("recipient IS NULL OR recipient = :user OR sender = :user")
-                        .bind("user", username)
-                        .execute();
-        std::vector<mysqlx::Row> all_rows = row_result.fetchAll();
-        for (size_t i = all_rows.size(); i > 0 && messages.size() < count; --i) {
-            const auto& row = all_rows[i-1];
-            messages.push_back(ChatMsg{
-                row[0].get<std::string>(),
-                row[1].isNull() ? "" : row[1].get<std::string>(),
-                row[2].get<std::string>(),
-                static_cast<uint64_t>(row[3].get<int64_t>())
-            });
+        auto connection_ptr = db_pool_->acquire();
+        connection_ptr->session.startTransaction();
+        try {
+            // TableInsert 会累积行，不能跨批复用；表句柄来自连接缓存
+            auto insert_stmt = connection_ptr->messages_table.insert("id", "sender_id", "recipient_id", "text", "ts");
+            for (size_t i = 0; i < count; ++i) {
+                const ChatMsg& message = messages[i];
+                insert_stmt.values(static_cast<int64_t>(message.id),
+                                   static_cast<int64_t>(message.from_id),
+                                   message.to_id ? mysqlx::Value(static_cast<int64_t>(message.to_id)) : mysqlx::Value(),
+                                   message.text,
+                                   static_cast<int64_t>(message.ts));
+            }
+            insert_stmt.execute();
+            connection_ptr->session.commit();
+        } catch (...) {
+            try { connection_ptr->session.rollback(); } catch (...) {}
+            throw;
+        }
+        return InsertResult::Committed;
+    } catch (const DBUnavailable& ex) {
+        error = ex.what();
+        return InsertResult::Transient;
+    } catch (const mysqlx::Error& ex) {
+        error = ex.what();
+        return is_rejected_row_error(error) ? InsertResult::Rejected : InsertResult::Transient;
+    } catch (const std::exception& ex) {
+        error = ex.what();
+        return InsertResult::Transient;
+    }
+}
+
+// 返回 false 表示遇到暂时性错误，batch 里留下的是还没写进去的消息，由调用方重试。
+// 整批被拒时逐条重插，只丢被拒的那几条
+bool MessageStore::write_batch(std::vector<ChatMsg>& batch) {
+    if (batch.empty()) return true;
+    if (!hold_writer_lock()) return false;
+    auto start_time = std::chrono::steady_clock::now();
+    std::string error;
+    InsertResult result = insert_rows(batch.data(), batch.size(), error);
+    if (result == InsertResult::Committed) {
+        record_commit(batch.size(), static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time).count()));
+        return true;
+    }
+    if (result == InsertResult::Transient) {
+        CHAT_LOG_WARN("Insert message batch failed, will retry", {
+            {"error", error}, {"batch_size", static_cast<uint64_t>(batch.size())}
+        });
+        std::lock_guard<std::mutex> lock_guard(id_mutex_);
+        is_writer_lock_suspect_ = true;
+        return false;
+    }
+    CHAT_LOG_ERROR("Insert message batch rejected, retrying row by row", {
+        {"error", error}, {"batch_size", static_cast<uint64_t>(batch.size())}
+    });
+    for (size_t i = 0; i < batch.size(); ++i) {
+        start_time = std::chrono::steady_clock::now();
+        result = insert_rows(&batch[i], 1, error);
+        if (result == InsertResult::Committed) {
+            record_commit(1, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_time).count()));
+        } else if (result == InsertResult::Rejected && is_duplicate_primary(error)) {
+            CHAT_LOG_WARN("Message already committed by an earlier attempt", { {"id", batch[i].id} });
+        } else if (result == InsertResult::Rejected) {
+            failed_count_.fetch_add(1, std::memory_order_relaxed);
+            CHAT_LOG_ERROR("Message rejected by MySQL", { {"id", batch[i].id}, {"error", error} });
+        } else {
+            batch.erase(batch.begin(), batch.begin() + static_cast<std::ptrdiff_t>(i));
+            std::lock_guard<std::mutex> lock_guard(id_mutex_);
+            is_writer_lock_suspect_ = true;
+            return false;
         }
-    } catch (const mysqlx::Error& ex) {}
+    }
+    return true;
+}
+
+void MessageStore::record_commit(uint64_t batch_size, uint64_t elapsed_us) {
+    committed_count_.fetch_add(batch_size, std::memory_order_relaxed);
+    batch_count_.fetch_add(1, std::memory_order_relaxed);
+    commit_us_total_.fetch_add(elapsed_us, std::memory_order_relaxed);
+    uint64_t prev_max = max_batch_size_.load(std::memory_order_relaxed);
+    while (batch_size > prev_max && !max_batch_size_.compare_exchange_weak(prev_max, batch_size)) {}
+    prev_max = commit_us_max_.load(std::memory_order_relaxed);
+    while (elapsed_us > prev_max && !commit_us_max_.compare_exchange_weak(prev_max, elapsed_us)) {}
+    CHAT_LOG_DEBUG("Message batch committed", {
+        {"batch_size", batch_size}, {"commit_us", elapsed_us}
+    });
+}
+
+MessageStoreStats MessageStore::stats() const {
+    MessageStoreStats snapshot;
+    snapshot.enqueued = enqueued_count_.load(std::memory_order_relaxed);
+    snapshot.committed = committed_count_.load(std::memory_order_relaxed);
+    snapshot.failed = failed_count_.load(std::memory_order_relaxed);
+    snapshot.retries = retry_count_.load(std::memory_order_relaxed);
+    snapshot.batches = batch_count_.load(std::memory_order_relaxed);
+    snapshot.max_batch_size = max_batch_size_.load(std::memory_order_relaxed);
+    snapshot.commit_us_total = commit_us_total_.load(std::memory_order_relaxed);
+    snapshot.commit_us_max = commit_us_max_.load(std::memory_order_relaxed);
+    snapshot.backpressure_waits = backpressure_waits_.load(std::memory_order_relaxed);
+    snapshot.rejected = rejected_count_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock_guard(queue_mutex_);
+        snapshot.queue_depth = pending_queue_.size();
+    }
+    return snapshot;
+}
+
+// 一页里出现的新 id 一次查回用户名，之后各条消息共享驻留的名字
+void MessageStore::attach_names(std::vector<ChatMsg>& messages) {
+    std::vector<UserId> user_ids;
+    user_ids.reserve(messages.size() * 2);
+    for (const auto& message : messages) {
+        user_ids.push_back(message.from_id);
+        if (message.to_id) user_ids.push_back(message.to_id);
+    }
+    user_names_->load(user_ids);
+    for (auto& message : messages) {
+        message.from = user_names_->find(message.from_id);
+        if (message.to_id) message.to = user_names_->find(message.to_id);
+    }
+}
+
+// 公共频道最近消息：走 (recipient_id, id) 索引倒序扫描，只取一页。语句在连接上复用，只换游标和 limit
+bool MessageStore::fetch_recent(size_t count, uint64_t before_id, std::vector<ChatMsg>& messages) {
+    messages.clear();
+    if (count == 0) return true;
+    try {
+        auto connection_ptr = db_pool_->acquire();
+        auto row_result = connection_ptr->recent_page
+            .limit(static_cast<unsigned>(count))
+            .bind("bound", cursor_bound(before_id))
+            .execute();
+        for (const mysqlx::Row& row : row_result.fetchAll()) messages.push_back(row_to_chat_msg(row));
+        attach_names(messages);
+    } catch (const mysqlx::Error& ex) {
+        CHAT_LOG_ERROR("Fetch recent messages failed", {{"error", ex.what()}});
+        messages.clear();
+        return false;
+    }
+    std::reverse(messages.begin(), messages.end());
+    return true;
+}
+
+// 与用户相关的消息 = 公共消息 ∪ 发给他的私信 ∪ 他发出的私信。
+// 三个分支各自走 (recipient_id, id) / (sender_id, id) 索引取前 count 条，再合并截断，
+// 避免 OR 条件退化为全表扫描。UNION 只能走 SQL 语句，而 SqlStatement 的 bind 会累加、不能复用，
+// 这里保持一次往返
+bool MessageStore::fetch_for_user(UserId user_id, size_t count, uint64_t before_id, std::vector<ChatMsg>& messages) {
+    messages.clear();
+    if (count == 0) return true;
+    try {
+        auto connection_ptr = db_pool_->acquire();
+        int64_t bound = cursor_bound(before_id);
+        uint64_t limit = static_cast<uint64_t>(count);
+        int64_t user_key = static_cast<int64_t>(user_id);
+        auto row_result = connection_ptr->session.sql(
+                "SELECT id, sender_id, recipient_id, text, ts FROM ("
+                " (SELECT id, sender_id, recipient_id, text, ts FROM chatdb.messages"
+                "   WHERE recipient_id IS NULL AND id < ? ORDER BY id DESC LIMIT ?)"
+                " UNION ALL"
+                " (SELECT id, sender_id, recipient_id, text, ts FROM chatdb.messages"
+                "   WHERE recipient_id = ? AND id < ? ORDER BY id DESC LIMIT ?)"
+                " UNION ALL"
+                " (SELECT id, sender_id, recipient_id, text, ts FROM chatdb.messages"
+                "   WHERE sender_id = ? AND recipient_id IS NOT NULL AND recipient_id <> ? AND id < ? ORDER BY id DESC LIMIT ?)"
+                ") AS page ORDER BY id DESC LIMIT ?")
+            .bind(bound, limit)
+            .bind(user_key, bound, limit)
+            .bind(user_key, user_key, bound, limit)
+            .bind(limit)
+            .execute();
+        for (const mysqlx::Row& row : row_result.fetchAll()) messages.push_back(row_to_chat_msg(row));
+        attach_names(messages);
+    } catch (const mysqlx::Error& ex) {
+        CHAT_LOG_ERROR("Fetch user history failed", {{"user_id", static_cast<uint64_t>(user_id)}, {"error", ex.what()}});
+        messages.clear();
+        return false;
+    }
     std::reverse(messages.begin(), messages.end());
+    return true;
+}
+
+std::vector<ChatMsg> MessageStore::recent(size_t count, uint64_t before_id) {
+    std::vector<ChatMsg> messages;
+    fetch_recent(count, before_id, messages);
     return messages;
-}
\ No newline at end of file
+}
+
+std::vector<ChatMsg> MessageStore::for_user(UserId user_id, size_t count, uint64_t before_id) {
+    std::vector<ChatMsg> messages;
+    fetch_for_user(user_id, count, before_id, messages);
+    return messages;
+}
+
+std::vector<HistoryEntryPtr> MessageStore::history(UserId user_id, size_t count, uint64_t before_id) {
+    std::vector<HistoryEntryPtr> entries;
+    if (count == 0) return entries;
+
+    // 公共频道只预热一次；并发登录在 warm_mutex_ 上排队，避免同时打出 N 条相同查询
+    if (!history_cache_.is_public_warm()) {
+        std::lock_guard<std::mutex> lock_guard(warm_mutex_);
+        if (!history_cache_.is_public_warm()) {
+            size_t capacity = options_.history_cache.public_capacity;
+            std::vector<ChatMsg> public_page;
+            if (fetch_recent(capacity, 0, public_page)) history_cache_.fill_public(public_page, capacity);
+        }
+    }
+    if (history_cache_.lookup(user_id, count, before_id, entries)) return entries;
+
+    std::vector<ChatMsg> messages;
+    bool is_ok = fetch_for_user(user_id, count, before_id, messages);
+    if (is_ok && before_id == 0 && user_id != 0) {
+        history_cache_.fill_user(user_id, messages, count);
+        // 再查一次缓存，把尚未落库的写后消息也带上
+        if (history_cache_.lookup(user_id, count, before_id, entries, false)) return entries;
+    }
+    entries.reserve(messages.size());
+    for (const auto& message : messages) entries.push_back(HistoryCache::make_entry(message));
+    return entries;
+}
@@ -1,21 +1,116 @@
 ﻿#pragma once
 #include <string>
 #include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "chat_msg.hpp"
+#include "history_cache.hpp"
 
-struct ChatMsg {
-    std::string from;
-    std::string to;
-    std::string text;
-    uint64_t ts;
+// 写后（write-behind）持久化参数
+struct MessageStoreOptions {
+    size_t batch_size = 256;                          // 单个事务最多写入的消息数
+    std::chrono::milliseconds linger{5};              // 攒批等待时间
+    size_t queue_capacity = 65536;                    // 队列上限，满时 push 阻塞形成背压
+    // 批次因 MySQL 不可用等暂时性错误没写进去时，放回队首按指数退避重试
+    std::chrono::milliseconds retry_backoff_initial{100};
+    std::chrono::milliseconds retry_backoff_max{5000};
+    size_t stop_retry_limit = 3;                      // stop() 时最多再试几次，仍失败则记为丢失
+    HistoryCacheOptions history_cache;
+};
+
+struct MessageStoreStats {
+    uint64_t enqueued = 0;
+    uint64_t committed = 0;
+    uint64_t failed = 0;                // 被 MySQL 拒绝（坏数据）或停止时仍写不进去而丢弃的消息
+    uint64_t retries = 0;               // 因暂时性错误放回队首重试的批次数
+    uint64_t batches = 0;
+    uint64_t max_batch_size = 0;
+    uint64_t commit_us_total = 0;
+    uint64_t commit_us_max = 0;
+    uint64_t backpressure_waits = 0;
+    uint64_t rejected = 0;              // id 序列不可用时拒收、未入队的消息
+    uint64_t queue_depth = 0;
 };
 
 class DBPool;
+class UserNames;
+struct DbConnection;
 class MessageStore {
 public:
-    MessageStore(DBPool* db_pool): db_pool_(db_pool) {}
-    void push(const ChatMsg& message);
-    std::vector<ChatMsg> recent(size_t count = 50);
-    std::vector<ChatMsg> for_user(const std::string& username, size_t count = 50);
+    // 表里只存 sender_id/recipient_id，读出的历史经 user_names 补上驻留的用户名
+    MessageStore(DBPool* db_pool, UserNames* user_names, const MessageStoreOptions& options = MessageStoreOptions());
+    ~MessageStore();
+    MessageStore(const MessageStore&) = delete;
+    MessageStore& operator=(const MessageStore&) = delete;
+
+    // 只入队不等待 MySQL；由后台写线程批量落库。返回分配给该消息的 id。
+    // id 序列取不到（MySQL 不可用）时不入队、返回 0，调用方应告知发送者消息未发出
+    uint64_t push(const ChatMsg& message);
+    // 不等待的入队：队列已满或 id 序列尚未就绪时返回 false，调用方改在 DB 执行器上调用 push；
+    // 成功时把分配的 id 写回 message
+    bool try_push(ChatMsg& message);
+    // 历史查询按 id 倒序分页：before_id 为 0 表示从最新开始；返回结果按时间正序
+    std::vector<ChatMsg> recent(size_t count = 50, uint64_t before_id = 0);
+    std::vector<ChatMsg> for_user(UserId user_id, size_t count = 50, uint64_t before_id = 0);
+    // 带缓存的历史：优先走 HistoryCache，未命中再查 MySQL 并回填。user_id 为 0（未登录）只看公共频道
+    std::vector<HistoryEntryPtr> history(UserId user_id, size_t count, uint64_t before_id = 0);
+
+    // 停止写线程，退出前把队列中剩余消息全部落库
+    void stop();
+    MessageStoreStats stats() const;
+    HistoryCacheStats cache_stats() { return history_cache_.stats(); }
+
 private:
+    bool ensure_id_sequence();
+    bool claim_writer_lock_locked();
+    bool hold_writer_lock();
+    uint64_t allocate_id();
+    bool fetch_recent(size_t count, uint64_t before_id, std::vector<ChatMsg>& messages);
+    bool fetch_for_user(UserId user_id, size_t count, uint64_t before_id, std::vector<ChatMsg>& messages);
+    void attach_names(std::vector<ChatMsg>& messages);
+    void writer_loop();
+    enum class InsertResult { Committed, Transient, Rejected };
+    InsertResult insert_rows(const ChatMsg* messages, size_t count, std::string& error);
+    bool write_batch(std::vector<ChatMsg>& batch);
+    void record_commit(uint64_t batch_size, uint64_t elapsed_us);
+
     DBPool* db_pool_;
-};
\ No newline at end of file
+    UserNames* user_names_;
+    MessageStoreOptions options_;
+    HistoryCache history_cache_;
+    std::mutex warm_mutex_;
+
+    mutable std::mutex queue_mutex_;
+    std::condition_variable not_empty_cv_;
+    std::condition_variable not_full_cv_;
+    std::deque<ChatMsg> pending_queue_;
+    bool is_stopping_ = false;
+    std::thread writer_thread_;
+
+    // 消息 id 在进程内分配（启动时取 MAX(id)），写后落库前即可作为游标下发。
+    // 前提：同一个 chatdb 只有一个 server 实例写入，由一条专用连接上的 GET_LOCK 命名锁保证。
+    // 以下成员除两个原子量外都由 id_mutex_ 保护
+    std::mutex id_mutex_;
+    std::atomic<bool> is_id_ready_{false};
+    std::atomic<uint64_t> next_id_{0};
+    std::shared_ptr<DbConnection> writer_lock_connection_;   // 持有写者锁的会话，进程存活期间不归还
+    bool is_writer_lock_suspect_ = false;                     // 写入遇到暂时性错误后置位，下次写前先核对锁还在不在
+    bool is_writer_lock_contended_ = false;                   // 锁被别的实例占着，只在首次记错误日志
+
+    std::atomic<uint64_t> enqueued_count_{0};
+    std::atomic<uint64_t> committed_count_{0};
+    std::atomic<uint64_t> failed_count_{0};
+    std::atomic<uint64_t> retry_count_{0};
+    std::atomic<uint64_t> batch_count_{0};
+    std::atomic<uint64_t> max_batch_size_{0};
+    std::atomic<uint64_t> commit_us_total_{0};
+    std::atomic<uint64_t> commit_us_max_{0};
+    std::atomic<uint64_t> backpressure_waits_{0};
+    std::atomic<uint64_t> rejected_count_{0};
+};
@@ -0,0 +1,140 @@
+﻿#include "metrics.hpp"
+#include <cmath>
+#include <cstdio>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+size_t next_metric_stripe() {
+    static std::atomic<size_t> next_stripe{0};
+    return next_stripe.fetch_add(1, std::memory_order_relaxed) % kMetricStripeCount;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& stripe : stripes_) total += stripe.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+static unsigned highest_bit(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long bit_index = 0;
+    _BitScanReverse64(&bit_index, value);
+    return static_cast<unsigned>(bit_index);
+#else
+    return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+}
+
+// 小于 kSubBucketCount 的值各占一桶；之后第 k 个 2 的幂区间 [2^(k+b), 2^(k+b+1)) 占 kSubBucketCount 个桶
+size_t Histogram::bucket_index(uint64_t value) {
+    if (value < kSubBucketCount) return static_cast<size_t>(value);
+    unsigned shift = highest_bit(value) - kSubBucketBits;
+    return static_cast<size_t>((shift + 1) * kSubBucketCount + ((value >> shift) & (kSubBucketCount - 1)));
+}
+
+uint64_t Histogram::bucket_upper_bound(size_t index) {
+    if (index < kSubBucketCount) return index;
+    uint64_t shift = index / kSubBucketCount - 1;
+    uint64_t lower = (kSubBucketCount + index % kSubBucketCount) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+Histogram::Histogram(uint64_t highest_trackable) : bucket_count_(bucket_index(highest_trackable) + 2) {
+    for (auto& stripe : stripes_) {
+        stripe.counts.reset(new std::atomic<uint64_t>[bucket_count_]);
+        for (size_t i = 0; i < bucket_count_; ++i) stripe.counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(uint64_t value) {
+    Stripe& stripe = stripes_[metric_stripe_index()];
+    size_t index = bucket_index(value);
+    if (index >= bucket_count_) index = bucket_count_ - 1;
+    stripe.counts[index].fetch_add(1, std::memory_order_relaxed);
+    stripe.count.fetch_add(1, std::memory_order_relaxed);
+    stripe.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+HistogramSnapshot Histogram::snapshot() const {
+    HistogramSnapshot snapshot;
+    snapshot.counts.assign(bucket_count_, 0);
+    for (const auto& stripe : stripes_) {
+        for (size_t i = 0; i < bucket_count_; ++i) snapshot.counts[i] += stripe.counts[i].load(std::memory_order_relaxed);
+        snapshot.count += stripe.count.load(std::memory_order_relaxed);
+        snapshot.sum += stripe.sum.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void PrometheusWriter::append_value(double value) {
+    char buffer[32];
+    if (std::isinf(value)) {
+        text_ += value > 0 ? "+Inf" : "-Inf";
+        return;
+    }
+    if (value >= 0 && value < 9007199254740992.0 && value == std::floor(value)) {
+        std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value));
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+    }
+    text_ += buffer;
+}
+
+void PrometheusWriter::family(const char* name, const char* help, const char* type) {
+    text_ += "# HELP ";
+    text_ += name;
+    text_ += ' ';
+    text_ += help;
+    text_ += "\n# TYPE ";
+    text_ += name;
+    text_ += ' ';
+    text_ += type;
+    text_ += '\n';
+}
+
+void PrometheusWriter::sample(const char* name, double value, const std::string& labels) {
+    text_ += name;
+    if (!labels.empty()) {
+        text_ += '{';
+        text_ += labels;
+        text_ += '}';
+    }
+    text_ += ' ';
+    append_value(value);
+    text_ += '\n';
+}
+
+void PrometheusWriter::counter(const char* name, const char* help, double value) {
+    family(name, help, "counter");
+    sample(name, value);
+}
+
+void PrometheusWriter::gauge(const char* name, const char* help, double value) {
+    family(name, help, "gauge");
+    sample(name, value);
+}
+
+// 桶边界固定（只取决于构造时的上限），各次抓取输出同一组 le
+void PrometheusWriter::histogram(const char* name, const char* help, const HistogramSnapshot& snapshot, double scale) {
+    family(name, help, "histogram");
+    std::string series_name = std::string(name) + "_bucket";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i + 1 < snapshot.counts.size(); ++i) {
+        cumulative += snapshot.counts[i];
+        text_ += series_name;
+        text_ += "{le=\"";
+        append_value(static_cast<double>(Histogram::bucket_upper_bound(i)) * scale);
+        text_ += "\"} ";
+        append_value(static_cast<double>(cumulative));
+        text_ += '\n';
+    }
+    sample(series_name.c_str(), static_cast<double>(snapshot.count), "le=\"+Inf\"");
+    sample((std::string(name) + "_sum").c_str(), static_cast<double>(snapshot.sum) * scale);
+    sample((std::string(name) + "_count").c_str(), static_cast<double>(snapshot.count));
+}
+
+Metrics& Metrics::instance() {
+    static Metrics instance;
+    return instance;
+}
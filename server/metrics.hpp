@@ -0,0 +1,100 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 热路径计数按线程分片：每个线程第一次打点时分到一个槽，之后只写自己那条缓存行，抓取时再把各槽加总。
+// 线程数不超过槽数时互不争用
+constexpr size_t kMetricStripeCount = 16;
+size_t next_metric_stripe();
+
+inline size_t metric_stripe_index() {
+    thread_local size_t stripe_index = next_metric_stripe();
+    return stripe_index;
+}
+
+class Counter {
+public:
+    void add(uint64_t value = 1) { stripes_[metric_stripe_index()].value.fetch_add(value, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Stripe, kMetricStripeCount> stripes_;
+};
+
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts;   // 各桶计数，最后一桶收超出上限的值
+    uint64_t count = 0;
+    uint64_t sum = 0;
+};
+
+// HDR 风格的对数-线性直方图：每个 2 的幂区间再均分 kSubBucketCount 个桶，桶宽不超过值的 1/kSubBucketCount。
+// 桶数由 highest_trackable 决定，记录时只做本线程分片上的三次 relaxed 原子加
+class Histogram {
+public:
+    // 16 个子桶：分位数误差在 6.25% 以内；60 秒上限的微秒直方图约 370 个桶
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr uint64_t kSubBucketCount = uint64_t(1) << kSubBucketBits;
+
+    explicit Histogram(uint64_t highest_trackable);
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t value);
+    HistogramSnapshot snapshot() const;
+
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_upper_bound(size_t index);   // 桶内最大值（含）
+
+private:
+    struct alignas(64) Stripe {
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+    size_t bucket_count_;
+    std::array<Stripe, kMetricStripeCount> stripes_;
+};
+
+// Prometheus 文本格式（0.0.4）的拼装
+class PrometheusWriter {
+public:
+    // 带标签的指标先写一次 family，再逐个 sample；labels 形如 type="login"
+    void family(const char* name, const char* help, const char* type);
+    void sample(const char* name, double value, const std::string& labels = std::string());
+    void counter(const char* name, const char* help, double value);
+    void gauge(const char* name, const char* help, double value);
+    // 值乘以 scale 后输出（微秒记录、按秒导出时为 1e-6）
+    void histogram(const char* name, const char* help, const HistogramSnapshot& snapshot, double scale = 1.0);
+
+    const std::string& text() const { return text_; }
+
+private:
+    void append_value(double value);
+    std::string text_;
+};
+
+// 热路径上的打点，各模块直接写这里；其余指标在抓取时从各自的 stats() 快照读取
+class Metrics {
+public:
+    static Metrics& instance();
+
+    Counter connections_accepted;
+    Counter logins_ok;
+    Counter logins_invalid;
+    Counter logins_db_unavailable;
+    Counter messages_public;
+    Counter messages_private;
+    Counter broadcasts;
+    Histogram broadcast_fanout{1u << 20};           // 一次广播投递给多少个会话
+    Histogram write_queue_frames{1u << 16};         // 每次 gathered write 开始时发送队列里的帧数
+    Histogram db_acquire_wait_us{60ull * 1000 * 1000};
+    Histogram db_query_us{60ull * 1000 * 1000};     // 连接从借出到归还的时长
+};
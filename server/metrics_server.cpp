@@ -0,0 +1,230 @@
+﻿#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "metrics_server.hpp"
+#include "metrics.hpp"
+#include "server.hpp"
+#include "db_pool.hpp"
+#include "user_store.hpp"
+#include "user_names.hpp"
+#include "message_store.hpp"
+#include "message_codec.hpp"
+#include "logger.hpp"
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+
+namespace {
+
+constexpr size_t kMaxRequestBytes = 8192;
+constexpr auto kRequestTimeout = std::chrono::seconds(5);
+
+// 单次抓取的连接：读到请求头结束，写回响应后关闭。超时未读完直接关掉
+class MetricsConnection : public std::enable_shared_from_this<MetricsConnection> {
+public:
+    MetricsConnection(tcp::socket socket, const MetricsServer& owner)
+        : socket_(std::move(socket)), timer_(socket_.get_executor()), request_(kMaxRequestBytes), owner_(owner) {}
+
+    void start() {
+        auto self = shared_from_this();
+        timer_.expires_after(kRequestTimeout);
+        timer_.async_wait([this, self](const boost::system::error_code& ec) {
+            if (ec) return;
+            boost::system::error_code ignored_ec;
+            socket_.close(ignored_ec);
+        });
+        asio::async_read_until(socket_, request_, "\r\n\r\n",
+            [this, self](const boost::system::error_code& ec, size_t) {
+                if (ec) {
+                    timer_.cancel();
+                    return;
+                }
+                respond();
+            });
+    }
+
+private:
+    void respond() {
+        std::istream request_stream(&request_);
+        std::string method, target;
+        request_stream >> method >> target;
+        std::string body;
+        const char* status = "200 OK";
+        const char* content_type = "text/plain; version=0.0.4; charset=utf-8";
+        if (method != "GET") {
+            status = "405 Method Not Allowed";
+            content_type = "text/plain; charset=utf-8";
+            body = "method not allowed\n";
+        } else if (target != "/metrics") {
+            status = "404 Not Found";
+            content_type = "text/plain; charset=utf-8";
+            body = "not found\n";
+        } else {
+            try {
+                body = owner_.render();
+            } catch (const std::exception& ex) {
+                CHAT_LOG_ERROR("Metrics render failed", { {"what", ex.what()} });
+                std::cerr << "Metrics render failed: " << ex.what() << std::endl;
+                status = "500 Internal Server Error";
+                content_type = "text/plain; charset=utf-8";
+                body = "render failed\n";
+            }
+        }
+        response_ = "HTTP/1.1 ";
+        response_ += status;
+        response_ += "\r\nContent-Type: ";
+        response_ += content_type;
+        response_ += "\r\nContent-Length: " + std::to_string(body.size());
+        response_ += "\r\nConnection: close\r\n\r\n";
+        response_ += body;
+        auto self = shared_from_this();
+        asio::async_write(socket_, asio::buffer(response_), [this, self](const boost::system::error_code&, size_t) {
+            timer_.cancel();
+            boost::system::error_code ignored_ec;
+            socket_.shutdown(tcp::socket::shutdown_both, ignored_ec);
+            socket_.close(ignored_ec);
+        });
+    }
+
+    tcp::socket socket_;
+    asio::steady_timer timer_;
+    asio::streambuf request_;
+    std::string response_;
+    const MetricsServer& owner_;
+};
+
+void write_executor(PrometheusWriter& writer, const std::string& labels, const BlockingExecutorStats& stats) {
+    writer.sample("chat_executor_submitted_total", static_cast<double>(stats.submitted), labels);
+    writer.sample("chat_executor_completed_total", static_cast<double>(stats.completed), labels);
+    writer.sample("chat_executor_queue_depth", static_cast<double>(stats.queue_depth), labels);
+    writer.sample("chat_executor_wait_seconds_total", static_cast<double>(stats.wait_us_total) * 1e-6, labels);
+    writer.sample("chat_executor_run_seconds_total", static_cast<double>(stats.run_us_total) * 1e-6, labels);
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(asio::io_context& io_context, const std::string& address, unsigned short port,
+                             const MetricsSources& sources)
+    : acceptor_(io_context), sources_(sources) {
+    tcp::endpoint endpoint(asio::ip::make_address(address), port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(asio::socket_base::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    CHAT_LOG_INFO("Metrics endpoint listening", { {"address", address}, {"port", static_cast<uint64_t>(port)} });
+}
+
+void MetricsServer::run_accept() {
+    accept_next();
+}
+
+void MetricsServer::accept_next() {
+    acceptor_.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+        if (!ec) {
+            std::make_shared<MetricsConnection>(std::move(socket), *this)->start();
+        } else {
+            CHAT_LOG_ERROR("Metrics accept error", { {"what", ec.message()}, {"value", ec.value()} });
+        }
+        if (acceptor_.is_open()) accept_next();
+    });
+}
+
+std::string MetricsServer::render() const {
+    PrometheusWriter writer;
+    Metrics& metrics = Metrics::instance();
+
+    // 连接与登录
+    writer.counter("chat_connections_accepted_total", "Accepted chat connections.",
+                   static_cast<double>(metrics.connections_accepted.value()));
+    writer.family("chat_logins_total", "Login attempts by result.", "counter");
+    writer.sample("chat_logins_total", static_cast<double>(metrics.logins_ok.value()), "result=\"ok\"");
+    writer.sample("chat_logins_total", static_cast<double>(metrics.logins_invalid.value()), "result=\"invalid\"");
+    writer.sample("chat_logins_total", static_cast<double>(metrics.logins_db_unavailable.value()), "result=\"db_unavailable\"");
+
+    // 请求与消息
+    DecodeStats decode = decode_stats();
+    writer.family("chat_requests_total", "Decoded client requests by type.", "counter");
+    for (size_t i = 0; i < kRequestTypeCount; ++i) {
+        writer.sample("chat_requests_total", static_cast<double>(decode.per_type[i]),
+                      std::string("type=\"") + request_type_name(static_cast<RequestType>(i)) + "\"");
+    }
+    writer.counter("chat_request_parse_errors_total", "Frames that failed to decode.", static_cast<double>(decode.parse_errors));
+    writer.histogram("chat_request_parse_seconds", "Time to decode one request frame.", decode.parse_ns, 1e-9);
+    writer.family("chat_messages_total", "Chat messages accepted for storage by kind.", "counter");
+    writer.sample("chat_messages_total", static_cast<double>(metrics.messages_public.value()), "kind=\"public\"");
+    writer.sample("chat_messages_total", static_cast<double>(metrics.messages_private.value()), "kind=\"private\"");
+    writer.counter("chat_broadcasts_total", "Frames fanned out to all online sessions.", static_cast<double>(metrics.broadcasts.value()));
+    writer.histogram("chat_broadcast_fanout", "Sessions reached by one broadcast.", metrics.broadcast_fanout.snapshot());
+    writer.histogram("chat_write_queue_frames", "Frames queued on a session when a write starts.", metrics.write_queue_frames.snapshot());
+
+    if (sources_.server) {
+        ServerStats stats = sources_.server->stats();
+        writer.gauge("chat_sessions_active", "Open chat sessions.", static_cast<double>(stats.active_sessions));
+        writer.counter("chat_frames_read_total", "Frames received.", static_cast<double>(stats.frames_read));
+        writer.counter("chat_read_calls_total", "Socket reads on chat sessions.", static_cast<double>(stats.read_calls));
+        writer.counter("chat_bytes_read_total", "Bytes received on chat sockets.", static_cast<double>(stats.bytes_read));
+        writer.counter("chat_frames_written_total", "Frames sent.", static_cast<double>(stats.frames_written));
+        writer.counter("chat_bytes_written_total", "Bytes sent on chat sockets.", static_cast<double>(stats.bytes_written));
+        writer.counter("chat_write_calls_total", "Gathered socket writes.", static_cast<double>(stats.write_calls));
+        writer.gauge("chat_queued_bytes", "Bytes waiting in all outbound queues.", static_cast<double>(stats.queued_bytes));
+        writer.counter("chat_congestion_events_total", "Sessions crossing the high watermark.", static_cast<double>(stats.congestion_events));
+        writer.counter("chat_frames_dropped_total", "Fan-out frames dropped for slow consumers.", static_cast<double>(stats.frames_dropped));
+        writer.counter("chat_slow_consumer_disconnects_total", "Sessions closed as slow consumers.",
+                       static_cast<double>(stats.slow_consumer_disconnects));
+        writer.gauge("chat_receive_pool_bytes_in_use", "Receive buffer bytes lent to sessions.",
+                     static_cast<double>(stats.receive_pool.bytes_in_use));
+        writer.gauge("chat_bytes_per_session", "Estimated memory per active session.", static_cast<double>(stats.bytes_per_session));
+
+        writer.family("chat_executor_submitted_total", "Tasks submitted to a blocking executor.", "counter");
+        writer.family("chat_executor_completed_total", "Tasks finished by a blocking executor.", "counter");
+        writer.family("chat_executor_queue_depth", "Tasks waiting in a blocking executor.", "gauge");
+        writer.family("chat_executor_wait_seconds_total", "Time tasks spent queued.", "counter");
+        writer.family("chat_executor_run_seconds_total", "Time tasks spent running.", "counter");
+        write_executor(writer, "executor=\"db\"", stats.db_executor);
+        write_executor(writer, "executor=\"auth\"", stats.auth_executor);
+
+        MessageStore& message_store = sources_.server->message_store();
+        MessageStoreStats store_stats = message_store.stats();
+        writer.gauge("chat_store_queue_depth", "Messages waiting for the write-behind batcher.", static_cast<double>(store_stats.queue_depth));
+        writer.counter("chat_store_committed_total", "Messages committed to MySQL.", static_cast<double>(store_stats.committed));
+        writer.counter("chat_store_failed_total", "Messages rejected by MySQL or dropped at shutdown.", static_cast<double>(store_stats.failed));
+        writer.counter("chat_store_retries_total", "Batches put back for retry after a transient error.", static_cast<double>(store_stats.retries));
+        writer.counter("chat_store_rejected_total", "Messages refused because no message id could be allocated.",
+                       static_cast<double>(store_stats.rejected));
+        writer.counter("chat_store_backpressure_waits_total", "Pushes that waited for queue space.",
+                       static_cast<double>(store_stats.backpressure_waits));
+        HistoryCacheStats cache_stats = message_store.cache_stats();
+        writer.counter("chat_history_cache_hits_total", "History pages served from memory.", static_cast<double>(cache_stats.hits));
+        writer.counter("chat_history_cache_misses_total", "History pages that went to MySQL.", static_cast<double>(cache_stats.misses));
+
+        UserStore& user_store = sources_.server->user_store();
+        UserDirectoryStats directory_stats = user_store.directory_stats();
+        writer.counter("chat_user_directory_hits_total", "Logins answered from the user directory.", static_cast<double>(directory_stats.hits));
+        writer.counter("chat_user_directory_misses_total", "Logins that loaded the user from MySQL.", static_cast<double>(directory_stats.misses));
+        writer.gauge("chat_user_directory_entries", "Users cached in the directory.", static_cast<double>(directory_stats.entries));
+        UserNamesStats names_stats = user_store.names().stats();
+        writer.gauge("chat_user_names_entries", "Interned user names.", static_cast<double>(names_stats.entries));
+    }
+
+    if (sources_.db_pool) {
+        DBPoolStats pool_stats = sources_.db_pool->stats();
+        writer.gauge("chat_db_pool_connections", "Open MySQL connections.", static_cast<double>(pool_stats.total));
+        writer.gauge("chat_db_pool_in_use", "MySQL connections lent out.", static_cast<double>(pool_stats.in_use));
+        writer.gauge("chat_db_pool_waiting", "Threads waiting for a connection.", static_cast<double>(pool_stats.waiting));
+        writer.counter("chat_db_pool_acquire_timeouts_total", "Acquires that gave up.", static_cast<double>(pool_stats.acquire_timeouts));
+        writer.counter("chat_db_pool_reconnects_total", "Broken connections replaced.", static_cast<double>(pool_stats.reconnects));
+    }
+    writer.histogram("chat_db_acquire_wait_seconds", "Time to get a pooled MySQL connection.", metrics.db_acquire_wait_us.snapshot(), 1e-6);
+    writer.histogram("chat_db_query_seconds", "Time a MySQL connection stays lent out.", metrics.db_query_us.snapshot(), 1e-6);
+
+    LoggerStats logger_stats = Logger::instance().stats();
+    writer.gauge("chat_logger_queue_depth", "Records waiting for the async log writer.", static_cast<double>(logger_stats.queue_depth));
+    writer.counter("chat_logger_dropped_total", "Log records dropped on overflow.", static_cast<double>(logger_stats.dropped));
+    return writer.text();
+}
@@ -0,0 +1,32 @@
+﻿#pragma once
+#include <boost/asio.hpp>
+#include <memory>
+#include <string>
+
+class Server;
+class DBPool;
+
+// 抓取时读取的各模块；热路径打点在 Metrics::instance() 里
+struct MetricsSources {
+    Server* server = nullptr;
+    DBPool* db_pool = nullptr;
+};
+
+// 只答 GET /metrics 的极简 HTTP 端点（Prometheus 文本格式），默认只监听本机地址。
+// 每个请求一条连接，答完即关；和聊天端口分开，抓取不占聊天连接的读写路径
+class MetricsServer {
+public:
+    MetricsServer(boost::asio::io_context& io_context, const std::string& address, unsigned short port,
+                  const MetricsSources& sources);
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    void run_accept();
+    std::string render() const;
+
+private:
+    void accept_next();
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    MetricsSources sources_;
+};
@@ -0,0 +1,48 @@
+﻿#include "online_registry.hpp"
+
+OnlineRegistry::OnlineRegistry() {
+    for (auto& shard : shards_) shard.snapshot = std::make_shared<const UserMap>();
+}
+
+std::shared_ptr<Session> OnlineRegistry::insert(UserId user_id, const UserName& username, const std::shared_ptr<Session>& session_ptr) {
+    Shard& shard = shard_for(user_id);
+    std::lock_guard<std::mutex> lock_guard(shard.writer_mutex);
+    auto next_map = std::make_shared<UserMap>(*shard.snapshot);
+    std::shared_ptr<Session> replaced;
+    auto it = next_map->find(user_id);
+    if (it != next_map->end()) {
+        replaced = it->second.session;
+        it->second = OnlineUser{ username, session_ptr };
+    } else {
+        next_map->emplace(user_id, OnlineUser{ username, session_ptr });
+        online_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::atomic_store(&shard.snapshot, Snapshot(std::move(next_map)));
+    return replaced;
+}
+
+bool OnlineRegistry::erase(UserId user_id, const std::shared_ptr<Session>& session_ptr) {
+    Shard& shard = shard_for(user_id);
+    std::lock_guard<std::mutex> lock_guard(shard.writer_mutex);
+    auto it = shard.snapshot->find(user_id);
+    if (it == shard.snapshot->end() || it->second.session != session_ptr) return false;
+    auto next_map = std::make_shared<UserMap>(*shard.snapshot);
+    next_map->erase(user_id);
+    std::atomic_store(&shard.snapshot, Snapshot(std::move(next_map)));
+    online_count_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::shared_ptr<Session> OnlineRegistry::find(UserId user_id) const {
+    Snapshot snapshot = std::atomic_load(&shard_for(user_id).snapshot);
+    auto it = snapshot->find(user_id);
+    return it != snapshot->end() ? it->second.session : nullptr;
+}
+
+void OnlineRegistry::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock_guard(shard.writer_mutex);
+        std::atomic_store(&shard.snapshot, std::make_shared<const UserMap>());
+    }
+    online_count_.store(0, std::memory_order_relaxed);
+}
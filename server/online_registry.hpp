@@ -0,0 +1,54 @@
+﻿#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "chat_msg.hpp"
+
+class Session;
+
+// 一个在线用户：驻留的用户名随条目保存，列在线名单时不必去碰会话对象
+struct OnlineUser {
+    UserName name;
+    std::shared_ptr<Session> session;
+};
+
+// 在线用户表：按 users.id 分片，每个分片是一份只读快照（read-copy-update）。
+// 登录/下线时在分片写锁内复制并替换快照；广播只原子地取快照遍历，不持有任何锁
+class OnlineRegistry {
+public:
+    using UserMap = std::unordered_map<UserId, OnlineUser>;
+    using Snapshot = std::shared_ptr<const UserMap>;
+    static constexpr size_t kShardCount = 16;
+
+    OnlineRegistry();
+
+    // 返回被顶掉的旧会话（同一用户重复登录），没有则为空
+    std::shared_ptr<Session> insert(UserId user_id, const UserName& username, const std::shared_ptr<Session>& session_ptr);
+    // 仅当表中登记的正是该会话时才删除
+    bool erase(UserId user_id, const std::shared_ptr<Session>& session_ptr);
+    std::shared_ptr<Session> find(UserId user_id) const;
+    void clear();
+    size_t size() const { return online_count_.load(std::memory_order_relaxed); }
+
+    template <class Fn>
+    void for_each(Fn&& fn) const {
+        for (const auto& shard : shards_) {
+            Snapshot snapshot = std::atomic_load(&shard.snapshot);
+            for (const auto& kv : *snapshot) fn(kv.first, kv.second);
+        }
+    }
+
+private:
+    struct Shard {
+        std::mutex writer_mutex;
+        Snapshot snapshot;
+    };
+    Shard& shard_for(UserId user_id) { return shards_[user_id % kShardCount]; }
+    const Shard& shard_for(UserId user_id) const { return shards_[user_id % kShardCount]; }
+
+    std::array<Shard, kShardCount> shards_;
+    std::atomic<size_t> online_count_{0};
+};
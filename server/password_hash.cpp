@@ -0,0 +1,168 @@
+﻿#include "password_hash.hpp"
+#include <cstring>
+#include <random>
+
+namespace {
+
+constexpr uint32_t kRoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+class Sha256 {
+public:
+    void update(const uint8_t* data, size_t size) {
+        total_bytes_ += size;
+        while (size > 0) {
+            size_t take = std::min(size, sizeof(block_) - block_size_);
+            std::memcpy(block_ + block_size_, data, take);
+            block_size_ += take;
+            data += take;
+            size -= take;
+            if (block_size_ == sizeof(block_)) {
+                compress(block_);
+                block_size_ = 0;
+            }
+        }
+    }
+
+    std::array<uint8_t, 32> finish() {
+        uint64_t bit_count = total_bytes_ * 8;
+        uint8_t padding[72] = { 0x80 };
+        size_t pad_size = (block_size_ < 56 ? 56 : 120) - block_size_;
+        update(padding, pad_size);
+        uint8_t length_bytes[8];
+        for (int i = 0; i < 8; ++i) length_bytes[i] = static_cast<uint8_t>(bit_count >> (56 - 8 * i));
+        update(length_bytes, 8);
+        std::array<uint8_t, 32> digest;
+        for (int i = 0; i < 8; ++i) {
+            for (int j = 0; j < 4; ++j) digest[i * 4 + j] = static_cast<uint8_t>(state_[i] >> (24 - 8 * j));
+        }
+        return digest;
+    }
+
+private:
+    void compress(const uint8_t* chunk) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t(chunk[i * 4]) << 24) | (uint32_t(chunk[i * 4 + 1]) << 16) |
+                   (uint32_t(chunk[i * 4 + 2]) << 8) | uint32_t(chunk[i * 4 + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t temp1 = h + s1 + ch + kRoundConstants[i] + w[i];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t temp2 = s0 + maj;
+            h = g; g = f; f = e; e = d + temp1;
+            d = c; c = b; b = a; a = temp1 + temp2;
+        }
+        state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+        state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+    }
+
+    uint32_t state_[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    uint8_t block_[64];
+    size_t block_size_ = 0;
+    uint64_t total_bytes_ = 0;
+};
+
+// HMAC 的内外两层在一次派生里只依赖密钥，先各吃一块，之后每轮复制状态即可
+struct HmacSha256 {
+    Sha256 inner;
+    Sha256 outer;
+
+    explicit HmacSha256(const std::string& key) {
+        uint8_t key_block[64] = {};
+        if (key.size() > sizeof(key_block)) {
+            auto key_hash = sha256(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+            std::memcpy(key_block, key_hash.data(), key_hash.size());
+        } else {
+            std::memcpy(key_block, key.data(), key.size());
+        }
+        uint8_t pad[64];
+        for (int i = 0; i < 64; ++i) pad[i] = key_block[i] ^ 0x36;
+        inner.update(pad, sizeof(pad));
+        for (int i = 0; i < 64; ++i) pad[i] = key_block[i] ^ 0x5c;
+        outer.update(pad, sizeof(pad));
+    }
+
+    std::array<uint8_t, 32> mac(const uint8_t* data, size_t size) const {
+        Sha256 inner_copy = inner;
+        inner_copy.update(data, size);
+        auto inner_digest = inner_copy.finish();
+        Sha256 outer_copy = outer;
+        outer_copy.update(inner_digest.data(), inner_digest.size());
+        return outer_copy.finish();
+    }
+};
+
+// 输出正好一个 SHA-256 块，PBKDF2 只需要第 1 块
+std::array<uint8_t, 32> pbkdf2_sha256(const std::string& password, const uint8_t* salt, size_t salt_size, uint32_t iterations) {
+    HmacSha256 hmac(password);
+    uint8_t first_input[64];
+    std::memcpy(first_input, salt, salt_size);
+    const uint8_t block_index[4] = { 0, 0, 0, 1 };
+    std::memcpy(first_input + salt_size, block_index, sizeof(block_index));
+    auto u = hmac.mac(first_input, salt_size + sizeof(block_index));
+    auto result = u;
+    for (uint32_t i = 1; i < iterations; ++i) {
+        u = hmac.mac(u.data(), u.size());
+        for (size_t j = 0; j < result.size(); ++j) result[j] ^= u[j];
+    }
+    return result;
+}
+
+}  // namespace
+
+std::array<uint8_t, 32> sha256(const uint8_t* data, size_t size) {
+    Sha256 hasher;
+    hasher.update(data, size);
+    return hasher.finish();
+}
+
+PasswordVerifier make_password_verifier(const std::string& password, uint32_t iterations) {
+    static thread_local std::mt19937_64 generator(std::random_device{}());
+    PasswordVerifier verifier;
+    verifier.iterations = iterations == 0 ? 1 : iterations;
+    for (size_t i = 0; i < verifier.salt.size(); i += 8) {
+        uint64_t random_value = generator();
+        std::memcpy(verifier.salt.data() + i, &random_value, 8);
+    }
+    verifier.hash = pbkdf2_sha256(password, verifier.salt.data(), verifier.salt.size(), verifier.iterations);
+    return verifier;
+}
+
+bool check_password(const PasswordVerifier& verifier, const std::string& password) {
+    auto hash = pbkdf2_sha256(password, verifier.salt.data(), verifier.salt.size(), verifier.iterations);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < hash.size(); ++i) diff |= hash[i] ^ verifier.hash[i];
+    return diff == 0;
+}
+
+bool constant_time_equals(const std::string& a, const std::string& b) {
+    size_t size = std::max(a.size(), b.size());
+    uint8_t diff = a.size() == b.size() ? 0 : 1;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t x = i < a.size() ? static_cast<uint8_t>(a[i]) : 0;
+        uint8_t y = i < b.size() ? static_cast<uint8_t>(b[i]) : 0;
+        diff |= x ^ y;
+    }
+    return diff == 0;
+}
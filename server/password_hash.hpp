@@ -0,0 +1,19 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+
+// 口令校验值：PBKDF2-HMAC-SHA256(password, salt, iterations)。内存里只放它，不放明文
+struct PasswordVerifier {
+    std::array<uint8_t, 16> salt{};
+    std::array<uint8_t, 32> hash{};
+    uint32_t iterations = 0;
+};
+
+std::array<uint8_t, 32> sha256(const uint8_t* data, size_t size);
+// 随机盐，派生出校验值
+PasswordVerifier make_password_verifier(const std::string& password, uint32_t iterations);
+// 用同样的盐和轮数重新派生再做定长比较
+bool check_password(const PasswordVerifier& verifier, const std::string& password);
+// 与长度无关地比较两个字符串，避免按提前返回的时间猜出口令
+bool constant_time_equals(const std::string& a, const std::string& b);
@@ -0,0 +1,84 @@
+﻿#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "protocol.hpp"
+
+using json = nlohmann::json;
+
+const char* wire_format_name(WireFormat format) {
+    return format == WireFormat::Cbor ? "cbor" : "json";
+}
+
+bool parse_wire_format(const std::string& name, WireFormat& format) {
+    if (name == "json") { format = WireFormat::Json; return true; }
+    if (name == "cbor") { format = WireFormat::Cbor; return true; }
+    return false;
+}
+
+void append_cbor_head(std::string& out, uint8_t major_type, uint64_t value) {
+    uint8_t major_bits = static_cast<uint8_t>(major_type << 5);
+    if (value < 24) {
+        out += static_cast<char>(major_bits | value);
+    } else if (value <= 0xFF) {
+        out += static_cast<char>(major_bits | 24);
+        out += static_cast<char>(value);
+    } else if (value <= 0xFFFF) {
+        out += static_cast<char>(major_bits | 25);
+        for (int shift = 8; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xFF);
+    } else if (value <= 0xFFFFFFFFull) {
+        out += static_cast<char>(major_bits | 26);
+        for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xFF);
+    } else {
+        out += static_cast<char>(major_bits | 27);
+        for (int shift = 56; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xFF);
+    }
+}
+
+void append_cbor_text(std::string& out, const std::string& text) {
+    append_cbor_head(out, 3, text.size());
+    out += text;
+}
+
+std::string to_cbor_bytes(const json& value) {
+    std::string out;
+    json::to_cbor(value, out);
+    return out;
+}
+
+Frame::Frame(WireFormat format, std::string payload) : native_format_(format) {
+    std::call_once(encoded_once_[static_cast<size_t>(format)], [&]() {
+        encodings_[static_cast<size_t>(format)].payload = std::move(payload);
+        encode(format);
+    });
+}
+
+Frame::Frame(json value) : value_(std::move(value)), has_value_(true) {}
+
+const Frame::Encoding& Frame::encoding(WireFormat format) const {
+    size_t index = static_cast<size_t>(format);
+    std::call_once(encoded_once_[index], [&]() { encode(format); });
+    return encodings_[index];
+}
+
+// 在 call_once 内执行：补齐 format 的负载（若还没有）并写长度头
+void Frame::encode(WireFormat format) const {
+    Encoding& target = encodings_[static_cast<size_t>(format)];
+    bool is_native = !has_value_ && format == native_format_;
+    if (!is_native) {
+        if (has_value_) {
+            target.payload = format == WireFormat::Cbor ? to_cbor_bytes(value_) : value_.dump();
+        } else {
+            // 只有原生编码时做一次转码；原生编码在构造时已就绪，读它无需同步
+            const std::string& native_payload = encodings_[static_cast<size_t>(native_format_)].payload;
+            json value = native_format_ == WireFormat::Cbor ? json::from_cbor(native_payload) : json::parse(native_payload);
+            target.payload = format == WireFormat::Cbor ? to_cbor_bytes(value) : value.dump();
+        }
+    }
+    uint32_t payload_length = static_cast<uint32_t>(target.payload.size());
+    target.header[0] = static_cast<uint8_t>((payload_length >> 24) & 0xFF);
+    target.header[1] = static_cast<uint8_t>((payload_length >> 16) & 0xFF);
+    target.header[2] = static_cast<uint8_t>((payload_length >> 8) & 0xFF);
+    target.header[3] = static_cast<uint8_t>((payload_length) & 0xFF);
+}
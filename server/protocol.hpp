@@ -2,7 +2,11 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <array>
+#include <memory>
+#include <mutex>
 #include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
 
 // Helpers to encode/decode 4-byte big-endian length prefix
 inline std::vector<uint8_t> make_frame(const std::string& payload) {
@@ -16,10 +20,92 @@ inline std::vector<uint8_t> make_frame(const std::string& payload) {
     return frame;
 }
 
+inline uint32_t parse_length(const uint8_t* header) {
+    return (static_cast<uint32_t>(header[0]) << 24) |
+           (static_cast<uint32_t>(header[1]) << 16) |
+           (static_cast<uint32_t>(header[2]) << 8) |
+           (static_cast<uint32_t>(header[3]));
+}
+
 inline uint32_t parse_length(const std::vector<uint8_t>& buffer) {
     if (buffer.size() < 4) return 0;
-    return (static_cast<uint32_t>(buffer[0]) << 24) |
-           (static_cast<uint32_t>(buffer[1]) << 16) |
-           (static_cast<uint32_t>(buffer[2]) << 8) |
-           (static_cast<uint32_t>(buffer[3]));
-}
\ No newline at end of file
+    return parse_length(buffer.data());
+}
+
+// 长度头最高位表示负载经过了本连接的 deflate 流压缩（需在 hello 里协商），其余 31 位是长度
+constexpr uint32_t kFrameCompressedFlag = 0x80000000u;
+constexpr uint32_t kFrameLengthMask = 0x7FFFFFFFu;
+
+// 负载编码。JSON 是默认格式，客户端可以在 hello 握手里选择 CBOR
+enum class WireFormat : uint8_t { Json = 0, Cbor = 1 };
+constexpr size_t kWireFormatCount = 2;
+
+const char* wire_format_name(WireFormat format);
+bool parse_wire_format(const std::string& name, WireFormat& format);
+
+// 我们的顶层负载永远是对象：JSON 以 '{' 开头，CBOR map 的首字节是 0xA0..0xBF，据此区分
+inline WireFormat detect_wire_format(const uint8_t* data, size_t length) {
+    if (length == 0) return WireFormat::Json;
+    uint8_t first_byte = data[0];
+    if (first_byte == '{' || first_byte == ' ' || first_byte == '\t' || first_byte == '\r' || first_byte == '\n') return WireFormat::Json;
+    return WireFormat::Cbor;
+}
+
+// 手工拼 CBOR 时用：写一个数据项头（major type + 参数），以及一个 UTF-8 文本串
+void append_cbor_head(std::string& out, uint8_t major_type, uint64_t value);
+void append_cbor_text(std::string& out, const std::string& text);
+std::string to_cbor_bytes(const nlohmann::json& value);
+
+// 不可变共享帧：长度头 + 负载每种格式最多编码一次，所有会话的写队列引用同一份内存，
+// 发送时用 scatter/gather 直接交给 socket，不再按接收者拷贝。
+// 其他格式在第一次有会话需要时才编码（线程安全），纯 JSON 的部署不会多付 CBOR 的开销
+class Frame {
+public:
+    explicit Frame(std::string json_text) : Frame(WireFormat::Json, std::move(json_text)) {}
+    Frame(WireFormat format, std::string payload);   // payload 已经是 format 编码
+    explicit Frame(nlohmann::json value);            // 保留原值，各格式都按需编码
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    const std::string& payload(WireFormat format = WireFormat::Json) const { return encoding(format).payload; }
+    size_t size(WireFormat format = WireFormat::Json) const { return 4 + encoding(format).payload.size(); }
+    std::array<boost::asio::const_buffer, 2> buffers(WireFormat format = WireFormat::Json) const {
+        const Encoding& target = encoding(format);
+        return { boost::asio::buffer(target.header), boost::asio::buffer(target.payload) };
+    }
+
+private:
+    struct Encoding {
+        std::array<uint8_t, 4> header{};
+        std::string payload;
+    };
+    const Encoding& encoding(WireFormat format) const;
+    void encode(WireFormat format) const;
+
+    nlohmann::json value_;
+    bool has_value_ = false;
+    WireFormat native_format_ = WireFormat::Json;
+    mutable std::array<std::once_flag, kWireFormatCount> encoded_once_;
+    mutable std::array<Encoding, kWireFormatCount> encodings_;
+};
+
+using FramePtr = std::shared_ptr<const Frame>;
+
+// 投递类别：发送队列拥塞时，慢消费者策略据此决定哪些帧可以丢
+enum class FrameClass : uint8_t {
+    Reply,       // 对本会话请求的应答（登录结果、历史页、快照等），不丢
+    Broadcast,   // 聊天消息扇出，resync 策略下可丢，之后用一个 resync 标记补齐
+    Presence,    // 上下线增量，拥塞时最先丢；客户端发现版本不连续会自己重拿快照
+};
+
+inline FramePtr make_shared_frame(std::string payload) {
+    return std::make_shared<const Frame>(std::move(payload));
+}
+
+inline FramePtr make_shared_frame(WireFormat format, std::string payload) {
+    return std::make_shared<const Frame>(format, std::move(payload));
+}
+
+inline FramePtr make_shared_frame(nlohmann::json value) {
+    return std::make_shared<const Frame>(std::move(value));
+}
@@ -9,88 +9,275 @@
 #include "server.hpp"
 #include "session.hpp"
 #include "logger.hpp"
+#include "metrics.hpp"
 #include <nlohmann/json.hpp>
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
 using json = nlohmann::json;
 
-Server::Server(asio::io_context& io_context, unsigned short port, UserStore* user_store, MessageStore* message_store)
-    : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)), io_context_(io_context), user_store_(user_store), message_store_(message_store) {
-    Logger::instance().info("Server constructed", { {"port", port} });
+Server::Server(IoContextPool& context_pool, unsigned short port, UserStore* user_store, MessageStore* message_store,
+               BlockingExecutor* db_executor, BlockingExecutor* auth_executor, const ServerOptions& options)
+    : context_pool_(context_pool), io_context_(context_pool.context(0)), user_store_(user_store), message_store_(message_store),
+      db_executor_(db_executor), auth_executor_(auth_executor), options_(options), presence_timer_(context_pool.context(0)), receive_pool_(options.receive_pool) {
+    if (options_.write_coalesce_max_buffers < 2) options_.write_coalesce_max_buffers = 2;
+    if (context_pool_.is_per_core()) {
+        for (size_t i = 0; i < context_pool_.size(); ++i) {
+            mailboxes_.push_back(std::make_unique<Mailbox>(context_pool_.context(i)));
+        }
+#ifdef SO_REUSEPORT
+        for (size_t i = 0; i < context_pool_.size(); ++i) open_acceptor(context_pool_.context(i), port, true);
+#else
+        // 没有 SO_REUSEPORT（如 Windows）：一个 acceptor 接入，连接轮流交给各 context
+        open_acceptor(io_context_, port, false);
+#endif
+    } else {
+        open_acceptor(io_context_, port, false);
+    }
+    CHAT_LOG_INFO("Server constructed", { {"port", port}, {"io_contexts", static_cast<uint64_t>(context_pool_.size())},
+                                          {"acceptors", static_cast<uint64_t>(acceptors_.size())} });
+}
+
+Server::~Server() {
+    online_users_.clear();
+    mailboxes_.clear();
+}
+
+void Server::open_acceptor(asio::io_context& io_context, unsigned short port, bool is_reuse_port) {
+    tcp::endpoint endpoint(tcp::v4(), port);
+    auto acceptor = std::make_unique<tcp::acceptor>(io_context);
+    acceptor->open(endpoint.protocol());
+    acceptor->set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+    if (is_reuse_port) acceptor->set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+    (void)is_reuse_port;
+#endif
+    acceptor->bind(endpoint);
+    acceptor->listen();
+    acceptors_.push_back(std::move(acceptor));
 }
 
 void Server::run_accept() {
-    acceptor_.async_accept([this](std::error_code ec, tcp::socket socket) {
+    for (size_t i = 0; i < acceptors_.size(); ++i) accept_next(i);
+}
+
+void Server::stop_accept() {
+    for (auto& acceptor : acceptors_) {
+        boost::system::error_code ec;
+        acceptor->close(ec);
+    }
+}
+
+// 共享模式：每个连接的 socket 绑定到自己的 strand，读写回调和 deliver 都在该 strand 上串行执行。
+// 每核模式：socket 直接绑定到某个单线程 context，会话一生都在这个线程上，不需要 strand
+void Server::accept_next(size_t acceptor_index) {
+    bool is_per_core = context_pool_.is_per_core();
+    size_t context_index = acceptor_index;
+    if (is_per_core && acceptors_.size() == 1) {
+        context_index = next_context_.fetch_add(1, std::memory_order_relaxed) % context_pool_.size();
+    }
+    auto on_accept = [this, acceptor_index, context_index](const boost::system::error_code& ec, tcp::socket socket) {
         if (!ec) {
-            auto session_ptr = std::make_shared<Session>(std::move(socket), *this);
-            Logger::instance().info("New connection accepted");
+            Metrics::instance().connections_accepted.add();
+            auto session_ptr = make_session(std::move(socket), context_index);
+            CHAT_LOG_INFO("New connection accepted", { {"context", static_cast<uint64_t>(context_index)} });
             session_ptr->start();
         } else {
-            Logger::instance().error("Accept error", { {"what", ec.message()}, {"value", ec.value()} });
+            CHAT_LOG_ERROR("Accept error", { {"what", ec.message()}, {"value", ec.value()} });
+            if (ec == asio::error::operation_aborted) return;
         }
-        run_accept();
-    });
+        accept_next(acceptor_index);
+    };
+    if (is_per_core) {
+        acceptors_[acceptor_index]->async_accept(context_pool_.context(context_index), std::move(on_accept));
+    } else {
+        acceptors_[acceptor_index]->async_accept(asio::make_strand(io_context_), std::move(on_accept));
+    }
+}
+
+std::shared_ptr<Session> Server::make_session(tcp::socket socket, size_t context_index) {
+    Mailbox* mailbox = context_pool_.is_per_core() ? mailboxes_[context_index].get() : nullptr;
+    return std::make_shared<Session>(std::move(socket), *this, mailbox);
 }
 
-void Server::on_login(std::shared_ptr<Session> session_ptr, const std::string& username) {
+void Server::on_login(std::shared_ptr<Session> session_ptr, UserId user_id, const UserName& username) {
+    std::shared_ptr<Session> replaced_session;
     {
-        std::lock_guard<std::mutex> lock_guard(mutex_);
-        online_users_[username] = session_ptr;
-        Logger::instance().info("User logged in", { {"username", username}, {"online_count", static_cast<uint64_t>(online_users_.size())} });
+        std::lock_guard<std::mutex> lock_guard(presence_mutex_);
+        replaced_session = online_users_.insert(user_id, username, session_ptr);
+        if (!replaced_session) record_presence_locked(*username, true);
+        // 在锁内投递快照，保证它排在之后的增量帧前面
+        session_ptr->deliver(user_list_frame_locked());
     }
-    broadcast_user_list();
+    CHAT_LOG_INFO("User logged in", { {"username", *username}, {"user_id", static_cast<uint64_t>(user_id)}, {"online_count", static_cast<uint64_t>(online_users_.size())},
+                                                {"replaced", replaced_session != nullptr} });
+    // 旧连接已不在在线表里，收不到任何投递；通知它并关掉，不能让它继续以这个账号发消息
+    if (replaced_session && replaced_session != session_ptr) replaced_session->close_replaced();
 }
 
+// 会话自己记录登录的用户 id，直接按 id 删除，不再线性扫描整张表
 void Server::on_disconnect(std::shared_ptr<Session> session_ptr) {
+    UserId user_id = session_ptr->user_id();
+    if (user_id == 0) return;
+    const std::string& username = session_ptr->username();
     {
-        std::lock_guard<std::mutex> lock_guard(mutex_);
-        for (auto it = online_users_.begin(); it != online_users_.end();) {
-            if (it->second == session_ptr) {
-                Logger::instance().info("User disconnected", { {"username", it->first} });
-                it = online_users_.erase(it);
-            } else ++it;
-        }
+        std::lock_guard<std::mutex> lock_guard(presence_mutex_);
+        if (!online_users_.erase(user_id, session_ptr)) return;
+        record_presence_locked(username, false);
     }
-    broadcast_user_list();
+    CHAT_LOG_INFO("User disconnected", { {"username", username} });
 }
 
-void Server::broadcast(const std::string& json_text, std::shared_ptr<Session> except_session) {
-    std::lock_guard<std::mutex> lock_guard(mutex_);
-    Logger::instance().debug("Broadcasting message", { {"len", static_cast<uint64_t>(json_text.size())}, {"except", except_session ? except_session->username() : ""} });
-    for (auto& kv : online_users_) {
-        if (kv.second != except_session) kv.second->deliver(json_text);
-    }
+void Server::record_presence_locked(const std::string& username, bool is_online) {
+    // 只记每个用户的最终状态，不做抵消：窗口内发出的快照可能已经反映了中间状态，
+    // 客户端按“设为最终状态”应用，重发一个它已有的状态无害
+    pending_presence_[username] = is_online;
+    if (is_presence_flush_scheduled_) return;
+    is_presence_flush_scheduled_ = true;
+    presence_timer_.expires_after(options_.presence_flush_interval);
+    presence_timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (ec == asio::error::operation_aborted) return;
+        flush_presence();
+    });
 }
 
-void Server::send_to_user(const std::string& username, const std::string& json_text) {
-    std::lock_guard<std::mutex> lock_guard(mutex_);
-    auto it = online_users_.find(username);
-    if (it != online_users_.end()) {
-        it->second->deliver(json_text);
-        Logger::instance().debug("Sent message to user", { {"to", username}, {"len", static_cast<uint64_t>(json_text.size())} });
-    } else {
-        Logger::instance().warn("User not online for send", { {"to", username} });
+// 一个窗口内的所有上下线合并成一个增量帧；客户端按“设为最终状态”应用，重复应用无副作用
+void Server::flush_presence() {
+    std::lock_guard<std::mutex> lock_guard(presence_mutex_);
+    is_presence_flush_scheduled_ = false;
+    if (pending_presence_.empty()) return;
+    json delta_json;
+    delta_json["type"] = "presence";
+    delta_json["from_version"] = presence_version_;
+    delta_json["version"] = ++presence_version_;
+    delta_json["joined"] = json::array();
+    delta_json["left"] = json::array();
+    for (const auto& kv : pending_presence_) {
+        delta_json[kv.second ? "joined" : "left"].push_back(kv.first);
     }
+    pending_presence_.clear();
+    CHAT_LOG_DEBUG("Presence delta", { {"version", presence_version_}, {"changes", static_cast<uint64_t>(delta_json["joined"].size() + delta_json["left"].size())} });
+    broadcast(make_shared_frame(std::move(delta_json)), nullptr, FrameClass::Presence);
 }
 
-void Server::broadcast_user_list() {
+FramePtr Server::user_list_frame_locked() {
     json json_obj;
-    {
-        std::lock_guard<std::mutex> lock_guard(mutex_);
-        json_obj["type"] = "user_list";
-        json_obj["users"] = json::array();
-        for (auto& kv : online_users_) {
-            json_obj["users"].push_back(kv.first);
+    json_obj["type"] = "user_list";
+    json_obj["version"] = presence_version_;
+    json_obj["users"] = online_usernames();
+    return make_shared_frame(std::move(json_obj));
+}
+
+void Server::send_user_list(const std::shared_ptr<Session>& session_ptr) {
+    std::lock_guard<std::mutex> lock_guard(presence_mutex_);
+    session_ptr->deliver(user_list_frame_locked());
+}
+
+void Server::broadcast(const std::string& json_text, std::shared_ptr<Session> except_session) {
+    broadcast(make_shared_frame(json_text), except_session);
+}
+
+// 帧只编码一次，每个会话只多持有一个引用；遍历的是无锁快照。
+// 入队不阻塞：慢连接由各自的水位策略处理，不会拖慢其他人的扇出
+void Server::broadcast(const FramePtr& frame, std::shared_ptr<Session> except_session, FrameClass frame_class) {
+    CHAT_LOG_DEBUG("Broadcasting message", { {"len", static_cast<uint64_t>(frame->payload().size())}, {"except", except_session ? except_session->username() : ""} });
+    uint64_t fanout = 0;
+    online_users_.for_each([&](UserId, const OnlineUser& online_user) {
+        if (online_user.session != except_session) {
+            online_user.session->deliver(frame, frame_class);
+            ++fanout;
         }
+    });
+    Metrics& metrics = Metrics::instance();
+    metrics.broadcasts.add();
+    metrics.broadcast_fanout.record(fanout);
+}
+
+void Server::send_to_user(UserId user_id, const std::string& json_text) {
+    send_to_user(user_id, make_shared_frame(json_text));
+}
+
+void Server::send_to_user(UserId user_id, const FramePtr& frame) {
+    auto session_ptr = online_users_.find(user_id);
+    if (session_ptr) {
+        session_ptr->deliver(frame, FrameClass::Broadcast);
+        CHAT_LOG_DEBUG("Sent message to user", { {"to", static_cast<uint64_t>(user_id)}, {"len", static_cast<uint64_t>(frame->payload().size())} });
+    } else {
+        CHAT_LOG_WARN("User not online for send", { {"to", static_cast<uint64_t>(user_id)} });
     }
-    broadcast(json_obj.dump());
 }
 
 std::vector<std::string> Server::online_usernames() {
-    std::lock_guard<std::mutex> lock_guard(mutex_);
     std::vector<std::string> username_list;
     username_list.reserve(online_users_.size());
-    for (auto& kv : online_users_) username_list.push_back(kv.first);
+    online_users_.for_each([&](UserId, const OnlineUser& online_user) {
+        username_list.push_back(*online_user.name);
+    });
     return username_list;
-}
\ No newline at end of file
+}
+
+void Server::record_write(size_t frame_count, size_t byte_count) {
+    write_calls_.add();
+    frames_written_.add(frame_count);
+    bytes_written_.add(byte_count);
+    uint64_t prev_max = max_frames_per_write_.load(std::memory_order_relaxed);
+    while (frame_count > prev_max && !max_frames_per_write_.compare_exchange_weak(prev_max, frame_count)) {}
+}
+
+void Server::record_compress(size_t raw_bytes, size_t compressed_bytes, uint64_t elapsed_ns) {
+    frames_compressed_.add();
+    compress_bytes_in_.add(raw_bytes);
+    compress_bytes_out_.add(compressed_bytes);
+    compress_ns_.add(elapsed_ns);
+}
+
+void Server::record_inflate(size_t compressed_bytes, size_t raw_bytes, uint64_t elapsed_ns) {
+    frames_inflated_.add();
+    inflate_bytes_in_.add(compressed_bytes);
+    inflate_bytes_out_.add(raw_bytes);
+    inflate_ns_.add(elapsed_ns);
+}
+
+ServerStats Server::stats() const {
+    ServerStats snapshot;
+    snapshot.write_calls = write_calls_.value();
+    snapshot.frames_written = frames_written_.value();
+    snapshot.bytes_written = bytes_written_.value();
+    snapshot.max_frames_per_write = max_frames_per_write_.load(std::memory_order_relaxed);
+    snapshot.read_calls = read_calls_.value();
+    snapshot.frames_read = frames_read_.value();
+    snapshot.bytes_read = bytes_read_.value();
+    snapshot.frames_compressed = frames_compressed_.value();
+    snapshot.compress_bytes_in = compress_bytes_in_.value();
+    snapshot.compress_bytes_out = compress_bytes_out_.value();
+    snapshot.compress_ns = compress_ns_.value();
+    snapshot.frames_inflated = frames_inflated_.value();
+    snapshot.inflate_bytes_in = inflate_bytes_in_.value();
+    snapshot.inflate_bytes_out = inflate_bytes_out_.value();
+    snapshot.inflate_ns = inflate_ns_.value();
+    snapshot.queued_bytes = queued_bytes_.load(std::memory_order_relaxed);
+    snapshot.congestion_events = congestion_events_.load(std::memory_order_relaxed);
+    snapshot.frames_dropped = frames_dropped_.value();
+    snapshot.resyncs_sent = resyncs_sent_.load(std::memory_order_relaxed);
+    snapshot.slow_consumer_disconnects = slow_consumer_disconnects_.load(std::memory_order_relaxed);
+    // zlib 默认参数下 deflate 约 256KB、inflate 约 40KB 状态
+    constexpr uint64_t kCompressionStateBytes = 256 * 1024 + 40 * 1024;
+    snapshot.active_sessions = active_sessions_.load(std::memory_order_relaxed);
+    snapshot.compression_sessions = compression_sessions_.load(std::memory_order_relaxed);
+    snapshot.session_object_bytes = snapshot.active_sessions * sizeof(Session);
+    snapshot.compression_state_bytes = snapshot.compression_sessions * kCompressionStateBytes;
+    snapshot.receive_pool = receive_pool_.stats();
+    snapshot.io_contexts = context_pool_.size();
+    for (const auto& mailbox : mailboxes_) {
+        snapshot.mailbox_deliveries += mailbox->deliveries();
+        snapshot.mailbox_drains += mailbox->drains();
+    }
+    snapshot.db_executor = db_executor_->stats();
+    snapshot.auth_executor = auth_executor_->stats();
+    if (snapshot.active_sessions > 0) {
+        snapshot.bytes_per_session = (snapshot.session_object_bytes + snapshot.compression_state_bytes +
+                                      snapshot.receive_pool.bytes_in_use) / snapshot.active_sessions;
+    }
+    return snapshot;
+}
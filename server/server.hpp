@@ -5,31 +5,205 @@
 #include <mutex>
 #include <string>
 #include <vector>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <boost/asio/steady_timer.hpp>
 #include "user_store.hpp"
 #include "message_store.hpp"
+#include "protocol.hpp"
+#include "online_registry.hpp"
+#include "buffer_pool.hpp"
+#include "io_context_pool.hpp"
+#include "mailbox.hpp"
+#include "blocking_executor.hpp"
+#include "metrics.hpp"
 
 class Session;
 
+// 发送队列超过高水位时的处理方式
+enum class SlowConsumerPolicy {
+    DropNonEssential,   // 丢掉排队中和新来的 presence 帧
+    Resync,             // 丢掉排队中和新来的扇出帧，排空后补发一个 resync 标记让客户端重新拉取
+    Disconnect,         // 直接断开
+};
+
+struct ServerOptions {
+    // 写合并：一次 gathered write 最多带多少字节 / 多少个 buffer（每帧占 2 个：头 + 负载）
+    size_t write_coalesce_max_bytes = 256 * 1024;
+    size_t write_coalesce_max_buffers = 64;
+    // 上下线增量在这个窗口内合并成一个 presence 帧
+    std::chrono::milliseconds presence_flush_interval{100};
+    // 协商了 deflate 的连接：负载不小于该值才压缩，短聊天行不付 CPU
+    size_t compression_min_bytes = 512;
+    int compression_level = 1;                          // zlib 级别，1 最快
+    size_t compression_max_inflated_bytes = 16 * 1024 * 1024;   // 解压后上限，防压缩炸弹
+    // 每会话发送队列水位（按未压缩帧长计）：超过 high 进入拥塞并执行策略，排空到 low 以下才恢复
+    size_t write_queue_high_bytes = 4 * 1024 * 1024;
+    size_t write_queue_low_bytes = 1024 * 1024;
+    size_t write_queue_high_frames = 8192;
+    size_t write_queue_low_frames = 1024;
+    size_t write_queue_max_bytes = 16 * 1024 * 1024;   // 硬上限：应答帧也会把队列撑到这里时，无论策略都断开
+    SlowConsumerPolicy slow_consumer_policy = SlowConsumerPolicy::Resync;
+    // 全服排队总字节超过该值时，积压已超过 low 水位的会话也按拥塞处理
+    size_t total_queued_bytes_high = 256 * 1024 * 1024;
+    // 单帧负载上限：长度头超过它直接断开，不做任何分配
+    size_t max_frame_bytes = 1024 * 1024;
+    size_t receive_chunk_bytes = 4096;      // 每次可读时至少准备这么多空间，一次读走多帧
+    // 阻塞任务在途时后续请求按序缓存在会话里；缓存到这么多个就暂停读，等 DB 完成再继续
+    size_t max_deferred_requests = 256;
+    BufferPoolOptions receive_pool;
+};
+
+struct ServerStats {
+    uint64_t write_calls = 0;
+    uint64_t frames_written = 0;
+    uint64_t bytes_written = 0;
+    uint64_t max_frames_per_write = 0;
+    uint64_t read_calls = 0;                // 接收侧 read_some 次数
+    uint64_t frames_read = 0;
+    uint64_t bytes_read = 0;
+    // 发送方向压缩：原始/压缩后字节数和耗时
+    uint64_t frames_compressed = 0;
+    uint64_t compress_bytes_in = 0;
+    uint64_t compress_bytes_out = 0;
+    uint64_t compress_ns = 0;
+    // 接收方向解压
+    uint64_t frames_inflated = 0;
+    uint64_t inflate_bytes_in = 0;
+    uint64_t inflate_bytes_out = 0;
+    uint64_t inflate_ns = 0;
+    // 发送队列
+    uint64_t queued_bytes = 0;              // 当前全服排队字节
+    uint64_t congestion_events = 0;
+    uint64_t frames_dropped = 0;
+    uint64_t resyncs_sent = 0;
+    uint64_t slow_consumer_disconnects = 0;
+    // 内存：每连接固定开销 + 借出的接收缓冲 + zlib 流状态（估算）
+    uint64_t active_sessions = 0;
+    uint64_t compression_sessions = 0;
+    uint64_t session_object_bytes = 0;
+    uint64_t compression_state_bytes = 0;
+    uint64_t bytes_per_session = 0;         // 上面三项加接收缓冲，按活跃会话平均
+    BufferPoolStats receive_pool;
+    // 每核模式：跨线程投递经信箱转交的帧数和 drain 批次
+    uint64_t io_contexts = 0;
+    uint64_t mailbox_deliveries = 0;
+    uint64_t mailbox_drains = 0;
+    BlockingExecutorStats db_executor;
+    BlockingExecutorStats auth_executor;
+};
+
 class Server {
 public:
-    Server(boost::asio::io_context& io_context, unsigned short port, UserStore* user_store, MessageStore* message_store);
+    // context_pool 只有一个 context 时为共享模式（每连接一个 strand）；多个时为每核模式，
+    // 每个 context 各有一个 SO_REUSEPORT acceptor，内核把新连接分散到各线程
+    Server(IoContextPool& context_pool, unsigned short port, UserStore* user_store, MessageStore* message_store,
+           BlockingExecutor* db_executor, BlockingExecutor* auth_executor, const ServerOptions& options = ServerOptions());
+    // 会话析构时要回调本对象的计数和接收缓冲池，所以先放掉在线表和信箱里的会话，再析构成员。
+    // 挂在 io_context 回调里的会话须已由 IoContextPool::shutdown() 释放
+    ~Server();
     void run_accept();
-    void on_login(std::shared_ptr<Session> session_ptr, const std::string& username);
+    // 关闭监听 socket，不再接入新连接。须在 context_pool 停下、工作线程 join 之后调用
+    void stop_accept();
+    // 为已接入的 socket 建会话（不启动读）。socket 须已绑定到第 context_index 个 context（共享模式下为其 strand）。
+    // 接入路径和基准测试里的替身连接共用
+    std::shared_ptr<Session> make_session(boost::asio::ip::tcp::socket socket, size_t context_index);
+    void on_login(std::shared_ptr<Session> session_ptr, UserId user_id, const UserName& username);
     void on_disconnect(std::shared_ptr<Session> session_ptr);
     void broadcast(const std::string& json_text, std::shared_ptr<Session> except_session = nullptr);
-    void send_to_user(const std::string& username, const std::string& json_text);
+    void broadcast(const FramePtr& frame, std::shared_ptr<Session> except_session = nullptr,
+                   FrameClass frame_class = FrameClass::Broadcast);
+    void send_to_user(UserId user_id, const std::string& json_text);
+    void send_to_user(UserId user_id, const FramePtr& frame);
 
-    void broadcast_user_list();
+    // 带版本号的完整在线列表，只在登录和 list_users 请求时单独下发
+    void send_user_list(const std::shared_ptr<Session>& session_ptr);
     std::vector<std::string> online_usernames();
 
     UserStore& user_store() { return *user_store_; }
     MessageStore& message_store() { return *message_store_; }
+    BlockingExecutor& db_executor() { return *db_executor_; }
+    BlockingExecutor& auth_executor() { return *auth_executor_; }
+    const ServerOptions& options() const { return options_; }
+
+    void record_write(size_t frame_count, size_t byte_count);
+    void record_read(size_t frame_count, size_t byte_count) {
+        read_calls_.add();
+        frames_read_.add(frame_count);
+        bytes_read_.add(byte_count);
+    }
+    // 暂停读恢复后从已缓冲数据里切出的帧，不算一次 read
+    void record_buffered_frames(size_t frame_count) { frames_read_.add(frame_count); }
+    void record_compress(size_t raw_bytes, size_t compressed_bytes, uint64_t elapsed_ns);
+    void record_inflate(size_t compressed_bytes, size_t raw_bytes, uint64_t elapsed_ns);
+
+    // 全服发送队列记账，由各会话在入队/写完/丢弃时更新
+    void add_queued_bytes(size_t byte_count) { queued_bytes_.fetch_add(byte_count, std::memory_order_relaxed); }
+    void release_queued_bytes(size_t byte_count) { queued_bytes_.fetch_sub(byte_count, std::memory_order_relaxed); }
+    uint64_t queued_bytes() const { return queued_bytes_.load(std::memory_order_relaxed); }
+    void record_congestion() { congestion_events_.fetch_add(1, std::memory_order_relaxed); }
+    void record_frames_dropped(size_t frame_count) { frames_dropped_.add(frame_count); }
+    void record_resync() { resyncs_sent_.fetch_add(1, std::memory_order_relaxed); }
+    void record_slow_consumer_disconnect() { slow_consumer_disconnects_.fetch_add(1, std::memory_order_relaxed); }
+
+    BufferPool& receive_pool() { return receive_pool_; }
+    void on_session_created() { active_sessions_.fetch_add(1, std::memory_order_relaxed); }
+    void on_session_destroyed() { active_sessions_.fetch_sub(1, std::memory_order_relaxed); }
+    void on_compression_started() { compression_sessions_.fetch_add(1, std::memory_order_relaxed); }
+    void on_compression_stopped() { compression_sessions_.fetch_sub(1, std::memory_order_relaxed); }
+    ServerStats stats() const;
 
 private:
-    boost::asio::ip::tcp::acceptor acceptor_;
-    boost::asio::io_context& io_context_;
-    std::mutex mutex_;
-    std::unordered_map<std::string, std::shared_ptr<Session>> online_users_;
+    void open_acceptor(boost::asio::io_context& io_context, unsigned short port, bool is_reuse_port);
+    void accept_next(size_t acceptor_index);
+    void record_presence_locked(const std::string& username, bool is_online);
+    void flush_presence();
+    FramePtr user_list_frame_locked();
+
+    IoContextPool& context_pool_;
+    boost::asio::io_context& io_context_;           // 第 0 个 context，跑 presence 定时器
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> acceptors_;
+    std::vector<std::unique_ptr<Mailbox>> mailboxes_;   // 每核模式下与 context 一一对应
+    std::atomic<size_t> next_context_{0};           // 不支持 SO_REUSEPORT 时单 acceptor 轮流分配连接
+    OnlineRegistry online_users_;
+
     UserStore* user_store_;
     MessageStore* message_store_;
+    BlockingExecutor* db_executor_;
+    BlockingExecutor* auth_executor_;
+    ServerOptions options_;
+
+    // presence_mutex_ 保护：版本号、待合并的上下线、以及与之对应的快照读取
+    std::mutex presence_mutex_;
+    uint64_t presence_version_ = 0;
+    std::map<std::string, bool> pending_presence_;   // 用户名 -> 窗口结束时是否在线
+    bool is_presence_flush_scheduled_ = false;
+    boost::asio::steady_timer presence_timer_;
+
+    // 每次读写都要打点的计数按线程分片（见 metrics.hpp），stats() 时加总
+    Counter write_calls_;
+    Counter frames_written_;
+    Counter bytes_written_;
+    std::atomic<uint64_t> max_frames_per_write_{0};
+    Counter read_calls_;
+    Counter frames_read_;
+    Counter bytes_read_;
+    Counter frames_compressed_;
+    Counter compress_bytes_in_;
+    Counter compress_bytes_out_;
+    Counter compress_ns_;
+    Counter frames_inflated_;
+    Counter inflate_bytes_in_;
+    Counter inflate_bytes_out_;
+    Counter inflate_ns_;
+    std::atomic<uint64_t> queued_bytes_{0};
+    std::atomic<uint64_t> congestion_events_{0};
+    Counter frames_dropped_;
+    std::atomic<uint64_t> resyncs_sent_{0};
+    std::atomic<uint64_t> slow_consumer_disconnects_{0};
+    std::atomic<uint64_t> active_sessions_{0};
+    std::atomic<uint64_t> compression_sessions_{0};
+    BufferPool receive_pool_;
 };
\ No newline at end of file
@@ -5,279 +5,851 @@
 #include <ws2tcpip.h>
 #include "session.hpp"
 #include "server.hpp"
+#include "mailbox.hpp"
+#include "db_pool.hpp"
+#include "password_hash.hpp"
 #include "protocol.hpp"
 #include "logger.hpp"
+#include "message_codec.hpp"
+#include "metrics.hpp"
 #include <chrono>
 #include <nlohmann/json.hpp>
 #include <algorithm>
+#include <cstring>
 #include <iostream> // For std::cerr
 
 using json = nlohmann::json;
 namespace asio = boost::asio;
 
-// 预览文本
-static std::string preview_text(const std::string& text, size_t max_length = 200) {
-    if (text.size() <= max_length) return text;
-    return text.substr(0, max_length) + "...";
+static constexpr size_t kMaxHistoryPage = 500;
+static constexpr size_t kLoginReplayCount = 100;
+static constexpr size_t kRetainedWriteBuffers = 16;    // 写队列排空后保留的 gather 数组容量上限
+
+// DB 任务结果：连接池给不出连接时单独标记，回给客户端 db_unavailable 而不是误报业务失败
+struct DbOutcome {
+    bool ok = false;
+    bool is_db_unavailable = false;
+};
+struct LoginOutcome {
+    UserId user_id = 0;                 // 0 表示校验失败
+    bool is_db_unavailable = false;
+};
+// 私信收件人要先解析成 users.id；不存在的用户名不落库
+struct PrivateOutcome {
+    ChatMsg message;
+    bool is_unknown_recipient = false;
+    bool is_db_unavailable = false;
+};
+struct HistoryOutcome {
+    std::vector<HistoryEntryPtr> entries;
+    bool is_db_unavailable = false;
+};
+
+// async_write 按值保存缓冲序列；交给它一个只含首尾指针的视图，每次写出不再复制一份 gather 数组。
+// 视图指向 write_buffers_，写完成前不修改它
+struct WriteBufferView {
+    using value_type = asio::const_buffer;
+    using const_iterator = const asio::const_buffer*;
+    const_iterator first;
+    const_iterator last;
+    const_iterator begin() const { return first; }
+    const_iterator end() const { return last; }
+};
+
+static FramePtr make_db_unavailable_frame() {
+    return make_shared_frame(json{ {"type", "error"}, {"error", "db_unavailable"} });
 }
 
-// 日志脱敏
-static json redact_for_logging(const std::string& raw_json_text) {
-    try {
-        json json_obj = json::parse(raw_json_text);
-        if (json_obj.contains("password")) json_obj["password"] = "<REDACTED>";
-        if (json_obj.contains("text")) json_obj["text"] = preview_text(json_obj["text"].get<std::string>(), 200);
-        return json_obj;
-    } catch (...) {
-        json out_json;
-        out_json["raw_preview"] = preview_text(raw_json_text, 200);
-        return out_json;
+static uint64_t now_ms() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+// 把一页历史拼成一个 history_batch 帧；条目里已是序列化好的 JSON/CBOR，直接拼接
+static FramePtr make_history_batch(const std::vector<HistoryEntryPtr>& entries, uint64_t before_id, size_t requested, WireFormat format) {
+    bool has_more = entries.size() >= requested;
+    if (format == WireFormat::Cbor) {
+        std::string batch_bytes;
+        batch_bytes.reserve(64 + entries.size() * 96);
+        append_cbor_head(batch_bytes, 5, 4);   // map，4 个键
+        append_cbor_text(batch_bytes, "type");
+        append_cbor_text(batch_bytes, "history_batch");
+        append_cbor_text(batch_bytes, "before_id");
+        append_cbor_head(batch_bytes, 0, before_id);
+        append_cbor_text(batch_bytes, "has_more");
+        batch_bytes += static_cast<char>(has_more ? 0xF5 : 0xF4);
+        append_cbor_text(batch_bytes, "messages");
+        append_cbor_head(batch_bytes, 4, entries.size());
+        for (const auto& entry : entries) batch_bytes += entry->cbor_bytes();
+        return make_shared_frame(WireFormat::Cbor, std::move(batch_bytes));
+    }
+    size_t total_length = 96;
+    for (const auto& entry : entries) total_length += entry->json_text.size() + 1;
+    std::string batch_text;
+    batch_text.reserve(total_length);
+    batch_text += "{\"type\":\"history_batch\",\"before_id\":";
+    batch_text += std::to_string(before_id);
+    batch_text += ",\"has_more\":";
+    batch_text += has_more ? "true" : "false";
+    batch_text += ",\"messages\":[";
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (i) batch_text += ',';
+        batch_text += entries[i]->json_text;
     }
+    batch_text += "]}";
+    return make_shared_frame(std::move(batch_text));
 }
 
-Session::Session(asio::ip::tcp::socket socket, Server& server)
-    : socket_(std::move(socket)), server_(server), header_buf_(4) {
-    Logger::instance().debug("Session constructed");
+Session::Session(asio::ip::tcp::socket socket, Server& server, Mailbox* mailbox)
+    : socket_(std::move(socket)), server_(server), mailbox_(mailbox) {
+    server_.on_session_created();
+    CHAT_LOG_DEBUG("Session constructed");
+}
+
+Session::~Session() {
+    if (queued_bytes_ > 0) server_.release_queued_bytes(queued_bytes_);
+    if (inflater_) server_.on_compression_stopped();
+    server_.on_session_destroyed();
 }
 
 void Session::start() {
-    Logger::instance().info("Session start");
-    do_read_header();
+    CHAT_LOG_INFO("Session start");
+    // 读由 async_wait 驱动、之后同步 read_some，必须是非阻塞 socket
+    socket_.non_blocking(true);
+    do_read();
 }
 
-void Session::do_read_header() {
+// 流式接收：等 socket 可读再一次性读走内核里已有的数据，从中切出所有完整帧。
+// 等待期间不持有缓冲，空闲会话不占接收内存
+void Session::do_read() {
     auto self = shared_from_this();
-    asio::async_read(socket_, asio::buffer(header_buf_), [this, self](std::error_code ec, std::size_t) {
+    socket_.async_wait(asio::ip::tcp::socket::wait_read, [this, self](std::error_code ec) {
         try {
             if (ec) {
+                rx_buf_.reset();
                 server_.on_disconnect(self);
-                Logger::instance().info("Session read header error/disconnect", { {"ec", ec.message()}, {"user", username_} });
+                CHAT_LOG_INFO("Session read error/disconnect", { {"ec", ec.message()}, {"user", username()} });
                 return;
             }
-            uint32_t body_len = parse_length(header_buf_);
-            if (body_len == 0) { do_read_header(); return; }
-            do_read_body(body_len);
+            if (on_readable() && !is_read_paused_) do_read();
         } catch (const std::exception& ex) {
-            Logger::instance().error("Unhandled exception in do_read_header", {{"what", ex.what()}});
-            std::cerr << "[fatal] do_read_header std::exception: " << ex.what() << std::endl;
+            CHAT_LOG_ERROR("Unhandled exception in do_read", {{"what", ex.what()}});
+            std::cerr << "[fatal] do_read std::exception: " << ex.what() << std::endl;
         } catch (...) {
-            Logger::instance().error("Unhandled unknown exception in do_read_header");
-            std::cerr << "[fatal] do_read_header unknown exception" << std::endl;
+            CHAT_LOG_ERROR("Unhandled unknown exception in do_read");
+            std::cerr << "[fatal] do_read unknown exception" << std::endl;
         }
     });
 }
 
-void Session::do_read_body(uint32_t body_len) {
-    body_buf_.assign(body_len, 0);
+// 返回 false 表示连接已关闭，不再继续等待
+bool Session::on_readable() {
+    const ServerOptions& options = server_.options();
+    if (!rx_buf_) {
+        rx_buf_ = server_.receive_pool().acquire(options.receive_chunk_bytes);
+        rx_begin_ = rx_end_ = 0;
+    }
+    // 尾部空间不够一个读块时，把残留的半帧挪到缓冲开头
+    if (rx_begin_ > 0 && rx_buf_.capacity() - rx_end_ < options.receive_chunk_bytes / 2) compact_rx_buffer();
+    if (rx_end_ == rx_buf_.capacity()) grow_rx_buffer(rx_buf_.capacity() * 2);
+
+    boost::system::error_code ec;
+    size_t byte_count = socket_.read_some(asio::buffer(rx_buf_.data() + rx_end_, rx_buf_.capacity() - rx_end_), ec);
+    if (ec == asio::error::would_block || ec == asio::error::try_again) return true;   // 伪唤醒
+    if (ec) {
+        rx_buf_.reset();
+        server_.on_disconnect(shared_from_this());
+        CHAT_LOG_INFO("Session read error/disconnect", { {"ec", ec.message()}, {"user", username()} });
+        return false;
+    }
+    rx_end_ += byte_count;
+    size_t frame_count = 0;
+    bool is_open = consume_frames(frame_count);
+    server_.record_read(frame_count, byte_count);
+    return is_open;
+}
+
+// 从接收缓冲切出完整帧逐个处理，暂停读时停在下一帧之前；返回 false 表示连接已关闭
+bool Session::consume_frames(size_t& frame_count) {
+    const ServerOptions& options = server_.options();
+    while (!is_read_paused_ && rx_end_ - rx_begin_ >= 4) {
+        uint32_t header_value = parse_length(rx_buf_.data() + rx_begin_);
+        uint32_t body_len = header_value & kFrameLengthMask;
+        // 在分配任何内存之前拒绝超长帧：伪造的长度头最多只能让我们断开连接
+        if (body_len > options.max_frame_bytes) {
+            CHAT_LOG_WARN("Frame too large, disconnecting", { {"user", username()}, {"len", static_cast<uint64_t>(body_len)},
+                                                             {"max", static_cast<uint64_t>(options.max_frame_bytes)} });
+            rx_buf_.reset();
+            server_.on_disconnect(shared_from_this());
+            socket_.close();
+            return false;
+        }
+        size_t frame_size = 4 + static_cast<size_t>(body_len);
+        if (rx_end_ - rx_begin_ < frame_size) {
+            // 半帧：确保缓冲放得下整帧，剩下的等下次可读
+            if (rx_begin_ + frame_size > rx_buf_.capacity()) {
+                if (frame_size <= rx_buf_.capacity()) compact_rx_buffer();
+                else grow_rx_buffer(frame_size);
+            }
+            break;
+        }
+        const uint8_t* body_data = rx_buf_.data() + rx_begin_ + 4;
+        rx_begin_ += frame_size;
+        ++frame_count;
+        if (body_len == 0) continue;
+        if (!handle_frame(body_data, body_len, (header_value & kFrameCompressedFlag) != 0)) return false;
+        if (!socket_.is_open()) {
+            // logout 或慢消费者策略关闭了连接：不会再有读回调报错，这里归还缓冲并下线（on_disconnect 可重复调用）
+            rx_buf_.reset();
+            server_.on_disconnect(shared_from_this());
+            return false;
+        }
+    }
+
+    // 没有残留就把缓冲还给池
+    if (rx_begin_ == rx_end_) {
+        rx_buf_.reset();
+        rx_begin_ = rx_end_ = 0;
+    }
+    return true;
+}
+
+void Session::compact_rx_buffer() {
+    size_t pending_bytes = rx_end_ - rx_begin_;
+    if (pending_bytes > 0 && rx_begin_ > 0) std::memmove(rx_buf_.data(), rx_buf_.data() + rx_begin_, pending_bytes);
+    rx_begin_ = 0;
+    rx_end_ = pending_bytes;
+}
+
+void Session::grow_rx_buffer(size_t min_capacity) {
+    PooledBuffer larger = server_.receive_pool().acquire(min_capacity);
+    size_t pending_bytes = rx_end_ - rx_begin_;
+    if (pending_bytes > 0) std::memcpy(larger.data(), rx_buf_.data() + rx_begin_, pending_bytes);
+    rx_buf_ = std::move(larger);
+    rx_begin_ = 0;
+    rx_end_ = pending_bytes;
+}
+
+// 处理一个完整帧的负载；返回 false 表示连接已被关闭，不要再继续读
+bool Session::handle_frame(const uint8_t* body_data, size_t body_size, bool is_compressed) {
+    if (is_compressed) {
+        auto start_time = std::chrono::steady_clock::now();
+        if (!inflater_ || !inflater_->decompress(body_data, body_size, server_.options().compression_max_inflated_bytes, inflate_buf_)) {
+            // 未协商却发压缩帧，或流已损坏：之后的帧都无法解出，只能断开
+            CHAT_LOG_ERROR("Bad compressed frame", { {"user", username()}, {"negotiated", inflater_ != nullptr}, {"len", static_cast<uint64_t>(body_size)} });
+            server_.on_disconnect(shared_from_this());
+            socket_.close();
+            return false;
+        }
+        server_.record_inflate(body_size, inflate_buf_.size(), static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count()));
+        body_data = reinterpret_cast<const uint8_t*>(inflate_buf_.data());
+        body_size = inflate_buf_.size();
+    }
+    // 直接在接收缓冲区上单遍解析出带类型的请求，不再复制 payload、也不再为日志二次解析
+    DecodedRequest request;
+    std::string decode_error;
+    if (decode_request(body_data, body_size, request, decode_error)) {
+        CHAT_LOG_DEBUG("Received JSON", { {"from", username()}, {"json_len", static_cast<uint64_t>(body_size)}, {"payload", request_log_view(request)} });
+        if (is_work_in_flight_) {
+            deferred_requests_.push_back(std::move(request));
+            if (deferred_requests_.size() >= server_.options().max_deferred_requests) is_read_paused_ = true;
+        } else {
+            run_request(request);
+        }
+    } else {
+        std::string payload_preview(reinterpret_cast<const char*>(body_data), std::min<size_t>(body_size, 200));
+        CHAT_LOG_ERROR("Bad JSON parse", { {"what", decode_error}, {"payload_preview", payload_preview} });
+        std::cerr << "[fatal] JSON parse error: " << decode_error << std::endl;
+    }
+    // 解压缓冲只在处理大帧时短暂持有
+    if (is_compressed) std::string().swap(inflate_buf_);
+    return true;
+}
+
+// 按请求类型索引的处理函数表，替代逐个比较类型字符串的 if/else 链
+const std::array<Session::Handler, kRequestTypeCount> Session::kHandlers = {
+    &Session::handle_register,
+    &Session::handle_login,
+    &Session::handle_chat,
+    &Session::handle_private,
+    &Session::handle_heartbeat,
+    &Session::handle_history,
+    &Session::handle_list_users,
+    &Session::handle_logout,
+    &Session::handle_hello,
+    &Session::handle_unknown,
+};
+
+void Session::run_request(DecodedRequest& request) {
+    try {
+        process_message(request);
+    } catch (const std::exception& ex) {
+        CHAT_LOG_ERROR("Exception in process_message", { {"what", ex.what()}, {"type", request.type_name} });
+        std::cerr << "[fatal] process_message error: " << ex.what() << std::endl;
+    } catch (...) {
+        CHAT_LOG_ERROR("Unknown exception in process_message", { {"type", request.type_name} });
+        std::cerr << "[fatal] Unknown process_message error" << std::endl;
+    }
+}
+
+void Session::process_message(DecodedRequest& request) {
+    CHAT_LOG_DEBUG("Processing message", { {"type", request.type_name}, {"user", username()} });
+    (this->*kHandlers[static_cast<size_t>(request.type)])(request);
+}
+
+// 阻塞的调用（DB、口令哈希）交给对应的执行器，I/O 线程继续读写其他连接。work 在执行器线程上运行、
+// 只能碰线程安全的 store；done 被 post 回本会话的执行器。work 抛异常时 done 收到默认构造的结果
+template <typename Work, typename Done>
+void Session::submit_work(BlockingExecutor& executor, Work work, Done done) {
+    is_work_in_flight_ = true;
     auto self = shared_from_this();
-    asio::async_read(socket_, asio::buffer(body_buf_), [this, self](std::error_code ec, std::size_t) {
+    executor.submit([self, work = std::move(work), done = std::move(done)]() mutable {
+        decltype(work()) result{};
         try {
-            if (ec) {
-                server_.on_disconnect(self);
-                Logger::instance().info("Session read body error/disconnect", { {"ec", ec.message()}, {"user", username_} });
-                return;
-            }
-            std::string payload(body_buf_.begin(), body_buf_.end());
-            json redacted_json = redact_for_logging(payload);
-            Logger::instance().debug("Received JSON", { {"from", username_}, {"json_len", static_cast<uint64_t>(payload.size())}, {"payload", redacted_json} });
+            result = work();
+        } catch (const std::exception& ex) {
+            CHAT_LOG_ERROR("Exception in blocking work", { {"what", ex.what()}, {"user", self->username()} });
+        } catch (...) {
+            CHAT_LOG_ERROR("Unknown exception in blocking work", { {"user", self->username()} });
+        }
+        asio::post(self->socket_.get_executor(), [self, result = std::move(result), done = std::move(done)]() mutable {
+            self->is_work_in_flight_ = false;
             try {
-                json json_obj = json::parse(payload);
-                process_message(json_obj);
+                done(std::move(result));
             } catch (const std::exception& ex) {
-                Logger::instance().error("Bad JSON parse", { {"what", ex.what()}, {"payload_preview", preview_text(payload, 200)} });
-                std::cerr << "[fatal] JSON parse error: " << ex.what() << std::endl;
+                CHAT_LOG_ERROR("Exception in work completion", { {"what", ex.what()}, {"user", self->username()} });
             } catch (...) {
-                Logger::instance().error("Unknown fatal JSON parse error", { {"payload_preview", preview_text(payload, 200)} });
-                std::cerr << "[fatal] Unknown fatal JSON parse error" << std::endl;
+                CHAT_LOG_ERROR("Unknown exception in work completion", { {"user", self->username()} });
             }
-            do_read_header();
-        } catch (const std::exception& ex) {
-            Logger::instance().error("Unhandled exception in do_read_body", {{"what", ex.what()}});
-            std::cerr << "[fatal] do_read_body std::exception: " << ex.what() << std::endl;
-        } catch (...) {
-            Logger::instance().error("Unhandled unknown exception in do_read_body");
-            std::cerr << "[fatal] do_read_body unknown exception" << std::endl;
-        }
+            self->resume_deferred_requests();
+        });
     });
 }
 
-void Session::process_message(const json& json_obj) {
-    std::string msg_type = json_obj.value("type", "");
-    Logger::instance().debug("Processing message", { {"type", msg_type}, {"user", username_} });
+// 阻塞任务完成后按顺序处理期间缓存的请求，直到又遇到一个阻塞请求；读被暂停过就先切完缓冲里的帧再恢复
+void Session::resume_deferred_requests() {
+    while (!is_work_in_flight_ && !deferred_requests_.empty()) {
+        if (!socket_.is_open()) {
+            deferred_requests_.clear();
+            return;
+        }
+        DecodedRequest request = std::move(deferred_requests_.front());
+        deferred_requests_.pop_front();
+        run_request(request);
+    }
+    if (!is_read_paused_ || deferred_requests_.size() >= server_.options().max_deferred_requests) return;
+    is_read_paused_ = false;
+    if (!socket_.is_open()) return;
+    size_t frame_count = 0;
+    bool is_open = consume_frames(frame_count);
+    server_.record_buffered_frames(frame_count);
+    if (is_open && !is_read_paused_) do_read();
+}
 
-    if (msg_type == "register") {
-        std::string username_input = json_obj.value("username", "");
-        std::string password_input = json_obj.value("password", "");
-        bool is_registered = false;
+void Session::handle_register(DecodedRequest& request) {
+    auto& register_request = std::get<RegisterRequest>(request.body);
+    submit_work(server_.db_executor(), [this, username_input = register_request.username, password_input = std::move(register_request.password)]() {
+        DbOutcome outcome;
         try {
-            Logger::instance().debug("About to call register_user", { {"username", username_input} });
-            std::cerr << "(debug) About to call register_user" << std::endl;
-            is_registered = server_.user_store().register_user(username_input, password_input);
-            Logger::instance().debug("register_user returned", {{"ok", is_registered}});
-            std::cerr << "(debug) register_user returned: " << is_registered << std::endl;
+            CHAT_LOG_DEBUG("About to call register_user", { {"username", username_input} });
+            outcome.ok = server_.user_store().register_user(username_input, password_input);
+            CHAT_LOG_DEBUG("register_user returned", {{"ok", outcome.ok}});
+        } catch(const DBUnavailable& ex) {
+            CHAT_LOG_ERROR("Database unavailable in register user", {{"what", ex.what()}});
+            outcome.is_db_unavailable = true;
         } catch(const std::exception& ex) {
-            Logger::instance().error("Exception in register user", {{"what", ex.what()}});
+            CHAT_LOG_ERROR("Exception in register user", {{"what", ex.what()}});
             std::cerr << "Exception in register user: " << ex.what() << std::endl;
-            is_registered = false;
         } catch(...) {
-            Logger::instance().error("FATAL UNKNOWN in register user", {{"username", username_input}});
+            CHAT_LOG_ERROR("FATAL UNKNOWN in register user", {{"username", username_input}});
             std::cerr << "FATAL UNKNOWN in register user" << std::endl;
-            is_registered = false;
         }
-        json resp_json = { {"type","register_result"}, {"ok", is_registered} };
-        if (!is_registered) {
-            resp_json["reason"] = "username_exists";
-            Logger::instance().warn("Register failed", { {"username", username_input}, {"reason", "username_exists"} });
+        return outcome;
+    }, [this, username_input = std::move(register_request.username)](DbOutcome outcome) {
+        json resp_json = { {"type","register_result"}, {"ok", outcome.ok} };
+        if (!outcome.ok) {
+            const char* reason = outcome.is_db_unavailable ? "db_unavailable" : "username_exists";
+            resp_json["reason"] = reason;
+            CHAT_LOG_WARN("Register failed", { {"username", username_input}, {"reason", reason} });
         } else {
-            Logger::instance().info("User registered (via session)", { {"username", username_input} });
+            CHAT_LOG_INFO("User registered (via session)", { {"username", username_input} });
         }
-        Logger::instance().debug("Delivering register_result");
-        std::cerr << "(debug) Delivering register_result" << std::endl;
-        deliver(resp_json.dump());
-
-    } else if (msg_type == "login") {
-        std::string username_input = json_obj.value("username", "");
-        std::string password_input = json_obj.value("password", "");
-        bool is_login_success = false;
+        CHAT_LOG_DEBUG("Delivering register_result");
+        deliver(make_shared_frame(std::move(resp_json)));
+    });
+}
+
+// 先查内存里的用户目录：负缓存直接失败；正缓存在哈希线程池上校验；未命中才查库。
+// 登录回放在 on_login 之后单独取，期间的广播不会漏掉
+void Session::handle_login(DecodedRequest& request) {
+    auto& login_request = std::get<LoginRequest>(request.body);
+    if (user_id_ != 0) {
+        // 一个连接只对应一个账号；换号要先 logout 重连，否则旧账号的在线登记会残留
+        deliver(make_shared_frame(json{ {"type", "login_result"}, {"ok", false}, {"reason", "already_logged_in"} }));
+        return;
+    }
+    auto credential = server_.user_store().find_credential(login_request.username);
+    if (credential && !credential->exists) {
+        complete_login(login_request.username, 0, false);
+        return;
+    }
+    auto on_checked = [this, username_input = login_request.username](LoginOutcome outcome) {
+        complete_login(username_input, outcome.user_id, outcome.is_db_unavailable);
+    };
+    if (credential) {
+        submit_work(server_.auth_executor(), [credential, password_input = std::move(login_request.password)]() {
+            LoginOutcome outcome;
+            if (check_password(credential->verifier, password_input)) outcome.user_id = credential->user_id;
+            return outcome;
+        }, std::move(on_checked));
+        return;
+    }
+    submit_work(server_.db_executor(), [this, username_input = login_request.username, password_input = std::move(login_request.password)]() {
+        LoginOutcome outcome;
         try {
-            is_login_success = server_.user_store().check_login(username_input, password_input);
+            outcome.user_id = server_.user_store().check_login(username_input, password_input);
+        } catch(const DBUnavailable& ex) {
+            CHAT_LOG_ERROR("Database unavailable in login", {{"what", ex.what()}});
+            outcome.is_db_unavailable = true;
         } catch(const std::exception& ex) {
-            Logger::instance().error("Exception in login", {{"what", ex.what()}});
-        }
-        json resp_json = { {"type","login_result"}, {"ok", is_login_success} };
-        if (!is_login_success) {
-            resp_json["reason"] = "invalid";
-            Logger::instance().warn("Login failed", { {"username", username_input}, {"reason", "invalid"} });
-        } else {
-            username_ = username_input;
-            server_.on_login(shared_from_this(), username_input);
-            Logger::instance().info("Login success", { {"username", username_input} });
-            resp_json["username"] = username_input;
-        }
-        Logger::instance().info("login_result JSON", {{"json", resp_json.dump()}});
-        deliver(resp_json.dump());
-        if (is_login_success) {
-            auto history_msgs = server_.message_store().for_user(username_input, 100);
-            for (auto& chat_msg : history_msgs) {
-                json msg_json = {
-                    {"type", chat_msg.to.empty() ? "message" : "private"},
-                    {"from", chat_msg.from},
-                    {"to", chat_msg.to},
-                    {"text", chat_msg.text},
-                    {"ts", chat_msg.ts}
-                };
-                deliver(msg_json.dump());
-            }
+            CHAT_LOG_ERROR("Exception in login", {{"what", ex.what()}});
         }
+        return outcome;
+    }, std::move(on_checked));
+}
 
-    } else if (msg_type == "message") {
-        if (username_.empty()) {
-            json err_json = { {"type", "error"}, {"error", "not_logged_in"} };
-            deliver(err_json.dump());
-            Logger::instance().warn("Message rejected - not logged in");
-            return;
-        }
-        std::string text_val = json_obj.value("text", "");
-        uint64_t ts_val = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count());
-        ChatMsg chat_msg{ username_, "", text_val, ts_val };
+// 登录成功后用户名只驻留一份，会话、在线表和之后的每条消息都引用它
+void Session::complete_login(const std::string& username_input, UserId user_id, bool is_db_unavailable) {
+    if (!socket_.is_open() || is_close_after_flush_) return;   // 校验期间连接已断开或被顶替，不能再登记为在线
+    bool is_login_success = user_id != 0;
+    json resp_json = { {"type","login_result"}, {"ok", is_login_success} };
+    if (!is_login_success) {
+        const char* reason = is_db_unavailable ? "db_unavailable" : "invalid";
+        resp_json["reason"] = reason;
+        if (is_db_unavailable) Metrics::instance().logins_db_unavailable.add();
+        else Metrics::instance().logins_invalid.add();
+        CHAT_LOG_WARN("Login failed", { {"username", username_input}, {"reason", reason} });
+    } else {
+        Metrics::instance().logins_ok.add();
+        user_id_ = user_id;
+        username_ = server_.user_store().names().intern(user_id, username_input);
+        server_.on_login(shared_from_this(), user_id_, username_);
+        CHAT_LOG_INFO("Login success", { {"username", username_input} });
+        resp_json["username"] = username_input;
+    }
+    CHAT_LOG_INFO("login_result JSON", {{"json", resp_json.dump()}});
+    deliver(make_shared_frame(std::move(resp_json)));
+    if (is_login_success) send_history(kLoginReplayCount, 0);
+}
+
+void Session::handle_chat(DecodedRequest& request) {
+    if (user_id_ == 0) {
+        json err_json = { {"type", "error"}, {"error", "not_logged_in"} };
+        deliver(make_shared_frame(std::move(err_json)));
+        CHAT_LOG_WARN("Message rejected - not logged in");
+        return;
+    }
+    ChatMsg chat_msg;
+    chat_msg.from_id = user_id_;
+    chat_msg.from = username_;
+    chat_msg.text = std::move(std::get<ChatRequest>(request.body).text);
+    chat_msg.ts = now_ms();
+    persist_message(std::move(chat_msg), &Session::publish_chat);
+}
+
+// 收件人按用户名解析成 id：驻留表里有（在线或最近出现过）就直接发，否则连同入队一起交给 DB 执行器
+void Session::handle_private(DecodedRequest& request) {
+    if (user_id_ == 0) {
+        json err_json = { {"type", "error"}, {"error", "not_logged_in"} };
+        deliver(make_shared_frame(std::move(err_json)));
+        CHAT_LOG_WARN("Private message rejected - not logged in");
+        return;
+    }
+    auto& private_request = std::get<PrivateRequest>(request.body);
+    ChatMsg chat_msg;
+    chat_msg.from_id = user_id_;
+    chat_msg.from = username_;
+    chat_msg.text = std::move(private_request.text);
+    chat_msg.ts = now_ms();
+    UserNames& user_names = server_.user_store().names();
+    chat_msg.to_id = user_names.find_id(private_request.to);
+    if (chat_msg.to_id) {
+        chat_msg.to = user_names.find(chat_msg.to_id);
+        persist_message(std::move(chat_msg), &Session::publish_private);
+        return;
+    }
+    submit_work(server_.db_executor(), [this, chat_msg = std::move(chat_msg), to_input = std::move(private_request.to)]() mutable {
+        PrivateOutcome outcome;
         try {
-            server_.message_store().push(chat_msg);
+            UserNames& user_names = server_.user_store().names();
+            chat_msg.to_id = user_names.lookup_id(to_input);
+            if (chat_msg.to_id == 0) {
+                outcome.is_unknown_recipient = true;
+                return outcome;
+            }
+            chat_msg.to = user_names.find(chat_msg.to_id);
+            chat_msg.id = server_.message_store().push(chat_msg);
+            if (chat_msg.id == 0) {
+                outcome.is_db_unavailable = true;   // 没分到 id，没有入队
+                return outcome;
+            }
+            outcome.message = std::move(chat_msg);
+        } catch(const DBUnavailable& ex) {
+            CHAT_LOG_ERROR("Database unavailable in private message", {{"what", ex.what()}});
+            outcome.is_db_unavailable = true;
         } catch(const std::exception& ex) {
-            Logger::instance().error("Exception in push message", {{"what", ex.what()}});
+            CHAT_LOG_ERROR("Exception in private message", {{"what", ex.what()}});
         }
-        json msg_json = { {"type","message"}, {"from", chat_msg.from}, {"text", chat_msg.text}, {"ts", chat_msg.ts} };
-        server_.broadcast(msg_json.dump());
-        Logger::instance().info("Broadcast message", { {"from", chat_msg.from}, {"len", static_cast<uint64_t>(text_val.size())}, {"text_preview", preview_text(text_val, 200)} });
-        Logger::instance().debug("Broadcast full message", { {"from", chat_msg.from}, {"text", text_val} });
-
-    } else if (msg_type == "private") {
-        if (username_.empty()) {
-            json err_json = { {"type", "error"}, {"error", "not_logged_in"} };
-            deliver(err_json.dump());
-            Logger::instance().warn("Private message rejected - not logged in");
-            return;
+        return outcome;
+    }, [this](PrivateOutcome outcome) {
+        if (outcome.is_db_unavailable) {
+            deliver(make_db_unavailable_frame());
+        } else if (outcome.is_unknown_recipient) {
+            deliver(make_shared_frame(json{ {"type", "error"}, {"error", "no_such_user"} }));
+            CHAT_LOG_WARN("Private message rejected - no such user", { {"from", username()} });
+        } else if (outcome.message.from_id) {
+            publish_private(outcome.message);
         }
-        std::string to_val = json_obj.value("to", "");
-        std::string text_val = json_obj.value("text", "");
-        uint64_t ts_val = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count());
-        ChatMsg chat_msg{ username_, to_val, text_val, ts_val };
+    });
+}
+
+// 写后队列有空位时直接在 I/O 线程上入队；需要等待（队列满形成背压、id 序列未就绪）时才交给 DB 执行器
+void Session::persist_message(ChatMsg chat_msg, Publisher publish) {
+    if (server_.message_store().try_push(chat_msg)) {
+        (this->*publish)(chat_msg);
+        return;
+    }
+    submit_work(server_.db_executor(), [this, chat_msg]() mutable {
+        chat_msg.id = 0;
         try {
-            server_.message_store().push(chat_msg);
+            chat_msg.id = server_.message_store().push(chat_msg);
         } catch(const std::exception& ex) {
-            Logger::instance().error("Exception in push private message", {{"what", ex.what()}});
+            CHAT_LOG_ERROR("Exception in push message", {{"what", ex.what()}});
         }
-        json msg_json = { {"type","private"}, {"from", chat_msg.from}, {"to", chat_msg.to}, {"text", chat_msg.text}, {"ts", chat_msg.ts} };
-        server_.send_to_user(to_val, msg_json.dump());
-        deliver(msg_json.dump());
-        Logger::instance().info("Private message", { {"from", chat_msg.from}, {"to", chat_msg.to}, {"len", static_cast<uint64_t>(text_val.size())}, {"text_preview", preview_text(text_val, 200)} });
-        Logger::instance().debug("Private message full", { {"from", chat_msg.from}, {"to", chat_msg.to}, {"text", text_val} });
-
-    } else if (msg_type == "heartbeat") {
-        json pong_json = { {"type","pong"} };
-        deliver(pong_json.dump());
-
-    } else if (msg_type == "history") {
-        size_t count = json_obj.value("n", 50);
+        return chat_msg;
+    }, [this, publish](ChatMsg chat_msg) {
+        if (chat_msg.id) {
+            (this->*publish)(chat_msg);
+            return;
+        }
+        // 没能入队（MySQL 不可用、取不到 id 序列）：不广播，告诉发送者消息没发出去
+        CHAT_LOG_WARN("Message not stored, rejected", { {"from", username()} });
+        deliver(make_db_unavailable_frame());
+    });
+}
+
+void Session::publish_chat(ChatMsg& chat_msg) {
+    const std::string& text_val = chat_msg.text;
+    json msg_json = { {"type","message"}, {"id", chat_msg.id}, {"from", chat_msg.from_name()}, {"text", chat_msg.text}, {"ts", chat_msg.ts} };
+    server_.broadcast(make_shared_frame(std::move(msg_json)));
+    CHAT_LOG_INFO("Broadcast message", { {"from", chat_msg.from_name()}, {"len", static_cast<uint64_t>(text_val.size())}, {"text_preview", preview_text(text_val, 200)} });
+    CHAT_LOG_DEBUG("Broadcast full message", { {"from", chat_msg.from_name()}, {"text", text_val} });
+}
+
+void Session::publish_private(ChatMsg& chat_msg) {
+    const std::string& text_val = chat_msg.text;
+    json msg_json = { {"type","private"}, {"id", chat_msg.id}, {"from", chat_msg.from_name()}, {"to", chat_msg.to_name()}, {"text", chat_msg.text}, {"ts", chat_msg.ts} };
+    auto frame = make_shared_frame(std::move(msg_json));
+    server_.send_to_user(chat_msg.to_id, frame);
+    deliver(frame);
+    CHAT_LOG_INFO("Private message", { {"from", chat_msg.from_name()}, {"to", chat_msg.to_name()}, {"len", static_cast<uint64_t>(text_val.size())}, {"text_preview", preview_text(text_val, 200)} });
+    CHAT_LOG_DEBUG("Private message full", { {"from", chat_msg.from_name()}, {"to", chat_msg.to_name()}, {"text", text_val} });
+}
+
+void Session::handle_heartbeat(DecodedRequest&) {
+    json pong_json = { {"type","pong"} };
+    deliver(make_shared_frame(std::move(pong_json)));
+}
+
+void Session::handle_history(DecodedRequest& request) {
+    // 游标分页：before_id 取客户端手里最旧一条消息的 id，缺省为从最新开始
+    const auto& history_request = std::get<HistoryRequest>(request.body);
+    size_t count = static_cast<size_t>(std::min<uint64_t>(history_request.count.value_or(50), kMaxHistoryPage));
+    send_history(count, history_request.before_id);
+}
+
+void Session::send_history(size_t count, uint64_t before_id) {
+    submit_work(server_.db_executor(), [this, user_id = user_id_, count, before_id]() {
+        HistoryOutcome outcome;
         try {
-            auto history_msgs = server_.message_store().for_user(username_, count);
-            for (auto& chat_msg : history_msgs) {
-                json msg_json = {
-                    {"type", chat_msg.to.empty() ? "message" : "private"},
-                    {"from", chat_msg.from},
-                    {"to", chat_msg.to},
-                    {"text", chat_msg.text},
-                    {"ts", chat_msg.ts}
-                };
-                deliver(msg_json.dump());
-            }
+            outcome.entries = server_.message_store().history(user_id, count, before_id);
+        } catch(const DBUnavailable& ex) {
+            CHAT_LOG_ERROR("Database unavailable in history fetch", {{"what", ex.what()}});
+            outcome.is_db_unavailable = true;
         } catch(const std::exception& ex) {
-            Logger::instance().error("Exception in history fetch", {{"what", ex.what()}});
+            CHAT_LOG_ERROR("Exception in history fetch", {{"what", ex.what()}});
         }
+        return outcome;
+    }, [this, count, before_id](HistoryOutcome outcome) {
+        if (outcome.is_db_unavailable) deliver(make_db_unavailable_frame());
+        else deliver(make_history_batch(outcome.entries, before_id, count, wire_format_));
+    });
+}
+
+void Session::handle_list_users(DecodedRequest&) {
+    server_.send_user_list(shared_from_this());
+}
 
-    } else if (msg_type == "list_users") {
-        auto users = server_.online_usernames();
-        json resp_json;
-        resp_json["type"] = "user_list";
-        resp_json["users"] = users;
-        deliver(resp_json.dump());
+void Session::handle_logout(DecodedRequest&) {
+    CHAT_LOG_INFO("User requested logout", { {"username", username()} });
+    socket_.close();
+}
+
+// 能力握手：选客户端列表里第一个我们支持的编码。应答按旧编码发出，之后的帧才切换
+void Session::handle_hello(DecodedRequest& request) {
+    const auto& hello_request = std::get<HelloRequest>(request.body);
+    WireFormat chosen_format = WireFormat::Json;
+    for (const auto& format_name : hello_request.formats) {
+        if (parse_wire_format(format_name, chosen_format)) break;
+    }
+    // 压缩一旦启用就不再关闭：两端的流状态必须一直对得上
+    bool is_deflate = inflater_ != nullptr ||
+        std::find(hello_request.compression.begin(), hello_request.compression.end(), "deflate") != hello_request.compression.end();
+    const ServerOptions& options = server_.options();
+    json ack_json = { {"type", "hello_ack"}, {"format", wire_format_name(chosen_format)}, {"formats", {"json", "cbor"}},
+                      {"compression", is_deflate ? "deflate" : "none"}, {"compression_min_bytes", options.compression_min_bytes} };
+    deliver(make_shared_frame(std::move(ack_json)));
+    wire_format_ = chosen_format;
+    if (is_deflate && !inflater_) {
+        deflater_ = std::make_unique<DeflateStream>(options.compression_level);
+        inflater_ = std::make_unique<InflateStream>();
+        server_.on_compression_started();
+    }
+    CHAT_LOG_INFO("Wire format negotiated", { {"format", wire_format_name(chosen_format)}, {"compression", is_deflate}, {"user", username()} });
+}
 
-    } else if (msg_type == "logout") {
-        Logger::instance().info("User requested logout", { {"username", username_} });
-        socket_.close();
+void Session::handle_unknown(DecodedRequest& request) {
+    CHAT_LOG_WARN("Unknown message type", { {"type", request.type_name} });
+}
+
+void Session::close_replaced() {
+    auto self = shared_from_this();
+    asio::dispatch(socket_.get_executor(), [this, self]() {
+        if (is_closing_ || !socket_.is_open()) return;
+        CHAT_LOG_INFO("Session replaced by a newer login", { {"user", username()} });
+        user_id_ = 0;   // 之后的 message / private 按未登录处理，不能再冒用这个账号
+        is_close_after_flush_ = true;
+        bool was_idle = push_frame(make_shared_frame(json{ {"type", "error"}, {"error", "logged_in_elsewhere"} }), FrameClass::Reply);
+        is_closing_ = true;   // 不再接收新的投递
+        if (was_idle) do_write();
+    });
+}
+
+void Session::deliver(const std::string& json_text) {
+    deliver(make_shared_frame(json_text));
+}
+
+// 可从任意线程调用：切到本会话的 strand 再操作写队列（已在 strand 上则直接执行）。
+// 每核模式下别的线程只往属主信箱压一下；属主线程上先把信箱里更早的投递交付，保持先后顺序
+void Session::deliver(const FramePtr& frame, FrameClass frame_class) {
+    if (mailbox_) {
+        if (mailbox_->is_owner_thread()) {
+            mailbox_->drain();
+            enqueue(frame, frame_class);
+        } else {
+            mailbox_->push(shared_from_this(), frame, frame_class);
+        }
         return;
+    }
+    auto self = shared_from_this();
+    auto enqueue_frame = [this, self, frame, frame_class]() { enqueue(frame, frame_class); };
+    // 直接投递到具体的 strand：经类型擦除的 any_io_executor 投递，每次都要在堆上复制一份 strand 并包装回调
+    if (const Strand* strand = socket_.get_executor().target<Strand>()) {
+        asio::dispatch(*strand, std::move(enqueue_frame));
     } else {
-        Logger::instance().warn("Unknown message type", { {"type", msg_type} });
+        asio::dispatch(socket_.get_executor(), std::move(enqueue_frame));
     }
 }
 
-void Session::deliver(const std::string& json_text) {
-    auto frame = make_frame(json_text);
-    bool writing = !write_queue_.empty();
-    write_queue_.push_back(std::move(frame));
-    if (!writing) do_write();
+// strand（每核模式下为属主线程）上执行：先按水位决定是否进入拥塞，再按策略决定这帧丢弃还是入队
+void Session::enqueue(const FramePtr& frame, FrameClass frame_class) {
+    if (is_closing_) return;
+    if (!is_congested_ && is_over_high_watermark()) {
+        enter_congestion();
+        if (is_closing_) return;
+    }
+    if (is_congested_ && is_droppable(frame_class)) {
+        server_.record_frames_dropped(1);
+        return;
+    }
+    if (queued_bytes_ + frame->size(wire_format_) > server_.options().write_queue_max_bytes) {
+        close_slow_consumer("write_queue_max_bytes");
+        return;
+    }
+    if (push_frame(frame, frame_class)) do_write();
+}
+
+// 入队并记账；返回入队前队列是否为空（即调用方需要启动 do_write）
+bool Session::push_frame(const FramePtr& frame, FrameClass frame_class) {
+    bool was_idle = write_queue_.empty();
+    size_t frame_size = frame->size(wire_format_);
+    write_queue_.push_back({ frame, wire_format_, deflater_ != nullptr, frame_class, frame_size });
+    queued_bytes_ += frame_size;
+    server_.add_queued_bytes(frame_size);
+    return was_idle;
+}
+
+bool Session::is_over_high_watermark() const {
+    const ServerOptions& options = server_.options();
+    if (queued_bytes_ > options.write_queue_high_bytes || write_queue_.size() > options.write_queue_high_frames) return true;
+    // 全服超预算时，已经积压到低水位以上的会话也算拥塞，防止一群慢连接合起来吃光内存
+    return queued_bytes_ > options.write_queue_low_bytes && server_.queued_bytes() > options.total_queued_bytes_high;
+}
+
+bool Session::is_droppable(FrameClass frame_class) const {
+    switch (server_.options().slow_consumer_policy) {
+        case SlowConsumerPolicy::DropNonEssential: return frame_class == FrameClass::Presence;
+        case SlowConsumerPolicy::Resync:           return frame_class != FrameClass::Reply;
+        default: return false;
+    }
+}
+
+void Session::enter_congestion() {
+    const ServerOptions& options = server_.options();
+    is_congested_ = true;
+    server_.record_congestion();
+    CHAT_LOG_WARN("Slow consumer: write queue over high watermark", { {"user", username()},
+        {"queued_bytes", static_cast<uint64_t>(queued_bytes_)}, {"queued_frames", static_cast<uint64_t>(write_queue_.size())},
+        {"policy", static_cast<int>(options.slow_consumer_policy)} });
+    if (options.slow_consumer_policy == SlowConsumerPolicy::Disconnect) {
+        close_slow_consumer("high_watermark");
+        return;
+    }
+    if (options.slow_consumer_policy == SlowConsumerPolicy::Resync) needs_resync_ = true;
+    drop_queued_frames();
+}
+
+// 丢弃尚未开始发送且策略允许丢的帧；在途的帧还被 write_buffers_ 引用，不能动
+void Session::drop_queued_frames() {
+    size_t dropped_bytes = 0;
+    size_t dropped_count = 0;
+    auto kept_end = std::remove_if(write_queue_.begin() + frames_in_flight_, write_queue_.end(), [&](const QueuedFrame& queued) {
+        if (!is_droppable(queued.frame_class)) return false;
+        dropped_bytes += queued.size;
+        ++dropped_count;
+        return true;
+    });
+    write_queue_.erase(kept_end, write_queue_.end());
+    queued_bytes_ -= dropped_bytes;
+    server_.release_queued_bytes(dropped_bytes);
+    server_.record_frames_dropped(dropped_count);
+}
+
+void Session::close_slow_consumer(const char* reason) {
+    is_closing_ = true;
+    server_.record_slow_consumer_disconnect();
+    CHAT_LOG_WARN("Disconnecting slow consumer", { {"user", username()}, {"reason", reason},
+        {"queued_bytes", static_cast<uint64_t>(queued_bytes_)} });
+    size_t pending_bytes = 0;
+    for (auto it = write_queue_.begin() + frames_in_flight_; it != write_queue_.end(); ++it) pending_bytes += it->size;
+    write_queue_.erase(write_queue_.begin() + frames_in_flight_, write_queue_.end());
+    queued_bytes_ -= pending_bytes;
+    server_.release_queued_bytes(pending_bytes);
+    // 可能正处在 on_login 持有 presence 锁的调用链里，下线登记放到之后执行
+    auto self = shared_from_this();
+    asio::post(socket_.get_executor(), [this, self]() { server_.on_disconnect(self); });
+    boost::system::error_code ignored_ec;
+    socket_.close(ignored_ec);
 }
 
+// 写合并：把队列里已有的帧一次性 gather 成一个 async_write，受字节数和 buffer 数上限约束
 void Session::do_write() {
+    const ServerOptions& options = server_.options();
+    write_buffers_.clear();
+    compressed_frames_.clear();
+    size_t byte_count = 0;
+    frames_in_flight_ = 0;
+    Metrics::instance().write_queue_frames.record(write_queue_.size());
+    for (const auto& queued : write_queue_) {
+        size_t frame_size = queued.frame->size(queued.format);
+        if (frames_in_flight_ > 0 &&
+            (write_buffers_.size() + 2 > options.write_coalesce_max_buffers ||
+             byte_count + frame_size > options.write_coalesce_max_bytes)) break;
+        // 大帧在这里按队列顺序压缩，保证两端 deflate 流的顺序一致
+        if (queued.may_compress && frame_size - 4 >= options.compression_min_bytes &&
+            append_compressed(queued.frame->payload(queued.format))) {
+            const CompressedFrame& compressed = compressed_frames_.back();
+            write_buffers_.push_back(asio::buffer(compressed.header));
+            write_buffers_.push_back(asio::buffer(compressed.payload));
+            byte_count += 4 + compressed.payload.size();
+        } else {
+            auto frame_buffers = queued.frame->buffers(queued.format);
+            write_buffers_.insert(write_buffers_.end(), frame_buffers.begin(), frame_buffers.end());
+            byte_count += frame_size;
+        }
+        ++frames_in_flight_;
+    }
+    server_.record_write(frames_in_flight_, byte_count);
+
     auto self = shared_from_this();
-    boost::asio::async_write(socket_, boost::asio::buffer(write_queue_.front()), [this, self](std::error_code ec, std::size_t) {
+    WriteBufferView buffer_view{ write_buffers_.data(), write_buffers_.data() + write_buffers_.size() };
+    boost::asio::async_write(socket_, buffer_view, [this, self](std::error_code ec, std::size_t) {
         try {
             if (ec) {
+                is_closing_ = true;
+                write_queue_.clear();
+                server_.release_queued_bytes(queued_bytes_);
+                queued_bytes_ = 0;
                 server_.on_disconnect(self);
-                Logger::instance().info("Session write error/disconnect", { {"ec", ec.message()}, {"user", username_} });
+                CHAT_LOG_INFO("Session write error/disconnect", { {"ec", ec.message()}, {"user", username()} });
                 return;
             }
-            write_queue_.pop_front();
-            if (!write_queue_.empty()) do_write();
+            size_t written_bytes = 0;
+            for (size_t i = 0; i < frames_in_flight_; ++i) written_bytes += write_queue_[i].size;
+            write_queue_.erase(write_queue_.begin(), write_queue_.begin() + frames_in_flight_);
+            frames_in_flight_ = 0;
+            compressed_frames_.clear();
+            queued_bytes_ -= written_bytes;
+            server_.release_queued_bytes(written_bytes);
+            const ServerOptions& options = server_.options();
+            if (is_congested_ && queued_bytes_ <= options.write_queue_low_bytes && write_queue_.size() <= options.write_queue_low_frames) {
+                is_congested_ = false;
+                CHAT_LOG_INFO("Slow consumer recovered", { {"user", username()}, {"resync", needs_resync_} });
+                if (needs_resync_) {
+                    // 拥塞期间丢掉的扇出帧合成一个标记：客户端据此重新拉在线列表和最新历史
+                    needs_resync_ = false;
+                    server_.record_resync();
+                    push_frame(make_shared_frame(json{ {"type", "resync"}, {"reason", "slow_consumer"} }), FrameClass::Reply);
+                }
+            }
+            if (!write_queue_.empty()) {
+                do_write();
+            } else if (is_close_after_flush_) {
+                boost::system::error_code ignored_ec;
+                socket_.close(ignored_ec);   // 读回调随之报错；在线表里已是新连接，on_disconnect 不会误删
+            } else if (write_buffers_.capacity() > kRetainedWriteBuffers) {
+                // 队列排空：大批量写留下的 gather 数组放掉，常规大小的留着，下一次广播不用重新分配
+                std::vector<asio::const_buffer>().swap(write_buffers_);
+            }
         } catch (const std::exception& ex) {
-            Logger::instance().error("Unhandled exception in do_write", {{"what", ex.what()}});
+            CHAT_LOG_ERROR("Unhandled exception in do_write", {{"what", ex.what()}});
             std::cerr << "[fatal] do_write std::exception: " << ex.what() << std::endl;
         } catch (...) {
-            Logger::instance().error("Unhandled unknown exception in do_write");
+            CHAT_LOG_ERROR("Unhandled unknown exception in do_write");
             std::cerr << "[fatal] do_write unknown exception" << std::endl;
         }
     });
 }
 
-std::string Session::username() const { return username_; }
\ No newline at end of file
+bool Session::append_compressed(const std::string& payload) {
+    if (!deflater_) return false;
+    auto start_time = std::chrono::steady_clock::now();
+    compressed_frames_.emplace_back();
+    CompressedFrame& compressed = compressed_frames_.back();
+    if (!deflater_->compress(payload.data(), payload.size(), compressed.payload)) {
+        // 流已坏，之后都发原文；对端的解压流没有收到这帧，不受影响
+        CHAT_LOG_ERROR("Deflate failed, compression disabled for session", { {"user", username()} });
+        compressed_frames_.pop_back();
+        deflater_.reset();
+        return false;
+    }
+    uint32_t header_value = static_cast<uint32_t>(compressed.payload.size()) | kFrameCompressedFlag;
+    compressed.header = { static_cast<uint8_t>(header_value >> 24), static_cast<uint8_t>(header_value >> 16),
+                          static_cast<uint8_t>(header_value >> 8), static_cast<uint8_t>(header_value) };
+    server_.record_compress(payload.size(), compressed.payload.size(), static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count()));
+    return true;
+}
+
+const std::string& Session::username() const { return user_name_text(username_); }
\ No newline at end of file
@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include <array>
 #include <memory>
 #include <boost/asio.hpp>
 #include <deque>
@@ -6,26 +7,112 @@
 #include <vector>
 #include <cstdint>
 #include <nlohmann/json.hpp>
+#include "protocol.hpp"
+#include "message_codec.hpp"
+#include "compression.hpp"
+#include "buffer_pool.hpp"
+#include "chat_msg.hpp"
 
 class Server;
+class Mailbox;
+class BlockingExecutor;
 
 class Session : public std::enable_shared_from_this<Session> {
 public:
-    Session(boost::asio::ip::tcp::socket socket, Server& server);
+    // mailbox 非空表示每核模式：socket 绑定在该信箱所属的 io_context 上，跨线程投递经信箱转交
+    Session(boost::asio::ip::tcp::socket socket, Server& server, Mailbox* mailbox = nullptr);
+    ~Session();
     void start();
     void deliver(const std::string& json_text);
-    std::string username() const;
+    // 可从任意线程调用；frame_class 决定拥塞时这帧能不能丢
+    void deliver(const FramePtr& frame, FrameClass frame_class = FrameClass::Reply);
+    // 同一账号在别的连接上登录后调用：通知本连接、不再接受它的请求，发完已排队的帧后关闭。可从任意线程调用
+    void close_replaced();
+    // 登录前为空 / 0
+    const std::string& username() const;
+    UserId user_id() const { return user_id_; }
 
 private:
-    void do_read_header();
-    void do_read_body(uint32_t body_len);
-    void process_message(const nlohmann::json& json_obj);
+    friend class Mailbox;
+    void do_read();
+    bool on_readable();
+    bool consume_frames(size_t& frame_count);
+    void compact_rx_buffer();
+    void grow_rx_buffer(size_t min_capacity);
+    bool handle_frame(const uint8_t* body_data, size_t body_size, bool is_compressed);
+    void run_request(DecodedRequest& request);
+    void process_message(DecodedRequest& request);
+    template <typename Work, typename Done>
+    void submit_work(BlockingExecutor& executor, Work work, Done done);
+    void resume_deferred_requests();
+    using Publisher = void (Session::*)(ChatMsg&);
+    void persist_message(ChatMsg chat_msg, Publisher publish);
+    void publish_chat(ChatMsg& chat_msg);
+    void publish_private(ChatMsg& chat_msg);
+    void handle_register(DecodedRequest& request);
+    void handle_login(DecodedRequest& request);
+    void complete_login(const std::string& username_input, UserId user_id, bool is_db_unavailable);
+    void handle_chat(DecodedRequest& request);
+    void handle_private(DecodedRequest& request);
+    void handle_heartbeat(DecodedRequest& request);
+    void handle_history(DecodedRequest& request);
+    void send_history(size_t count, uint64_t before_id);
+    void handle_list_users(DecodedRequest& request);
+    void handle_logout(DecodedRequest& request);
+    void handle_hello(DecodedRequest& request);
+    void handle_unknown(DecodedRequest& request);
+    void enqueue(const FramePtr& frame, FrameClass frame_class);
+    bool push_frame(const FramePtr& frame, FrameClass frame_class);
+    bool is_over_high_watermark() const;
+    bool is_droppable(FrameClass frame_class) const;
+    void enter_congestion();
+    void drop_queued_frames();
+    void close_slow_consumer(const char* reason);
     void do_write();
+    bool append_compressed(const std::string& payload);
+
+    using Strand = boost::asio::strand<boost::asio::io_context::executor_type>;   // 共享模式下 socket 绑定的执行器
+    using Handler = void (Session::*)(DecodedRequest&);
+    static const std::array<Handler, kRequestTypeCount> kHandlers;   // 下标为 RequestType
 
     boost::asio::ip::tcp::socket socket_;
     Server& server_;
-    std::vector<uint8_t> header_buf_;
-    std::vector<uint8_t> body_buf_;
-    std::deque<std::vector<uint8_t>> write_queue_;
-    std::string username_;
+    Mailbox* mailbox_;
+    // 接收缓冲来自 Server 的共享池：[rx_begin_, rx_end_) 是尚未切出的数据，排空即归还
+    PooledBuffer rx_buf_;
+    size_t rx_begin_ = 0;
+    size_t rx_end_ = 0;
+    // 同一时刻最多一个阻塞任务（DB、口令哈希）在途；期间收到的请求按到达顺序缓存，完成后依次处理
+    bool is_work_in_flight_ = false;
+    bool is_read_paused_ = false;                   // 缓存的请求达到上限，暂不读 socket
+    std::deque<DecodedRequest> deferred_requests_;
+    // 入队时记下当时协商的编码，握手应答仍按旧格式发出
+    struct QueuedFrame {
+        FramePtr frame;
+        WireFormat format;
+        bool may_compress;
+        FrameClass frame_class;
+        size_t size;                                // 入队时的帧长，用于水位记账
+    };
+    std::deque<QueuedFrame> write_queue_;           // 队首 frames_in_flight_ 个帧正在发送
+    std::vector<boost::asio::const_buffer> write_buffers_;
+    // 本次写出中被压缩的帧；deque 保证追加时已有元素地址不变
+    struct CompressedFrame {
+        std::array<uint8_t, 4> header;
+        std::string payload;
+    };
+    std::deque<CompressedFrame> compressed_frames_;
+    size_t frames_in_flight_ = 0;
+    size_t queued_bytes_ = 0;                       // write_queue_（含在途）按未压缩帧长的总字节
+    bool is_congested_ = false;                     // 超过高水位后置位，排空到低水位以下清除
+    bool needs_resync_ = false;                     // Resync 策略丢过扇出帧，恢复时要补 resync 标记
+    bool is_closing_ = false;
+    bool is_close_after_flush_ = false;             // 被同账号的新连接顶替：写队列排空后关闭
+    UserId user_id_ = 0;
+    UserName username_;                             // 驻留的用户名，与 user_id_ 同时在登录时设置
+    WireFormat wire_format_ = WireFormat::Json;     // 发往客户端的编码，hello 握手后可能切到 CBOR
+    // hello 里协商了 deflate 后才创建；两个方向各一条跨帧保留字典的流
+    std::unique_ptr<DeflateStream> deflater_;
+    std::unique_ptr<InflateStream> inflater_;
+    std::string inflate_buf_;
 };
\ No newline at end of file
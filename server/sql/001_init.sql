@@ -0,0 +1,23 @@
+-- chatdb 表结构（新装）：直接建成最终结构，新库只需执行本文件，不要再执行 002-004。
+-- 002-004 只用于升级按旧结构（messages 存 VARCHAR 用户名）建的库：
+--   002 -> 003 -> chat_migrate 回填 -> 004
+CREATE DATABASE IF NOT EXISTS chatdb DEFAULT CHARACTER SET utf8mb4 COLLATE utf8mb4_general_ci;
+USE chatdb;
+
+CREATE TABLE IF NOT EXISTS users (
+    id INT AUTO_INCREMENT PRIMARY KEY,
+    username VARCHAR(64) NOT NULL UNIQUE,
+    password VARCHAR(128) NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS messages (
+    id INT AUTO_INCREMENT PRIMARY KEY,
+    sender_id INT NOT NULL,
+    recipient_id INT,
+    text TEXT NOT NULL,
+    ts BIGINT NOT NULL,
+    INDEX idx_messages_recipient_uid (recipient_id, id),
+    INDEX idx_messages_sender_uid (sender_id, id),
+    CONSTRAINT fk_messages_sender FOREIGN KEY (sender_id) REFERENCES users (id),
+    CONSTRAINT fk_messages_recipient FOREIGN KEY (recipient_id) REFERENCES users (id)
+);
@@ -0,0 +1,10 @@
+-- 历史分页索引：MessageStore::recent / for_user 按 id 倒序 + LIMIT 查询
+--   公共频道 / 收到的私信 -> (recipient, id)
+--   发出的私信             -> (sender, id)
+-- 在线 DDL，不阻塞写入。只用于升级旧结构的库，按 001 新建的库已是最终结构
+USE chatdb;
+
+ALTER TABLE messages
+    ADD INDEX idx_messages_recipient_id (recipient, id),
+    ADD INDEX idx_messages_sender_id (sender, id),
+    ALGORITHM = INPLACE, LOCK = NONE;
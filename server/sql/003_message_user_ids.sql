@@ -0,0 +1,13 @@
+-- messages 改用整型外键：先加可空的 sender_id / recipient_id 和对应的分页索引（在线 DDL，不阻塞写入）。
+-- 之后用 chat_migrate 按 id 区间分批回填，再执行 004 删除旧的用户名列。只用于升级旧结构的库
+USE chatdb;
+
+ALTER TABLE messages
+    ADD COLUMN sender_id INT NULL AFTER id,
+    ADD COLUMN recipient_id INT NULL AFTER sender_id,
+    ALGORITHM = INPLACE, LOCK = NONE;
+
+ALTER TABLE messages
+    ADD INDEX idx_messages_recipient_uid (recipient_id, id),
+    ADD INDEX idx_messages_sender_uid (sender_id, id),
+    ALGORITHM = INPLACE, LOCK = NONE;
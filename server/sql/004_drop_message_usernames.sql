@@ -0,0 +1,19 @@
+-- 收尾：chat_migrate 回填完成（没有 sender_id 为空的行）后执行。
+-- 删除 VARCHAR 用户名列及其索引，sender_id 改为 NOT NULL，并加上指向 users.id 的外键。
+-- 需要重建表；执行期间 server 应当停止
+USE chatdb;
+
+ALTER TABLE messages
+    DROP INDEX idx_messages_recipient_id,
+    DROP INDEX idx_messages_sender_id,
+    DROP COLUMN sender,
+    DROP COLUMN recipient,
+    MODIFY sender_id INT NOT NULL;
+
+-- 数据已由 chat_migrate 校验过，跳过逐行检查以便原地加外键
+SET foreign_key_checks = 0;
+ALTER TABLE messages
+    ADD CONSTRAINT fk_messages_sender FOREIGN KEY (sender_id) REFERENCES users (id),
+    ADD CONSTRAINT fk_messages_recipient FOREIGN KEY (recipient_id) REFERENCES users (id),
+    ALGORITHM = INPLACE;
+SET foreign_key_checks = 1;
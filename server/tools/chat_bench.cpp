@@ -0,0 +1,603 @@
+﻿// chat_bench：服务器热路径的微基准（Google Benchmark）。不需要 MySQL：
+// 连接池用 connection_factory 换成占位连接，广播用本机回环 socket 对充当会话。
+// 设置 CHAT_BENCH_MYSQL=host:port:user:password 时额外跑 DB 路径的对比（缓存语句 vs 每次现建）：
+// 用户查询、消息批量 INSERT、公共频道分页查询。
+// 用法：chat_bench [--benchmark_filter=正则] [--benchmark_format=json] ...
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include "protocol.hpp"
+#include "message_codec.hpp"
+#include "logger.hpp"
+#include "server.hpp"
+#include "session.hpp"
+#include "io_context_pool.hpp"
+#include "db_pool.hpp"
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using json = nlohmann::json;
+
+// 全局 operator new 计数，用来报告每次广播的分配次数；另按线程计数，区分调用线程和 I/O 线程上的分配
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"   // 替换后的 delete 被内联成 free 时的误报
+#endif
+static std::atomic<uint64_t> g_allocation_count{0};
+static thread_local uint64_t t_allocation_count = 0;
+
+void* operator new(std::size_t size) {
+    g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    ++t_allocation_count;
+    if (void* memory = std::malloc(size ? size : 1)) return memory;
+    throw std::bad_alloc();
+}
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+static std::string filler_text(size_t length) {
+    std::string text;
+    text.reserve(length);
+    for (size_t i = 0; i < length; ++i) text.push_back(static_cast<char>('a' + i % 26));
+    return text;
+}
+
+// ---------------- 帧头 ----------------
+
+static void BM_MakeFrame(benchmark::State& state) {
+    std::string payload = filler_text(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        std::vector<uint8_t> frame = make_frame(payload);
+        benchmark::DoNotOptimize(frame.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(payload.size() + 4));
+}
+BENCHMARK(BM_MakeFrame)->Arg(64)->Arg(1024)->Arg(64 * 1024);
+
+static void BM_ParseLength(benchmark::State& state) {
+    std::vector<uint8_t> frame = make_frame(filler_text(1000));
+    const uint8_t* header = frame.data();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(header);
+        uint32_t length = parse_length(header);
+        benchmark::DoNotOptimize(length);
+    }
+}
+BENCHMARK(BM_ParseLength);
+
+// ---------------- 请求解码 / 应答编码，JSON 与 CBOR 对比 ----------------
+
+struct SampleRequest {
+    const char* name;
+    json value;
+};
+
+static const std::vector<SampleRequest>& sample_requests() {
+    static const std::vector<SampleRequest> requests = {
+        { "register",   { {"type", "register"}, {"username", "alice"}, {"password", "correct horse battery"} } },
+        { "login",      { {"type", "login"}, {"username", "alice"}, {"password", "correct horse battery"} } },
+        { "message",    { {"type", "message"}, {"text", filler_text(120)} } },
+        { "private",    { {"type", "private"}, {"to", "bob"}, {"text", filler_text(120)} } },
+        { "heartbeat",  { {"type", "heartbeat"} } },
+        { "history",    { {"type", "history"}, {"n", 50}, {"before_id", 123456} } },
+        { "list_users", { {"type", "list_users"} } },
+        { "logout",     { {"type", "logout"} } },
+        { "hello",      { {"type", "hello"}, {"formats", {"cbor", "json"}}, {"compression", {"deflate"}} } },
+    };
+    return requests;
+}
+
+static std::string encode_payload(const json& value, WireFormat format) {
+    return format == WireFormat::Cbor ? to_cbor_bytes(value) : value.dump();
+}
+
+// range(0) = 请求下标，range(1) = WireFormat
+static void BM_DecodeRequest(benchmark::State& state) {
+    const SampleRequest& sample = sample_requests()[static_cast<size_t>(state.range(0))];
+    WireFormat format = static_cast<WireFormat>(state.range(1));
+    std::string payload = encode_payload(sample.value, format);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload.data());
+    DecodedRequest request;
+    std::string error;
+    for (auto _ : state) {
+        if (!decode_request(data, payload.size(), request, error)) {
+            state.SkipWithError(error.c_str());
+            break;
+        }
+        benchmark::DoNotOptimize(request);
+    }
+    state.SetLabel(std::string(sample.name) + "/" + wire_format_name(format));
+    state.counters["payload_bytes"] = static_cast<double>(payload.size());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(payload.size()));
+}
+
+static void decode_request_args(benchmark::internal::Benchmark* benchmark) {
+    for (size_t i = 0; i < sample_requests().size(); ++i) {
+        for (int format = 0; format < static_cast<int>(kWireFormatCount); ++format) benchmark->Args({ static_cast<int64_t>(i), format });
+    }
+}
+BENCHMARK(BM_DecodeRequest)->Apply(decode_request_args);
+
+// 服务器下发的几类帧，构造方式与 Session / HistoryCache 里一致
+struct SampleResponse {
+    const char* name;
+    std::function<json()> build;
+};
+
+static json sample_chat_json(uint64_t id, bool is_private) {
+    json message_json = { {"type", is_private ? "private" : "message"}, {"id", id}, {"from", "alice"},
+                          {"text", filler_text(120)}, {"ts", 1760000000000ull + id} };
+    if (is_private) message_json["to"] = "bob";
+    return message_json;
+}
+
+static const std::vector<SampleResponse>& sample_responses() {
+    static const std::vector<SampleResponse> responses = {
+        { "message", []() { return sample_chat_json(1000, false); } },
+        { "private", []() { return sample_chat_json(1001, true); } },
+        { "login_result", []() { return json{ {"type", "login_result"}, {"ok", true}, {"username", "alice"} }; } },
+        { "history_batch", []() {
+            json messages = json::array();
+            for (uint64_t i = 0; i < 50; ++i) messages.push_back(sample_chat_json(1000 + i, i % 5 == 0));
+            return json{ {"type", "history_batch"}, {"messages", std::move(messages)} };
+        } },
+        { "user_list", []() {
+            json users = json::array();
+            for (int i = 0; i < 200; ++i) users.push_back("user" + std::to_string(i));
+            return json{ {"type", "user_list"}, {"version", 42}, {"users", std::move(users)} };
+        } },
+    };
+    return responses;
+}
+
+// range(0) = 应答下标，range(1) = WireFormat；每次迭代都按会话里的写法现建 json 再编码一次
+static void BM_EncodeResponse(benchmark::State& state) {
+    const SampleResponse& sample = sample_responses()[static_cast<size_t>(state.range(0))];
+    WireFormat format = static_cast<WireFormat>(state.range(1));
+    size_t payload_bytes = 0;
+    for (auto _ : state) {
+        Frame frame(sample.build());
+        payload_bytes = frame.payload(format).size();
+        benchmark::DoNotOptimize(payload_bytes);
+    }
+    state.SetLabel(std::string(sample.name) + "/" + wire_format_name(format));
+    state.counters["payload_bytes"] = static_cast<double>(payload_bytes);
+}
+
+static void encode_response_args(benchmark::internal::Benchmark* benchmark) {
+    for (size_t i = 0; i < sample_responses().size(); ++i) {
+        for (int format = 0; format < static_cast<int>(kWireFormatCount); ++format) benchmark->Args({ static_cast<int64_t>(i), format });
+    }
+}
+BENCHMARK(BM_EncodeResponse)->Apply(encode_response_args);
+
+// 调试日志用的脱敏视图（原 redact_for_logging）：构造 + dump，与日志真正写出时的开销一致
+static void BM_RequestLogView(benchmark::State& state) {
+    const SampleRequest& sample = sample_requests()[static_cast<size_t>(state.range(0))];
+    std::string payload = sample.value.dump();
+    DecodedRequest request;
+    std::string error;
+    decode_request(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), request, error);
+    for (auto _ : state) {
+        std::string text = request_log_view(request).dump();
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetLabel(sample.name);
+}
+BENCHMARK(BM_RequestLogView)->Arg(1)->Arg(2)->Arg(3);
+
+// ---------------- 日志 ----------------
+
+// 宏先判断级别：关闭时 extras 的 json 不构造
+static void BM_LogMacroDisabled(benchmark::State& state) {
+    Logger::instance().set_level(LogLevel::Info);
+    std::string username = "alice";
+    for (auto _ : state) {
+        CHAT_LOG_DEBUG("Processing message", { {"type", "message"}, {"user", username} });
+    }
+    Logger::instance().set_level(LogLevel::Warn);
+}
+BENCHMARK(BM_LogMacroDisabled);
+
+// 直接调 log()：级别关闭时也要先构造 extras，对比宏的收益
+static void BM_LogCallDisabled(benchmark::State& state) {
+    Logger::instance().set_level(LogLevel::Info);
+    std::string username = "alice";
+    for (auto _ : state) {
+        Logger::instance().log(LogLevel::Debug, "Processing message", { {"type", "message"}, {"user", username} });
+    }
+    Logger::instance().set_level(LogLevel::Warn);
+}
+BENCHMARK(BM_LogCallDisabled);
+
+// 级别开启：调用方只付入队的代价，格式化和写文件在后台线程；队列满按 Drop 策略计数
+static void BM_LogEnabled(benchmark::State& state) {
+    Logger::instance().set_level(LogLevel::Debug);
+    LoggerStats before = Logger::instance().stats();
+    std::string username = "alice";
+    for (auto _ : state) {
+        CHAT_LOG_INFO("Processing message", { {"type", "message"}, {"user", username} });
+    }
+    Logger::instance().set_level(LogLevel::Warn);
+    LoggerStats after = Logger::instance().stats();
+    state.counters["dropped"] = static_cast<double>(after.dropped - before.dropped);
+}
+BENCHMARK(BM_LogEnabled)->ThreadRange(1, 8)->UseRealTime();
+
+// ---------------- 广播扇出 ----------------
+
+// 一组通过本机回环接入的替身会话：服务器侧是真正的 Session（不启动读），客户端侧只把收到的字节数记下来。
+// 测的是 broadcast 到数据写进所有 socket 的完整路径。析构前须先 shutdown()
+class FanoutFixture {
+public:
+    FanoutFixture(bool is_per_core, size_t thread_count)
+        : context_pool_(is_per_core ? thread_count : 1, is_per_core ? 1 : thread_count, false),
+          acceptor_(accept_context_, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0)),
+          is_per_core_(is_per_core) {
+        ServerOptions options;
+        options.presence_flush_interval = std::chrono::milliseconds(20);
+        // 端口 0：服务器自己的 acceptor 不用，会话都由 make_session 直接建
+        server_ = std::make_unique<Server>(context_pool_, 0, nullptr, nullptr, nullptr, nullptr, options);
+        context_pool_.run();
+    }
+
+    Server& server() { return *server_; }
+    uint64_t received_bytes() const { return received_bytes_.load(std::memory_order_acquire); }
+
+    // 让恰好 count 个会话在线，并等上下线增量发完
+    void resize(size_t count) {
+        while (peers_.size() < count) add_peer();
+        for (size_t i = 0; i < peers_.size(); ++i) {
+            Peer& peer = *peers_[i];
+            bool should_be_online = i < count;
+            if (should_be_online == peer.is_online) continue;
+            if (should_be_online) server_->on_login(peer.session, static_cast<UserId>(i + 1), peer.name);
+            else server_->on_disconnect(peer.session);
+            peer.is_online = should_be_online;
+        }
+        settle();
+    }
+
+    bool wait_for_bytes(uint64_t expected_bytes) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (received_bytes() < expected_bytes) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // 会话的析构要访问 Server：先让全部会话下线，停掉线程后关闭客户端 socket，
+    // 再把各 context 里剩下的回调（被取消的读、presence 定时器）跑完，没有谁再持有会话时才析构 Server
+    void shutdown() {
+        resize(0);
+        context_pool_.stop();
+        context_pool_.join();
+        peers_.clear();
+        for (size_t i = 0; i < context_pool_.size(); ++i) {
+            context_pool_.context(i).restart();
+            context_pool_.context(i).run();
+        }
+        server_.reset();
+    }
+
+private:
+    struct Peer {
+        explicit Peer(asio::io_context& io_context) : client(io_context) {}
+        tcp::socket client;
+        std::array<char, 64 * 1024> buffer{};
+        std::shared_ptr<Session> session;
+        UserName name;
+        bool is_online = false;
+    };
+
+    void add_peer() {
+        size_t index = peers_.size();
+        size_t context_index = is_per_core_ ? index % context_pool_.size() : 0;
+        asio::io_context& io_context = context_pool_.context(context_index);
+        auto peer = std::make_unique<Peer>(io_context);
+        peer->client.connect(acceptor_.local_endpoint());
+        if (is_per_core_) {
+            tcp::socket accepted(io_context);
+            acceptor_.accept(accepted);
+            peer->session = server_->make_session(std::move(accepted), context_index);
+        } else {
+            tcp::socket accepted(asio::make_strand(io_context));
+            acceptor_.accept(accepted);
+            peer->session = server_->make_session(std::move(accepted), context_index);
+        }
+        peer->name = std::make_shared<const std::string>("bench" + std::to_string(index));
+        start_drain(*peer);
+        peers_.push_back(std::move(peer));
+    }
+
+    void start_drain(Peer& peer) {
+        peer.client.async_read_some(asio::buffer(peer.buffer), [this, &peer](const boost::system::error_code& ec, size_t byte_count) {
+            if (ec) return;
+            received_bytes_.fetch_add(byte_count, std::memory_order_release);
+            start_drain(peer);
+        });
+    }
+
+    // 收到的字节数连续几个 presence 周期不变，认为快照和增量都已送达
+    void settle() {
+        uint64_t last_bytes = received_bytes();
+        for (int stable_rounds = 0; stable_rounds < 5;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            uint64_t bytes = received_bytes();
+            stable_rounds = bytes == last_bytes ? stable_rounds + 1 : 0;
+            last_bytes = bytes;
+        }
+    }
+
+    IoContextPool context_pool_;
+    asio::io_context accept_context_;
+    tcp::acceptor acceptor_;
+    bool is_per_core_;
+    std::unique_ptr<Server> server_;
+    std::vector<std::unique_ptr<Peer>> peers_;
+    std::atomic<uint64_t> received_bytes_{0};
+};
+
+static std::unique_ptr<FanoutFixture> g_fanout_fixtures[2];
+
+static FanoutFixture& fanout_fixture(bool is_per_core) {
+    std::unique_ptr<FanoutFixture>& fixture = g_fanout_fixtures[is_per_core ? 1 : 0];
+    if (!fixture) {
+        size_t thread_count = std::max(2u, std::thread::hardware_concurrency());
+        fixture = std::make_unique<FanoutFixture>(is_per_core, thread_count);
+    }
+    return *fixture;
+}
+
+// range(0) = 0 共享模式 / 1 每核模式，range(1) = 在线会话数。
+// 每次迭代广播一帧并等它写进全部会话的 socket。allocs_per_broadcast 只算 broadcast() 调用本身，
+// io_allocs_per_broadcast 是同期其他线程（投递、写出）上的分配
+static void BM_BroadcastFanout(benchmark::State& state) {
+    bool is_per_core = state.range(0) != 0;
+    size_t session_count = static_cast<size_t>(state.range(1));
+    FanoutFixture& fixture = fanout_fixture(is_per_core);
+    fixture.resize(session_count);
+    FramePtr frame = make_shared_frame(sample_chat_json(1, false));
+    uint64_t frame_bytes = frame->size();
+    uint64_t expected_bytes = fixture.received_bytes();
+    uint64_t allocations_before = g_allocation_count.load(std::memory_order_relaxed);
+    uint64_t broadcast_allocations = 0;
+    for (auto _ : state) {
+        uint64_t thread_allocations_before = t_allocation_count;
+        fixture.server().broadcast(frame);
+        broadcast_allocations += t_allocation_count - thread_allocations_before;
+        expected_bytes += frame_bytes * session_count;
+        if (!fixture.wait_for_bytes(expected_bytes)) {
+            state.SkipWithError("fan-out did not complete within 10s");
+            break;
+        }
+    }
+    uint64_t allocations = g_allocation_count.load(std::memory_order_relaxed) - allocations_before;
+    state.SetLabel(is_per_core ? "per_core" : "shared");
+    state.counters["allocs_per_broadcast"] = benchmark::Counter(static_cast<double>(broadcast_allocations), benchmark::Counter::kAvgIterations);
+    state.counters["io_allocs_per_broadcast"] = benchmark::Counter(static_cast<double>(allocations - broadcast_allocations),
+                                                                   benchmark::Counter::kAvgIterations);
+    state.counters["deliveries"] = benchmark::Counter(static_cast<double>(state.iterations() * session_count),
+                                                      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BroadcastFanout)
+    ->ArgsProduct({ {0, 1}, {16, 256, 1024} })
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// ---------------- 连接池争用 ----------------
+
+// 占位连接的池：max_size 4，借到后“持有” range(0) 微秒（忙等，模拟一条短查询），多线程争同一个池
+static DBPoolOptions standin_pool_options() {
+    DBPoolOptions options;
+    options.min_size = 4;
+    options.max_size = 4;
+    options.acquire_timeout = std::chrono::seconds(30);
+    options.validate_after_idle = std::chrono::hours(1);
+    options.idle_check_interval = std::chrono::hours(1);
+    options.idle_timeout = std::chrono::hours(1);
+    options.connection_factory = []() { return std::shared_ptr<DbConnection>(); };
+    return options;
+}
+
+static DBPool& standin_pool() {
+    static DBPool pool("", 0, "", "", standin_pool_options());
+    return pool;
+}
+
+static void BM_DBPoolAcquire(benchmark::State& state) {
+    DBPool& pool = standin_pool();
+    auto hold_time = std::chrono::microseconds(state.range(0));
+    for (auto _ : state) {
+        auto connection_ptr = pool.acquire();
+        if (hold_time.count() > 0) {
+            auto until = std::chrono::steady_clock::now() + hold_time;
+            while (std::chrono::steady_clock::now() < until) {}
+        }
+        benchmark::DoNotOptimize(connection_ptr);
+    }
+}
+BENCHMARK(BM_DBPoolAcquire)->Arg(0)->Arg(20)->ThreadRange(1, 16)->UseRealTime();
+
+// ---------------- DB 路径（需要 MySQL）----------------
+
+struct MySqlTarget {
+    std::string host;
+    unsigned port = 33060;
+    std::string user;
+    std::string password;
+};
+
+// CHAT_BENCH_MYSQL=host:port:user:password；没设时相关基准跳过
+static bool mysql_target(MySqlTarget& target) {
+    const char* spec = std::getenv("CHAT_BENCH_MYSQL");
+    if (!spec || !*spec) return false;
+    std::string text = spec;
+    size_t first = text.find(':');
+    size_t second = first == std::string::npos ? std::string::npos : text.find(':', first + 1);
+    size_t third = second == std::string::npos ? std::string::npos : text.find(':', second + 1);
+    if (third == std::string::npos) return false;
+    target.host = text.substr(0, first);
+    target.port = static_cast<unsigned>(std::stoul(text.substr(first + 1, second - first - 1)));
+    target.user = text.substr(second + 1, third - second - 1);
+    target.password = text.substr(third + 1);
+    return true;
+}
+
+static std::unique_ptr<DbConnection> open_bench_connection(benchmark::State& state) {
+    MySqlTarget target;
+    if (!mysql_target(target)) {
+        state.SkipWithError("set CHAT_BENCH_MYSQL=host:port:user:password to run");
+        return nullptr;
+    }
+    try {
+        return std::make_unique<DbConnection>(target.host, target.port, target.user, target.password,
+                                              std::chrono::milliseconds(5000));
+    } catch (const std::exception& ex) {
+        state.SkipWithError(ex.what());
+        return nullptr;
+    }
+}
+
+// range(0) = 1 复用连接上缓存的语句（现在的做法），0 每次从 schema 现建（缓存之前的做法）
+static void BM_MySqlUserLookup(benchmark::State& state) {
+    std::unique_ptr<DbConnection> connection = open_bench_connection(state);
+    if (!connection) {
+        for (auto _ : state) {}
+        return;
+    }
+    bool is_cached = state.range(0) != 0;
+    try {
+        for (auto _ : state) {
+            if (is_cached) {
+                std::vector<mysqlx::Row> rows = connection->user_password_lookup.bind("username", "bench0").execute().fetchAll();
+                benchmark::DoNotOptimize(rows.size());
+            } else {
+                std::vector<mysqlx::Row> rows = connection->session.getSchema("chatdb").getTable("users")
+                    .select("id", "password").where("username = :username").bind("username", "bench0").execute().fetchAll();
+                benchmark::DoNotOptimize(rows.size());
+            }
+        }
+    } catch (const std::exception& ex) {
+        state.SkipWithError(ex.what());
+    }
+    state.SetLabel(is_cached ? "cached" : "adhoc");
+}
+BENCHMARK(BM_MySqlUserLookup)->Arg(0)->Arg(1)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+// 写后队列的一批 INSERT：range(0) 同上，range(1) 为每批行数。每批在事务里写完后回滚，不留数据；
+// 发送者用 bench0（没有就建），外键才能通过。id 交给 AUTO_INCREMENT，避免与库里已有的消息冲突
+static void BM_MySqlMessageInsert(benchmark::State& state) {
+    std::unique_ptr<DbConnection> connection = open_bench_connection(state);
+    if (!connection) {
+        for (auto _ : state) {}
+        return;
+    }
+    bool is_cached = state.range(0) != 0;
+    size_t row_count = static_cast<size_t>(state.range(1));
+    std::string text(64, 'x');
+    try {
+        std::vector<mysqlx::Row> users = connection->user_id_lookup.bind("username", "bench0").execute().fetchAll();
+        if (users.empty()) {
+            connection->users_table.insert("username", "password").values("bench0", "bench").execute();
+            users = connection->user_id_lookup.bind("username", "bench0").execute().fetchAll();
+        }
+        if (users.empty()) {
+            state.SkipWithError("cannot create user bench0");
+            for (auto _ : state) {}
+            return;
+        }
+        int64_t sender_id = users[0][0].get<int64_t>();
+        for (auto _ : state) {
+            connection->session.startTransaction();
+            auto insert_stmt = is_cached ? connection->messages_table.insert("sender_id", "recipient_id", "text", "ts")
+                                         : connection->session.getSchema("chatdb").getTable("messages")
+                                               .insert("sender_id", "recipient_id", "text", "ts");
+            for (size_t i = 0; i < row_count; ++i) insert_stmt.values(sender_id, mysqlx::Value(), text, int64_t(0));
+            insert_stmt.execute();
+            connection->session.rollback();
+        }
+    } catch (const std::exception& ex) {
+        state.SkipWithError(ex.what());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(row_count));
+    state.SetLabel(is_cached ? "cached" : "adhoc");
+}
+BENCHMARK(BM_MySqlMessageInsert)
+    ->ArgsProduct({ {0, 1}, {1, 64} })
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+// 公共频道最新一页（history 未命中缓存时走的查询）：range(0) 同上，range(1) 为页大小
+static void BM_MySqlRecentPage(benchmark::State& state) {
+    std::unique_ptr<DbConnection> connection = open_bench_connection(state);
+    if (!connection) {
+        for (auto _ : state) {}
+        return;
+    }
+    bool is_cached = state.range(0) != 0;
+    unsigned page_size = static_cast<unsigned>(state.range(1));
+    int64_t bound = std::numeric_limits<int64_t>::max();
+    try {
+        for (auto _ : state) {
+            if (is_cached) {
+                std::vector<mysqlx::Row> rows = connection->recent_page.limit(page_size).bind("bound", bound).execute().fetchAll();
+                benchmark::DoNotOptimize(rows.size());
+            } else {
+                std::vector<mysqlx::Row> rows = connection->session.getSchema("chatdb").getTable("messages")
+                    .select("id", "sender_id", "recipient_id", "text", "ts")
+                    .where("recipient_id IS NULL AND id < :bound").orderBy("id DESC")
+                    .limit(page_size).bind("bound", bound).execute().fetchAll();
+                benchmark::DoNotOptimize(rows.size());
+            }
+        }
+    } catch (const std::exception& ex) {
+        state.SkipWithError(ex.what());
+    }
+    state.SetLabel(is_cached ? "cached" : "adhoc");
+}
+BENCHMARK(BM_MySqlRecentPage)
+    ->ArgsProduct({ {0, 1}, {50} })
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char** argv) {
+    // 日志写到临时目录，默认只留 Warn 以上，日志基准自己切级别
+    std::filesystem::path log_path = std::filesystem::temp_directory_path() / "chat_bench" / "bench.log";
+    std::filesystem::create_directories(log_path.parent_path());
+    Logger::instance().init(log_path.string(), LogLevel::Warn, 64ull * 1024 * 1024, 2);
+    AsyncLogOptions log_options;
+    log_options.overflow_policy = LogOverflowPolicy::Drop;
+    Logger::instance().enable_async(log_options);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    for (auto& fixture : g_fanout_fixtures) {
+        if (!fixture) continue;
+        fixture->shutdown();
+        fixture.reset();
+    }
+    Logger::instance().shutdown();
+    return 0;
+}
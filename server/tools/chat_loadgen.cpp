@@ -0,0 +1,738 @@
+﻿// chat_loadgen：无界面的压测客户端，按 protocol.hpp 的帧格式模拟大量并发用户。
+// 每个虚拟用户依次 注册（可选）→ 登录 → 按泊松到达发公共消息、私信、拉历史，偶尔登出重连（churn）。
+// 消息正文带发送时刻，收到扇出时算端到端投递延迟（私信只算收件人那一份）；结束时输出表格和 JSON（--json）。
+// 用法见 print_usage；只用于压本机或测试环境的服务器
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include "protocol.hpp"
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct LoadgenOptions {
+    std::string host = "127.0.0.1";
+    std::string port = "9000";
+    size_t users = 1000;
+    size_t threads = 0;                         // 0 = 硬件线程数
+    std::chrono::milliseconds duration{60000};  // 统计窗口
+    std::chrono::milliseconds ramp{10000};      // 用户在这段时间内均匀上线，不计入统计
+    std::chrono::milliseconds drain{2000};      // 停止发送后继续收的时间，让在途消息落地
+    // 以下速率都是每个用户每秒
+    double public_rate = 0.1;
+    double private_rate = 0.05;
+    double history_rate = 0.01;
+    double churn_rate = 0.002;
+    size_t message_bytes = 64;
+    size_t pipeline = 1;                        // 每次写合并的请求数；总请求速率不变
+    std::string metrics_port;                   // 非空时在统计窗口两端抓服务器 /metrics，算每帧读次数
+    bool is_register = true;
+    std::string user_prefix = "lg";
+    std::string password = "loadgen";
+    std::string json_path;                      // "-" 表示 JSON 写到标准输出，表格改到 stderr
+    uint64_t seed = 1;
+};
+
+static void print_usage() {
+    std::cerr << "usage: chat_loadgen [--host H] [--port P] [--users N] [--threads T]\n"
+                 "                    [--duration S] [--ramp S] [--drain S]\n"
+                 "                    [--public-rate R] [--private-rate R] [--history-rate R] [--churn-rate R]\n"
+                 "                    [--message-bytes B] [--no-register] [--user-prefix P] [--password PW]\n"
+                 "                    [--pipeline K] [--metrics-port P] [--seed N] [--json PATH|-]\n"
+                 "rates are per user per second; durations are seconds (fractions allowed)" << std::endl;
+}
+
+static std::chrono::milliseconds parse_seconds(const std::string& value) {
+    return std::chrono::milliseconds(static_cast<int64_t>(std::stod(value) * 1000));
+}
+
+static bool parse_options(int argc, char** argv, LoadgenOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--no-register") { options.is_register = false; continue; }
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = value;
+        else if (arg == "--users") options.users = std::max<size_t>(1, std::stoul(value));
+        else if (arg == "--threads") options.threads = std::stoul(value);
+        else if (arg == "--duration") options.duration = parse_seconds(value);
+        else if (arg == "--ramp") options.ramp = parse_seconds(value);
+        else if (arg == "--drain") options.drain = parse_seconds(value);
+        else if (arg == "--public-rate") options.public_rate = std::max(0.0, std::stod(value));
+        else if (arg == "--private-rate") options.private_rate = std::max(0.0, std::stod(value));
+        else if (arg == "--history-rate") options.history_rate = std::max(0.0, std::stod(value));
+        else if (arg == "--churn-rate") options.churn_rate = std::max(0.0, std::stod(value));
+        else if (arg == "--message-bytes") options.message_bytes = std::stoul(value);
+        else if (arg == "--pipeline") options.pipeline = std::max<size_t>(1, std::stoul(value));
+        else if (arg == "--metrics-port") options.metrics_port = value;
+        else if (arg == "--user-prefix") options.user_prefix = value;
+        else if (arg == "--password") options.password = value;
+        else if (arg == "--seed") options.seed = std::stoull(value);
+        else if (arg == "--json") options.json_path = value;
+        else return false;
+    }
+    return true;
+}
+
+// 微秒级延迟直方图：每个 2 的幂区间分 128 个线性子桶，相对误差 < 1%。
+// 每个工作线程一份，不加锁，结束时合并
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 7;
+    static constexpr uint64_t kSubBucketCount = uint64_t(1) << kSubBucketBits;
+    static constexpr unsigned kMaxBits = 40;    // 约 12.7 天，足够装下任何超时
+
+    LatencyHistogram() : counts_((kMaxBits - kSubBucketBits + 1) * kSubBucketCount, 0) {}
+
+    void record(uint64_t value_us) {
+        size_t index = bucket_index(value_us);
+        if (index >= counts_.size()) index = counts_.size() - 1;
+        ++counts_[index];
+        ++count_;
+        max_ = std::max(max_, value_us);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+
+    // 返回第 quantile 分位所在桶的上界（不超过实际最大值）
+    uint64_t percentile(double quantile) const {
+        if (count_ == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count_) + 0.5);
+        rank = std::max<uint64_t>(1, std::min(rank, count_));
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            cumulative += counts_[i];
+            if (cumulative >= rank) return std::min(bucket_upper_bound(i), max_);
+        }
+        return max_;
+    }
+
+private:
+    static unsigned highest_bit(uint64_t value) {
+        unsigned bit = 0;
+        while (value >>= 1) ++bit;
+        return bit;
+    }
+    static size_t bucket_index(uint64_t value) {
+        if (value < kSubBucketCount) return static_cast<size_t>(value);
+        unsigned shift = highest_bit(value) - kSubBucketBits;
+        return static_cast<size_t>(kSubBucketCount + shift * kSubBucketCount + ((value >> shift) - kSubBucketCount));
+    }
+    static uint64_t bucket_upper_bound(size_t index) {
+        if (index < kSubBucketCount) return index;
+        uint64_t shift = index / kSubBucketCount - 1;
+        uint64_t sub_bucket = index % kSubBucketCount;
+        return ((kSubBucketCount + sub_bucket + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
+
+// 一个工作线程上所有用户共享的计数，只在该线程上改
+struct LoadStats {
+    uint64_t connects = 0;
+    uint64_t connect_errors = 0;
+    uint64_t unexpected_disconnects = 0;
+    uint64_t logins_ok = 0;
+    uint64_t logins_failed = 0;
+    uint64_t registers_ok = 0;
+    uint64_t sent_public = 0;
+    uint64_t sent_private = 0;
+    uint64_t sent_history = 0;
+    uint64_t churns = 0;
+    uint64_t received_public = 0;
+    uint64_t received_private = 0;
+    uint64_t frames_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t resyncs = 0;
+    std::map<std::string, uint64_t> errors;     // 服务器回的 error / 登录失败原因
+    LatencyHistogram public_delivery;
+    LatencyHistogram private_delivery;
+    LatencyHistogram login;
+    LatencyHistogram history;
+
+    void merge(const LoadStats& other) {
+        connects += other.connects;
+        connect_errors += other.connect_errors;
+        unexpected_disconnects += other.unexpected_disconnects;
+        logins_ok += other.logins_ok;
+        logins_failed += other.logins_failed;
+        registers_ok += other.registers_ok;
+        sent_public += other.sent_public;
+        sent_private += other.sent_private;
+        sent_history += other.sent_history;
+        churns += other.churns;
+        received_public += other.received_public;
+        received_private += other.received_private;
+        frames_in += other.frames_in;
+        bytes_in += other.bytes_in;
+        bytes_out += other.bytes_out;
+        resyncs += other.resyncs;
+        for (const auto& entry : other.errors) errors[entry.first] += entry.second;
+        public_delivery.merge(other.public_delivery);
+        private_delivery.merge(other.private_delivery);
+        login.merge(other.login);
+        history.merge(other.history);
+    }
+};
+
+// 整个压测的时间线：[start, measure_start) 上线爬坡，[measure_start, send_deadline) 统计窗口，
+// 之后 drain 段只收不发
+struct Timeline {
+    Clock::time_point start;
+    Clock::time_point measure_start;
+    Clock::time_point send_deadline;
+};
+
+static uint64_t to_ns(Clock::time_point time_point) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count());
+}
+
+class VirtualUser;
+
+// 每个工作线程一个 io_context，用户固定在自己的线程上，回调之间不需要同步
+struct Worker {
+    asio::io_context io_context;
+    tcp::resolver::results_type endpoints;
+    LoadStats stats;
+    std::vector<std::shared_ptr<VirtualUser>> users;
+};
+
+class VirtualUser : public std::enable_shared_from_this<VirtualUser> {
+public:
+    VirtualUser(Worker& worker, const LoadgenOptions& options, const Timeline& timeline, size_t index)
+        : worker_(worker), options_(options), timeline_(timeline), index_(index),
+          name_(options.user_prefix + std::to_string(index)),
+          socket_(worker.io_context), timer_(worker.io_context), rng_(options.seed * 1000003u + index) {}
+
+    void start(Clock::time_point at) {
+        auto self = shared_from_this();
+        timer_.expires_at(at);
+        timer_.async_wait([this, self](const boost::system::error_code& ec) {
+            if (!ec) connect();
+        });
+    }
+
+    void stop() {
+        is_stopped_ = true;
+        timer_.cancel();
+        boost::system::error_code ignored_ec;
+        socket_.close(ignored_ec);
+    }
+
+private:
+    enum class State { Idle, Connecting, LoggingIn, Active, LeavingOnPurpose };
+
+    void connect() {
+        if (is_stopped_) return;
+        state_ = State::Connecting;
+        ++generation_;
+        socket_ = tcp::socket(worker_.io_context);
+        write_queue_.clear();
+        is_writing_ = false;
+        pending_history_.clear();
+        auto self = shared_from_this();
+        uint64_t generation = generation_;
+        asio::async_connect(socket_, worker_.endpoints, [this, self, generation](const boost::system::error_code& ec, const tcp::endpoint&) {
+            if (is_stopped_ || generation != generation_) return;
+            if (ec) {
+                ++worker_.stats.connect_errors;
+                reconnect_later(std::chrono::milliseconds(1000));
+                return;
+            }
+            ++worker_.stats.connects;
+            boost::system::error_code ignored_ec;
+            socket_.set_option(tcp::no_delay(true), ignored_ec);
+            state_ = State::LoggingIn;
+            if (options_.is_register) {
+                send(json{ {"type", "register"}, {"username", name_}, {"password", options_.password} });
+            }
+            login_started_ = Clock::now();
+            send(json{ {"type", "login"}, {"username", name_}, {"password", options_.password} });
+            read_header();
+        });
+    }
+
+    void reconnect_later(std::chrono::milliseconds delay) {
+        if (is_stopped_ || Clock::now() >= timeline_.send_deadline) return;
+        state_ = State::Idle;
+        boost::system::error_code ignored_ec;
+        socket_.close(ignored_ec);
+        auto self = shared_from_this();
+        timer_.expires_after(delay);
+        timer_.async_wait([this, self](const boost::system::error_code& ec) {
+            if (!ec) connect();
+        });
+    }
+
+    void on_closed() {
+        if (is_stopped_) return;
+        if (state_ == State::LeavingOnPurpose) {
+            std::uniform_int_distribution<int> delay_ms(0, 1000);
+            reconnect_later(std::chrono::milliseconds(delay_ms(rng_)));
+            return;
+        }
+        if (state_ == State::Idle) return;
+        ++worker_.stats.unexpected_disconnects;
+        reconnect_later(std::chrono::milliseconds(1000));
+    }
+
+    void read_header() {
+        auto self = shared_from_this();
+        uint64_t generation = generation_;
+        asio::async_read(socket_, asio::buffer(header_), [this, self, generation](const boost::system::error_code& ec, size_t) {
+            if (generation != generation_) return;
+            if (ec) { on_closed(); return; }
+            uint32_t length = parse_length(header_.data()) & kFrameLengthMask;
+            body_.resize(length);
+            asio::async_read(socket_, asio::buffer(&body_[0], body_.size()), [this, self, generation](const boost::system::error_code& ec, size_t) {
+                if (generation != generation_) return;
+                if (ec) { on_closed(); return; }
+                worker_.stats.bytes_in += 4 + body_.size();
+                ++worker_.stats.frames_in;
+                try {
+                    on_frame(json::parse(body_));
+                } catch (const std::exception& ex) {
+                    ++worker_.stats.errors[std::string("bad_frame")];
+                    std::cerr << "bad frame from server: " << ex.what() << std::endl;
+                }
+                read_header();
+            });
+        });
+    }
+
+    void on_frame(const json& frame_json) {
+        std::string type = frame_json.value("type", std::string());
+        Clock::time_point now = Clock::now();
+        if (type == "message") {
+            record_delivery(false, frame_json.value("text", std::string()), now);
+        } else if (type == "private") {
+            // 服务器把私信也回显给发送者；只算收件人这一份，received_private 与 sent_private 一一对应
+            if (frame_json.value("to", std::string()) == name_) record_delivery(true, frame_json.value("text", std::string()), now);
+        } else if (type == "login_result") {
+            if (frame_json.value("ok", false)) {
+                ++worker_.stats.logins_ok;
+                worker_.stats.login.record(elapsed_us(login_started_, now));
+                state_ = State::Active;
+                schedule_next();
+            } else {
+                std::string reason = frame_json.value("reason", std::string("failed"));
+                ++worker_.stats.logins_failed;
+                ++worker_.stats.errors["login_" + reason];
+                // 口令不对重试也没用，这个用户退出；DB 暂不可用时稍后重连再试
+                if (reason == "db_unavailable") reconnect_later(std::chrono::milliseconds(1000));
+                else stop();
+            }
+        } else if (type == "register_result") {
+            // 重复跑时用户已存在是正常的，只记成功次数
+            if (frame_json.value("ok", false)) ++worker_.stats.registers_ok;
+        } else if (type == "history_batch") {
+            if (!pending_history_.empty()) {
+                worker_.stats.history.record(elapsed_us(pending_history_.front(), now));
+                pending_history_.pop_front();
+            }
+        } else if (type == "error") {
+            ++worker_.stats.errors[frame_json.value("error", std::string("unknown"))];
+        } else if (type == "resync") {
+            ++worker_.stats.resyncs;
+        }
+    }
+
+    // 正文格式 "lg:<发送时刻 ns>:<填充>"，别的客户端发的消息不计
+    void record_delivery(bool is_private, const std::string& text, Clock::time_point now) {
+        if (text.compare(0, 3, "lg:") != 0) return;
+        uint64_t sent_ns = std::strtoull(text.c_str() + 3, nullptr, 10);
+        if (sent_ns < to_ns(timeline_.measure_start)) return;
+        uint64_t latency_us = (to_ns(now) - std::min(sent_ns, to_ns(now))) / 1000;
+        if (is_private) {
+            ++worker_.stats.received_private;
+            worker_.stats.private_delivery.record(latency_us);
+        } else {
+            ++worker_.stats.received_public;
+            worker_.stats.public_delivery.record(latency_us);
+        }
+    }
+
+    // 各类动作的到达合并成一个泊松过程，每次到点再按速率比例抽动作。
+    // --pipeline K 时每次到点抽 K 个，拼成一次写发出，到点速率相应除以 K
+    void schedule_next() {
+        double total_rate = options_.public_rate + options_.private_rate + options_.history_rate + options_.churn_rate;
+        if (total_rate <= 0 || is_stopped_) return;
+        std::exponential_distribution<double> gap_seconds(total_rate / static_cast<double>(options_.pipeline));
+        auto gap = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap_seconds(rng_)));
+        Clock::time_point next_at = Clock::now() + gap;
+        if (next_at >= timeline_.send_deadline) return;
+        auto self = shared_from_this();
+        timer_.expires_at(next_at);
+        timer_.async_wait([this, self, total_rate](const boost::system::error_code& ec) {
+            if (ec || state_ != State::Active) return;
+            std::uniform_real_distribution<double> pick(0.0, total_rate);
+            bool is_measuring = Clock::now() >= timeline_.measure_start;
+            std::vector<uint8_t> batch;
+            for (size_t i = 0; i < options_.pipeline; ++i) {
+                double choice = pick(rng_);
+                if ((choice -= options_.public_rate) < 0) {
+                    append_frame(batch, json{ {"type", "message"}, {"text", make_text()} });
+                    if (is_measuring) ++worker_.stats.sent_public;
+                } else if ((choice -= options_.private_rate) < 0) {
+                    append_frame(batch, json{ {"type", "private"}, {"to", pick_peer()}, {"text", make_text()} });
+                    if (is_measuring) ++worker_.stats.sent_private;
+                } else if ((choice -= options_.history_rate) < 0) {
+                    pending_history_.push_back(Clock::now());
+                    append_frame(batch, json{ {"type", "history"}, {"n", 50} });
+                    if (is_measuring) ++worker_.stats.sent_history;
+                } else {
+                    ++worker_.stats.churns;
+                    state_ = State::LeavingOnPurpose;
+                    // 服务器收到后关连接，读端看到 EOF 再重连；同一批里 logout 之后的请求不再发
+                    append_frame(batch, json{ {"type", "logout"} });
+                    send_bytes(std::move(batch));
+                    return;
+                }
+            }
+            send_bytes(std::move(batch));
+            schedule_next();
+        });
+    }
+
+    std::string make_text() {
+        std::string text = "lg:" + std::to_string(to_ns(Clock::now())) + ":";
+        if (text.size() < options_.message_bytes) text.append(options_.message_bytes - text.size(), 'x');
+        return text;
+    }
+
+    std::string pick_peer() {
+        if (options_.users < 2) return name_;
+        std::uniform_int_distribution<size_t> peer(0, options_.users - 2);
+        size_t peer_index = peer(rng_);
+        if (peer_index >= index_) ++peer_index;
+        return options_.user_prefix + std::to_string(peer_index);
+    }
+
+    void send(const json& request_json) {
+        send_bytes(make_frame(request_json.dump()));
+    }
+
+    static void append_frame(std::vector<uint8_t>& batch, const json& request_json) {
+        std::vector<uint8_t> frame = make_frame(request_json.dump());
+        batch.insert(batch.end(), frame.begin(), frame.end());
+    }
+
+    // 队列里的一项是一次 async_write；流水线模式下一项含多帧
+    void send_bytes(std::vector<uint8_t> bytes) {
+        worker_.stats.bytes_out += bytes.size();
+        write_queue_.push_back(std::make_shared<std::vector<uint8_t>>(std::move(bytes)));
+        if (!is_writing_) write_next();
+    }
+
+    void write_next() {
+        if (write_queue_.empty()) { is_writing_ = false; return; }
+        is_writing_ = true;
+        auto self = shared_from_this();
+        auto frame = write_queue_.front();
+        uint64_t generation = generation_;
+        asio::async_write(socket_, asio::buffer(*frame), [this, self, frame, generation](const boost::system::error_code& ec, size_t) {
+            if (generation != generation_) return;   // 旧连接上的写，队列已随重连清空
+            if (ec) { is_writing_ = false; return; }   // 读端会看到同一个错误并处理重连
+            write_queue_.pop_front();
+            write_next();
+        });
+    }
+
+    static uint64_t elapsed_us(Clock::time_point from, Clock::time_point to) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+    }
+
+    Worker& worker_;
+    const LoadgenOptions& options_;
+    const Timeline& timeline_;
+    size_t index_;
+    std::string name_;
+    tcp::socket socket_;
+    asio::steady_timer timer_;
+    std::mt19937_64 rng_;
+    State state_ = State::Idle;
+    bool is_stopped_ = false;
+    uint64_t generation_ = 0;       // 每次重连加一，旧 socket 上迟到的回调据此丢弃
+    std::array<uint8_t, 4> header_{};
+    std::string body_;
+    std::deque<std::shared_ptr<std::vector<uint8_t>>> write_queue_;
+    bool is_writing_ = false;
+    Clock::time_point login_started_;
+    std::deque<Clock::time_point> pending_history_;
+};
+
+// 服务器接收侧的两个计数，取自 /metrics；统计窗口两端各抓一次相减
+struct ServerReadCounters {
+    bool is_valid = false;
+    uint64_t read_calls = 0;
+    uint64_t frames_read = 0;
+};
+
+// 同步抓一次 /metrics（指标端口只听回环地址，所以只对本机服务器有效），失败时 is_valid 为 false
+static ServerReadCounters scrape_read_counters(const std::string& host, const std::string& port) {
+    ServerReadCounters counters;
+    try {
+        asio::io_context io_context;
+        tcp::resolver resolver(io_context);
+        tcp::socket socket(io_context);
+        asio::connect(socket, resolver.resolve(host, port));
+        std::string request = "GET /metrics HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+        asio::write(socket, asio::buffer(request));
+        std::string response;
+        boost::system::error_code ec;
+        asio::read(socket, asio::dynamic_buffer(response), ec);
+        if (ec && ec != asio::error::eof) throw boost::system::system_error(ec);
+        std::istringstream lines(response);
+        std::string name;
+        double value = 0;
+        bool has_reads = false;
+        bool has_frames = false;
+        for (std::string line; std::getline(lines, line);) {
+            std::istringstream fields(line);
+            if (!(fields >> name >> value)) continue;
+            if (name == "chat_read_calls_total") { counters.read_calls = static_cast<uint64_t>(value); has_reads = true; }
+            else if (name == "chat_frames_read_total") { counters.frames_read = static_cast<uint64_t>(value); has_frames = true; }
+        }
+        counters.is_valid = has_reads && has_frames;
+        if (!counters.is_valid) std::cerr << "metrics on port " << port << " have no read counters" << std::endl;
+    } catch (const std::exception& ex) {
+        std::cerr << "scrape " << host << ":" << port << "/metrics failed: " << ex.what() << std::endl;
+    }
+    return counters;
+}
+
+static double to_ms(uint64_t value_us) {
+    return static_cast<double>(value_us) / 1000.0;
+}
+
+static json latency_json(const LatencyHistogram& histogram, double seconds) {
+    return json{
+        {"count", histogram.count()},
+        {"rate_per_sec", seconds > 0 ? static_cast<double>(histogram.count()) / seconds : 0.0},
+        {"p50_ms", to_ms(histogram.percentile(0.50))},
+        {"p99_ms", to_ms(histogram.percentile(0.99))},
+        {"p999_ms", to_ms(histogram.percentile(0.999))},
+        {"max_ms", to_ms(histogram.max())},
+    };
+}
+
+static void print_latency_row(std::FILE* out, const char* label, const LatencyHistogram& histogram, double seconds) {
+    std::fprintf(out, "%-18s %10llu %10.1f %9.2f %9.2f %9.2f %9.2f\n", label,
+                      static_cast<unsigned long long>(histogram.count()),
+                      seconds > 0 ? static_cast<double>(histogram.count()) / seconds : 0.0,
+                      to_ms(histogram.percentile(0.50)), to_ms(histogram.percentile(0.99)),
+                      to_ms(histogram.percentile(0.999)), to_ms(histogram.max()));
+}
+
+static double reads_per_frame(const ServerReadCounters& server_reads) {
+    return server_reads.frames_read > 0 ? static_cast<double>(server_reads.read_calls) / server_reads.frames_read : 0.0;
+}
+
+static json report_json(const LoadgenOptions& options, size_t thread_count, const LoadStats& total, const ServerReadCounters& server_reads,
+                        double seconds) {
+    json errors_json = json::object();
+    for (const auto& entry : total.errors) errors_json[entry.first] = entry.second;
+    json report = json{
+        {"config", {
+            {"host", options.host}, {"port", options.port}, {"users", options.users}, {"threads", thread_count},
+            {"duration_sec", seconds}, {"ramp_sec", options.ramp.count() / 1000.0},
+            {"public_rate", options.public_rate}, {"private_rate", options.private_rate},
+            {"history_rate", options.history_rate}, {"churn_rate", options.churn_rate},
+            {"message_bytes", options.message_bytes}, {"pipeline", options.pipeline},
+        }},
+        {"latency", {
+            {"public_delivery", latency_json(total.public_delivery, seconds)},
+            {"private_delivery", latency_json(total.private_delivery, seconds)},
+            {"login", latency_json(total.login, seconds)},
+            {"history", latency_json(total.history, seconds)},
+        }},
+        {"throughput", {
+            {"sent_public", total.sent_public}, {"sent_private", total.sent_private},
+            {"sent_history", total.sent_history}, {"churns", total.churns},
+            {"sent_per_sec", seconds > 0 ? (total.sent_public + total.sent_private) / seconds : 0.0},
+            {"delivered_per_sec", seconds > 0 ? (total.received_public + total.received_private) / seconds : 0.0},
+            {"frames_in", total.frames_in}, {"bytes_in", total.bytes_in}, {"bytes_out", total.bytes_out},
+        }},
+        {"connections", {
+            {"connects", total.connects}, {"connect_errors", total.connect_errors},
+            {"unexpected_disconnects", total.unexpected_disconnects},
+            {"logins_ok", total.logins_ok}, {"logins_failed", total.logins_failed},
+            {"registers_ok", total.registers_ok}, {"resyncs", total.resyncs},
+        }},
+        {"errors", errors_json},
+    };
+    if (server_reads.is_valid) {
+        report["server"] = json{
+            {"read_calls", server_reads.read_calls}, {"frames_read", server_reads.frames_read},
+            {"reads_per_frame", reads_per_frame(server_reads)},
+        };
+    }
+    return report;
+}
+
+// --json - 时 JSON 独占标准输出，表格改写到 stderr
+static void print_report(std::FILE* out, const LoadgenOptions& options, size_t thread_count, const LoadStats& total,
+                         const ServerReadCounters& server_reads, double seconds) {
+    std::fprintf(out, "chat_loadgen: %zu users on %zu threads against %s:%s, %.1fs measured after %.1fs ramp, %zu requests per write\n\n",
+                      options.users, thread_count, options.host.c_str(), options.port.c_str(), seconds, options.ramp.count() / 1000.0,
+                      options.pipeline);
+    std::fprintf(out, "%-18s %10s %10s %9s %9s %9s %9s\n", "latency", "count", "per sec", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+    print_latency_row(out, "public delivery", total.public_delivery, seconds);
+    print_latency_row(out, "private delivery", total.private_delivery, seconds);
+    print_latency_row(out, "login", total.login, seconds);
+    print_latency_row(out, "history", total.history, seconds);
+    std::fprintf(out, "\nsent      public %llu, private %llu, history %llu, churn %llu (%.1f msgs/s)\n",
+                      static_cast<unsigned long long>(total.sent_public), static_cast<unsigned long long>(total.sent_private),
+                      static_cast<unsigned long long>(total.sent_history), static_cast<unsigned long long>(total.churns),
+                      seconds > 0 ? (total.sent_public + total.sent_private) / seconds : 0.0);
+    std::fprintf(out, "received  %llu frames, %.1f MB in, %.1f MB out\n", static_cast<unsigned long long>(total.frames_in),
+                      total.bytes_in / 1e6, total.bytes_out / 1e6);
+    std::fprintf(out, "sessions  connects %llu, connect errors %llu, unexpected disconnects %llu, logins ok %llu, failed %llu, resyncs %llu\n",
+                      static_cast<unsigned long long>(total.connects), static_cast<unsigned long long>(total.connect_errors),
+                      static_cast<unsigned long long>(total.unexpected_disconnects), static_cast<unsigned long long>(total.logins_ok),
+                      static_cast<unsigned long long>(total.logins_failed), static_cast<unsigned long long>(total.resyncs));
+    if (server_reads.is_valid) {
+        std::fprintf(out, "server    %llu reads for %llu frames (%.3f reads/frame)\n",
+                          static_cast<unsigned long long>(server_reads.read_calls), static_cast<unsigned long long>(server_reads.frames_read),
+                          reads_per_frame(server_reads));
+    }
+    std::fprintf(out, "errors   ");
+    if (total.errors.empty()) std::fprintf(out, " none");
+    for (const auto& entry : total.errors) std::fprintf(out, " %s=%llu", entry.first.c_str(), static_cast<unsigned long long>(entry.second));
+    std::fprintf(out, "\n");
+}
+
+int main(int argc, char** argv) {
+    LoadgenOptions options;
+    try {
+        if (!parse_options(argc, argv, options)) {
+            print_usage();
+            return 1;
+        }
+    } catch (const std::exception&) {
+        print_usage();
+        return 1;
+    }
+    size_t thread_count = options.threads ? options.threads : std::thread::hardware_concurrency();
+    if (thread_count == 0) thread_count = 2;
+    thread_count = std::min(thread_count, options.users);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    try {
+        asio::io_context resolver_context;
+        tcp::resolver resolver(resolver_context);
+        tcp::resolver::results_type endpoints = resolver.resolve(options.host, options.port);
+        for (size_t i = 0; i < thread_count; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+            workers.back()->endpoints = endpoints;
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "resolve " << options.host << ":" << options.port << " failed: " << ex.what() << std::endl;
+        return 1;
+    }
+
+    Timeline timeline;
+    timeline.start = Clock::now();
+    timeline.measure_start = timeline.start + options.ramp;
+    timeline.send_deadline = timeline.measure_start + options.duration;
+
+    // 上线时刻在爬坡段内均匀错开，避免所有用户同一瞬间登录
+    for (size_t i = 0; i < options.users; ++i) {
+        Worker& worker = *workers[i % thread_count];
+        auto user = std::make_shared<VirtualUser>(worker, options, timeline, i);
+        worker.users.push_back(user);
+        user->start(timeline.start + options.ramp * static_cast<int64_t>(i) / static_cast<int64_t>(options.users));
+    }
+
+    using WorkGuard = asio::executor_work_guard<asio::io_context::executor_type>;
+    std::vector<WorkGuard> work_guards;
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        work_guards.push_back(asio::make_work_guard(worker->io_context));
+        Worker* worker_ptr = worker.get();
+        threads.emplace_back([worker_ptr]() {
+            try {
+                worker_ptr->io_context.run();
+            } catch (const std::exception& ex) {
+                std::cerr << "worker thread error: " << ex.what() << std::endl;
+            }
+        });
+    }
+
+    // 服务器的读计数在统计窗口两端各抓一次，差值只含窗口内的请求（同一服务器上别的客户端也会算进来）
+    ServerReadCounters server_reads;
+    if (!options.metrics_port.empty()) {
+        std::this_thread::sleep_until(timeline.measure_start);
+        ServerReadCounters window_start = scrape_read_counters(options.host, options.metrics_port);
+        std::this_thread::sleep_until(timeline.send_deadline);
+        ServerReadCounters window_end = scrape_read_counters(options.host, options.metrics_port);
+        if (window_start.is_valid && window_end.is_valid) {
+            server_reads.is_valid = true;
+            server_reads.read_calls = window_end.read_calls - window_start.read_calls;
+            server_reads.frames_read = window_end.frames_read - window_start.frames_read;
+        }
+    }
+    std::this_thread::sleep_until(timeline.send_deadline + options.drain);
+    for (auto& worker : workers) {
+        Worker* worker_ptr = worker.get();
+        asio::post(worker_ptr->io_context, [worker_ptr]() {
+            for (auto& user : worker_ptr->users) user->stop();
+        });
+    }
+    work_guards.clear();
+    for (auto& thread : threads) thread.join();
+
+    LoadStats total;
+    for (auto& worker : workers) total.merge(worker->stats);
+    double seconds = options.duration.count() / 1000.0;
+    print_report(options.json_path == "-" ? stderr : stdout, options, thread_count, total, server_reads, seconds);
+    if (!options.json_path.empty()) {
+        std::string report_text = report_json(options, thread_count, total, server_reads, seconds).dump(2);
+        if (options.json_path == "-") {
+            std::cout << report_text << std::endl;
+        } else {
+            std::ofstream report_file(options.json_path);
+            if (!report_file) {
+                std::cerr << "cannot write " << options.json_path << std::endl;
+                return 1;
+            }
+            report_file << report_text << std::endl;
+        }
+    }
+    return total.logins_ok > 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+﻿// chat_migrate：把 messages 的 sender/recipient（VARCHAR 用户名）原地回填为 sender_id/recipient_id。
+// 前提：已执行 sql/003_message_user_ids.sql。按 id 区间分批 UPDATE，每批单独提交，不长时间锁表；
+// 只处理 sender_id 为空的行，可以反复执行（旧 server 还在写时先跑一遍，停服后再跑一遍补齐）。
+// 全部回填且校验通过后再执行 sql/004_drop_message_usernames.sql
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <mysqlx/xdevapi.h>
+
+struct MigrateOptions {
+    std::string host = "127.0.0.1";
+    unsigned port = 33060;
+    std::string user = "root";
+    std::string password = "mypassword";
+    int64_t batch_size = 5000;                  // 每批覆盖的 id 区间长度
+    std::chrono::milliseconds pause{0};         // 批间休眠，给线上写入和复制让路
+    bool create_missing_users = false;          // 为 users 表里没有的发送者/收件人补建账号（随机口令，无法登录）
+};
+
+static void print_usage() {
+    std::cerr << "usage: chat_migrate [--host H] [--port P] [--user U] [--password PW]\n"
+                 "                    [--batch N] [--pause-ms MS] [--create-missing-users]" << std::endl;
+}
+
+static bool parse_options(int argc, char** argv, MigrateOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--create-missing-users") { options.create_missing_users = true; continue; }
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (arg == "--host") options.host = value;
+        else if (arg == "--port") options.port = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--user") options.user = value;
+        else if (arg == "--password") options.password = value;
+        else if (arg == "--batch") options.batch_size = std::max<int64_t>(1, std::stoll(value));
+        else if (arg == "--pause-ms") options.pause = std::chrono::milliseconds(std::stoll(value));
+        else return false;
+    }
+    return true;
+}
+
+static int64_t query_count(mysqlx::Session& session, const std::string& query) {
+    mysqlx::Row row = session.sql(query).execute().fetchOne();
+    return row && !row[0].isNull() ? row[0].get<int64_t>() : 0;
+}
+
+static bool has_column(mysqlx::Session& session, const std::string& column) {
+    return query_count(session,
+        "SELECT COUNT(*) FROM information_schema.COLUMNS"
+        " WHERE TABLE_SCHEMA = 'chatdb' AND TABLE_NAME = 'messages' AND COLUMN_NAME = '" + column + "'") > 0;
+}
+
+// 孤儿：用户名在 users 里查不到。收件人查不到的私信不能回填成 NULL，否则会变成公共消息
+static const char* kOrphanNames =
+    "SELECT name FROM ("
+    " SELECT sender AS name FROM chatdb.messages WHERE sender_id IS NULL"
+    " UNION SELECT recipient FROM chatdb.messages WHERE sender_id IS NULL AND recipient IS NOT NULL"
+    ") AS names LEFT JOIN chatdb.users u ON u.username = names.name WHERE u.id IS NULL";
+
+static uint64_t create_missing_users(mysqlx::Session& session) {
+    std::random_device random_device;
+    std::string seed = std::to_string(random_device()) + std::to_string(random_device());
+    auto result = session.sql(std::string("INSERT IGNORE INTO chatdb.users (username, password)"
+                                          " SELECT name, SHA2(CONCAT(?, RAND(), name), 256) FROM (") + kOrphanNames + ") AS orphans")
+        .bind(seed)
+        .execute();
+    return result.getAffectedItemsCount();
+}
+
+static uint64_t backfill(mysqlx::Session& session, const MigrateOptions& options) {
+    mysqlx::Row bounds = session.sql("SELECT MIN(id), MAX(id) FROM chatdb.messages WHERE sender_id IS NULL").execute().fetchOne();
+    if (!bounds || bounds[0].isNull()) return 0;
+    int64_t first_id = bounds[0].get<int64_t>();
+    int64_t last_id = bounds[1].get<int64_t>();
+    std::cout << "Backfilling ids [" << first_id << ", " << last_id << "] in batches of " << options.batch_size << std::endl;
+
+    uint64_t updated_total = 0;
+    uint64_t batch_count = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    for (int64_t lower = first_id; lower <= last_id; lower += options.batch_size) {
+        auto result = session.sql(
+                "UPDATE chatdb.messages m"
+                " JOIN chatdb.users s ON s.username = m.sender"
+                " LEFT JOIN chatdb.users r ON r.username = m.recipient"
+                " SET m.sender_id = s.id, m.recipient_id = r.id"
+                " WHERE m.id >= ? AND m.id < ? AND m.sender_id IS NULL"
+                "   AND (m.recipient IS NULL OR r.id IS NOT NULL)")
+            .bind(lower, lower + options.batch_size)
+            .execute();
+        updated_total += result.getAffectedItemsCount();
+        if (++batch_count % 100 == 0) {
+            auto elapsed_s = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
+            std::cout << "  up to id " << lower + options.batch_size - 1 << ": " << updated_total << " rows, "
+                      << elapsed_s << "s" << std::endl;
+        }
+        if (options.pause.count() > 0) std::this_thread::sleep_for(options.pause);
+    }
+    return updated_total;
+}
+
+int main(int argc, char** argv) {
+    MigrateOptions options;
+    try {
+        if (!parse_options(argc, argv, options)) {
+            print_usage();
+            return 1;
+        }
+    } catch (const std::exception&) {
+        print_usage();
+        return 1;
+    }
+
+    try {
+        mysqlx::Session session(options.host, options.port, options.user, options.password);
+        if (!has_column(session, "sender_id") || !has_column(session, "recipient_id")) {
+            std::cerr << "messages.sender_id / recipient_id missing: apply sql/003_message_user_ids.sql first" << std::endl;
+            return 1;
+        }
+        if (!has_column(session, "sender")) {
+            std::cout << "messages.sender already dropped, nothing to migrate" << std::endl;
+            return 0;
+        }
+
+        if (options.create_missing_users) {
+            std::cout << "Created " << create_missing_users(session) << " missing users" << std::endl;
+        }
+        uint64_t updated_total = backfill(session, options);
+        std::cout << "Backfilled " << updated_total << " rows" << std::endl;
+
+        int64_t pending_count = query_count(session, "SELECT COUNT(*) FROM chatdb.messages WHERE sender_id IS NULL");
+        if (pending_count > 0) {
+            std::cerr << pending_count << " rows still have no sender_id. Usernames missing from users:" << std::endl;
+            auto orphan_result = session.sql(std::string(kOrphanNames) + " LIMIT 20").execute();
+            for (const mysqlx::Row& row : orphan_result.fetchAll()) std::cerr << "  " << row[0].get<std::string>() << std::endl;
+            std::cerr << "Rerun with --create-missing-users to keep these rows, or if the server is still writing, rerun after stopping it."
+                      << std::endl;
+            return 2;
+        }
+        std::cout << "All rows migrated. With the server stopped, apply sql/004_drop_message_usernames.sql" << std::endl;
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Migration failed: " << ex.what() << std::endl;
+        return 1;
+    }
+}
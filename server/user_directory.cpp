@@ -0,0 +1,109 @@
+﻿#include "user_directory.hpp"
+#include "blocking_executor.hpp"
+#include "logger.hpp"
+
+UserDirectory::UserDirectory(BlockingExecutor* hash_executor, const UserDirectoryOptions& options)
+    : hash_executor_(hash_executor), options_(options) {
+    if (options_.max_entries == 0) options_.max_entries = 1;
+}
+
+UserCredentialPtr UserDirectory::find(const std::string& username) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    auto it = entries_.find(username);
+    if (it == entries_.end() || it->second.expires_at <= std::chrono::steady_clock::now()) {
+        miss_count_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (it->second.credential->exists) hit_count_.fetch_add(1, std::memory_order_relaxed);
+    else negative_hit_count_.fetch_add(1, std::memory_order_relaxed);
+    return it->second.credential;
+}
+
+UserDirectory::LoadedUser UserDirectory::load(const std::string& username, const std::function<LoadedUser()>& loader) {
+    std::promise<LoadedUser> promise;
+    std::shared_future<LoadedUser> flight;
+    uint64_t epoch = 0;
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex_);
+        auto it = in_flight_.find(username);
+        if (it != in_flight_.end()) {
+            flight = it->second;
+        } else {
+            in_flight_.emplace(username, promise.get_future().share());
+            epoch = epoch_;
+        }
+    }
+    if (flight.valid()) {
+        coalesced_load_count_.fetch_add(1, std::memory_order_relaxed);
+        return flight.get();
+    }
+
+    LoadedUser user;
+    try {
+        db_load_count_.fetch_add(1, std::memory_order_relaxed);
+        user = loader();
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock_guard(mutex_);
+            in_flight_.erase(username);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex_);
+        in_flight_.erase(username);
+        if (!user.exists && epoch == epoch_) {
+            store_locked(username, std::make_shared<UserCredential>(), options_.negative_ttl);
+        }
+    }
+    promise.set_value(user);
+
+    // 正缓存要先派生校验值，交给哈希线程池，这次登录直接用查到的记录比较
+    if (user.exists) {
+        hash_executor_->submit([this, username, user_id = user.user_id, password = user.password, epoch]() {
+            auto credential = std::make_shared<UserCredential>();
+            credential->exists = true;
+            credential->user_id = user_id;
+            credential->verifier = make_password_verifier(password, options_.verifier_iterations);
+            verifier_count_.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock_guard(mutex_);
+            if (epoch == epoch_) store_locked(username, std::move(credential), options_.positive_ttl);
+        });
+    }
+    return user;
+}
+
+void UserDirectory::forget(const std::string& username) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    entries_.erase(username);
+    ++epoch_;
+}
+
+// 满了先清过期项，仍然满就随便腾出一个位置
+void UserDirectory::store_locked(const std::string& username, UserCredentialPtr credential, std::chrono::milliseconds ttl) {
+    auto now = std::chrono::steady_clock::now();
+    if (entries_.size() >= options_.max_entries && entries_.find(username) == entries_.end()) {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->second.expires_at <= now) it = entries_.erase(it);
+            else ++it;
+        }
+        if (entries_.size() >= options_.max_entries) entries_.erase(entries_.begin());
+    }
+    entries_[username] = Entry{ std::move(credential), now + ttl };
+}
+
+UserDirectoryStats UserDirectory::stats() const {
+    UserDirectoryStats snapshot;
+    snapshot.hits = hit_count_.load(std::memory_order_relaxed);
+    snapshot.negative_hits = negative_hit_count_.load(std::memory_order_relaxed);
+    snapshot.misses = miss_count_.load(std::memory_order_relaxed);
+    snapshot.db_loads = db_load_count_.load(std::memory_order_relaxed);
+    snapshot.coalesced_loads = coalesced_load_count_.load(std::memory_order_relaxed);
+    snapshot.verifiers_built = verifier_count_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock_guard(mutex_);
+        snapshot.entries = entries_.size();
+    }
+    return snapshot;
+}
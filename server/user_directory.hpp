@@ -0,0 +1,82 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "password_hash.hpp"
+#include "chat_msg.hpp"
+
+class BlockingExecutor;
+
+struct UserDirectoryOptions {
+    std::chrono::milliseconds positive_ttl{10 * 60 * 1000};
+    std::chrono::milliseconds negative_ttl{5000};       // 不存在的用户名只缓存很短时间
+    size_t max_entries = 100000;
+    uint32_t verifier_iterations = 10000;               // PBKDF2 轮数
+};
+
+struct UserDirectoryStats {
+    uint64_t hits = 0;
+    uint64_t negative_hits = 0;
+    uint64_t misses = 0;
+    uint64_t db_loads = 0;
+    uint64_t coalesced_loads = 0;       // 搭上了同名用户正在进行的查库
+    uint64_t verifiers_built = 0;
+    uint64_t entries = 0;
+};
+
+// 一个用户名的缓存结果；exists 为 false 是负缓存
+struct UserCredential {
+    bool exists = false;
+    UserId user_id = 0;
+    PasswordVerifier verifier;
+};
+using UserCredentialPtr = std::shared_ptr<const UserCredential>;
+
+// 进程内的用户目录：缓存加盐校验值而不是明文，未知用户名做短 TTL 负缓存，
+// 同一用户名的并发查库合并成一次。校验值的派生放在有界的哈希线程池里
+class UserDirectory {
+public:
+    struct LoadedUser {
+        bool exists = false;
+        UserId user_id = 0;
+        std::string password;           // 只在本次查库的调用方之间传递，不进缓存
+    };
+
+    UserDirectory(BlockingExecutor* hash_executor, const UserDirectoryOptions& options = UserDirectoryOptions());
+
+    // 只查内存；未命中或已过期返回 nullptr
+    UserCredentialPtr find(const std::string& username);
+    // 未命中时调用：同一用户名同时只有一个调用方真正执行 loader，其他人等它的结果（含异常）
+    LoadedUser load(const std::string& username, const std::function<LoadedUser()>& loader);
+    // 注册等改动后丢弃该用户名的缓存；进行中的查库结果也不再写回
+    void forget(const std::string& username);
+    UserDirectoryStats stats() const;
+
+private:
+    struct Entry {
+        UserCredentialPtr credential;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+    void store_locked(const std::string& username, UserCredentialPtr credential, std::chrono::milliseconds ttl);
+
+    BlockingExecutor* hash_executor_;
+    UserDirectoryOptions options_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::unordered_map<std::string, std::shared_future<LoadedUser>> in_flight_;
+    uint64_t epoch_ = 0;                // forget 时递增，早于它开始的查库/派生不写回
+
+    std::atomic<uint64_t> hit_count_{0};
+    std::atomic<uint64_t> negative_hit_count_{0};
+    std::atomic<uint64_t> miss_count_{0};
+    std::atomic<uint64_t> db_load_count_{0};
+    std::atomic<uint64_t> coalesced_load_count_{0};
+    std::atomic<uint64_t> verifier_count_{0};
+};
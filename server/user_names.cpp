@@ -0,0 +1,83 @@
+﻿#include "user_names.hpp"
+#include "db_pool.hpp"
+#include "logger.hpp"
+#include <mysqlx/xdevapi.h>
+#include <algorithm>
+#include <mutex>
+
+UserName UserNames::find(UserId user_id) const {
+    std::shared_lock<std::shared_mutex> lock_guard(mutex_);
+    auto it = names_.find(user_id);
+    return it != names_.end() ? it->second : nullptr;
+}
+
+UserId UserNames::find_id(const std::string& username) const {
+    std::shared_lock<std::shared_mutex> lock_guard(mutex_);
+    auto it = ids_.find(username);
+    return it != ids_.end() ? it->second : 0;
+}
+
+UserName UserNames::intern(UserId user_id, const std::string& username) {
+    if (user_id == 0) return nullptr;
+    {
+        std::shared_lock<std::shared_mutex> lock_guard(mutex_);
+        auto it = names_.find(user_id);
+        if (it != names_.end()) return it->second;
+    }
+    auto name = std::make_shared<const std::string>(username);
+    std::unique_lock<std::shared_mutex> lock_guard(mutex_);
+    auto inserted = names_.emplace(user_id, name);
+    if (inserted.second) ids_.emplace(username, user_id);
+    return inserted.first->second;
+}
+
+UserId UserNames::lookup_id(const std::string& username) {
+    UserId user_id = find_id(username);
+    if (user_id) return user_id;
+    id_lookup_count_.fetch_add(1, std::memory_order_relaxed);
+    auto connection_ptr = db_pool_->acquire();
+    mysqlx::RowResult row_result = connection_ptr->user_id_lookup
+        .bind("username", username)
+        .execute();
+    mysqlx::Row row = row_result.fetchOne();
+    if (!row) return 0;
+    user_id = static_cast<UserId>(row[0].get<int64_t>());
+    intern(user_id, username);
+    return user_id;
+}
+
+// id 都是整数，直接拼进 IN 列表；一页历史里的新名字一次往返查完
+void UserNames::load(const std::vector<UserId>& user_ids) {
+    std::vector<UserId> missing;
+    {
+        std::shared_lock<std::shared_mutex> lock_guard(mutex_);
+        for (UserId user_id : user_ids) {
+            if (user_id && names_.find(user_id) == names_.end()) missing.push_back(user_id);
+        }
+    }
+    if (missing.empty()) return;
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    name_load_count_.fetch_add(1, std::memory_order_relaxed);
+
+    std::string query = "SELECT id, username FROM chatdb.users WHERE id IN (";
+    for (size_t i = 0; i < missing.size(); ++i) {
+        if (i) query += ',';
+        query += std::to_string(missing[i]);
+    }
+    query += ')';
+    auto connection_ptr = db_pool_->acquire();
+    auto row_result = connection_ptr->session.sql(query).execute();
+    for (const mysqlx::Row& row : row_result.fetchAll()) {
+        intern(static_cast<UserId>(row[0].get<int64_t>()), row[1].get<std::string>());
+    }
+}
+
+UserNamesStats UserNames::stats() const {
+    UserNamesStats snapshot;
+    snapshot.id_lookups = id_lookup_count_.load(std::memory_order_relaxed);
+    snapshot.name_loads = name_load_count_.load(std::memory_order_relaxed);
+    std::shared_lock<std::shared_mutex> lock_guard(mutex_);
+    snapshot.entries = names_.size();
+    return snapshot;
+}
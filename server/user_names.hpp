@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chat_msg.hpp"
+
+class DBPool;
+
+struct UserNamesStats {
+    uint64_t entries = 0;
+    uint64_t id_lookups = 0;        // 按用户名查 id 走了 DB
+    uint64_t name_loads = 0;        // 按 id 批量补用户名走了 DB
+};
+
+// 用户名驻留表：id <-> 用户名，登录、注册、翻历史时记下，之后按 id 取共享的名字，不再逐条拷贝字符串。
+// 用户名不可改、id 不复用，所以条目从不失效；规模以 users 表为上限
+class UserNames {
+public:
+    explicit UserNames(DBPool* db_pool) : db_pool_(db_pool) {}
+    UserNames(const UserNames&) = delete;
+    UserNames& operator=(const UserNames&) = delete;
+
+    // 只查内存，可在 I/O 线程上调用
+    UserName find(UserId user_id) const;
+    UserId find_id(const std::string& username) const;
+    // 记下一对 id/用户名，返回驻留的名字
+    UserName intern(UserId user_id, const std::string& username);
+
+    // 以下会访问 DB，只能在 DB 执行器上调用；连接池给不出连接时抛 DBUnavailable
+    // 用户不存在返回 0
+    UserId lookup_id(const std::string& username);
+    // 把 user_ids 里内存中还没有的名字一次查回来
+    void load(const std::vector<UserId>& user_ids);
+
+    UserNamesStats stats() const;
+
+private:
+    DBPool* db_pool_;
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<UserId, UserName> names_;
+    std::unordered_map<std::string, UserId> ids_;
+
+    std::atomic<uint64_t> id_lookup_count_{0};
+    std::atomic<uint64_t> name_load_count_{0};
+};
@@ -4,101 +4,100 @@
 #include "logger.hpp"
 #include <mysqlx/xdevapi.h>
 
+// mysqlx::Error 不带服务端错误码，只能认消息文本。ER_DUP_ENTRY（1062，SQLSTATE 23000）的格式固定为
+// "Duplicate entry '<值>' for key '<索引>'"，连接器可能加 "CDK Error: " 前缀；只按前缀匹配，
+// 不在整条消息里找子串，否则用户名或别的错误里碰巧出现的 "1062" 也会被当成重名
+static bool is_duplicate_key(const mysqlx::Error& ex) {
+    static const std::string kConnectorPrefix = "CDK Error: ";
+    static const std::string kDuplicatePrefix = "Duplicate entry '";
+    std::string message = ex.what();
+    size_t start = message.compare(0, kConnectorPrefix.size(), kConnectorPrefix) == 0 ? kConnectorPrefix.size() : 0;
+    if (message.compare(start, kDuplicatePrefix.size(), kDuplicatePrefix) != 0) return false;
+    return message.find("' for key '", start + kDuplicatePrefix.size()) != std::string::npos;
+}
+
 bool UserStore::register_user(const std::string& username, const std::string& password) {
     if (username.empty() || password.size() < 3) {
-        std::cerr << "[debug] empty username or password too short" << std::endl;
-        Logger::instance().warn("Register failed: Invalid username or password", {
+        CHAT_LOG_WARN("Register failed: Invalid username or password", {
             {"username", username},
             {"reason", "empty or password too short"}
         });
         return false;
     }
+    // 只发一条 INSERT，重名由 username 上的唯一约束（1062 Duplicate entry）判定，不再先 SELECT
     try {
-        std::cerr << "[debug] before db_pool_->acquire_session()" << std::endl;
-        auto session_ptr = db_pool_->acquire_session();
-        if (!session_ptr) {
-            Logger::instance().error("Failed to get database session", {
-                {"username", username}
-            });
-            std::cerr << "[error] failed to get session" << std::endl;
-            return false;
-        }
-        std::cerr << "[debug] session OK" << std::endl;
-        auto database_schema = session_ptr->getSchema("chatdb");
-        std::cerr << "[debug] db OK" << std::endl;
-        auto users_table = database_schema.getTable("users");
-        std::cerr << "[debug] table OK" << std::endl;
-
-        mysqlx::RowResult exist_result = users_table.select("id")
-            .where("username = :username")
-            .bind("username", username)
+        auto connection_ptr = db_pool_->acquire();
+        auto insert_result = connection_ptr->users_table.insert("username", "password")
+            .values(username, password)
             .execute();
-        if (exist_result.count() > 0) {
-            Logger::instance().warn("Register failed: username already exists", {
+        user_names_->intern(static_cast<UserId>(insert_result.getAutoIncrementValue()), username);
+        directory_.forget(username);   // 丢掉可能存在的负缓存
+        CHAT_LOG_INFO("Register succeeded", {{"username", username}});
+        return true;
+    } catch (const DBUnavailable&) {
+        throw;   // 不是“用户名已存在”，交给调用方按数据库不可用回复
+    } catch (const mysqlx::Error& ex) {
+        if (is_duplicate_key(ex)) {
+            CHAT_LOG_WARN("Register failed: username already exists", {
                 {"username", username}
             });
             std::cerr << "Register failed: username already exists" << std::endl;
             return false;
         }
-
-        users_table.insert("username", "password")
-            .values(username, password)
-            .execute();
-        std::cerr << "[debug] insert OK" << std::endl;
-        Logger::instance().info("Register succeeded", {{"username", username}});
-        return true;
-    } catch (const mysqlx::Error& ex) {
-        Logger::instance().warn("Register failed", {
+        CHAT_LOG_WARN("Register failed", {
             {"username", username}, {"error", ex.what()}
         });
         std::cerr << "Register failed: " << ex.what() << std::endl;
         return false;
     } catch (const std::exception& ex) {
         std::cerr << "register_user std::exception: " << ex.what() << std::endl;
-        Logger::instance().error("register_user uncaught std::exception", {
+        CHAT_LOG_ERROR("register_user uncaught std::exception", {
             {"username", username}, {"error", ex.what()}
         });
         return false;
     } catch (...) {
         std::cerr << "register_user FATAL UNKNOWN EXCEPTION" << std::endl;
-        Logger::instance().error("register_user fatal UNKNOWN EXCEPTION", {
+        CHAT_LOG_ERROR("register_user fatal UNKNOWN EXCEPTION", {
             {"username", username}
         });
         return false;
     }
 }
 
-bool UserStore::check_login(const std::string& username, const std::string& password) {
+// 目录未命中：同名并发只查一次库，本次直接和查到的记录做定长比较；校验值由目录在后台派生
+UserId UserStore::check_login(const std::string& username, const std::string& password) {
     try {
-        auto session_ptr = db_pool_->acquire_session();
-        if (!session_ptr) {
-            Logger::instance().error("Failed to get database session (login)", {
-                {"username", username}
-            });
-            return false;
-        }
-        auto database_schema = session_ptr->getSchema("chatdb");
-        auto users_table = database_schema.getTable("users");
-        mysqlx::RowResult row_result = users_table.select("password")
-            .where("username = :username")
-            .bind("username", username)
-            .execute();
-        std::vector<mysqlx::Row> rows = row_result.fetchAll();
-        if (rows.empty()) {
-            Logger::instance().warn("Login failed - no such user (DB)", { {"username", username} });
-            return false;
+        UserDirectory::LoadedUser user = directory_.load(username, [this, &username]() {
+            UserDirectory::LoadedUser loaded;
+            auto connection_ptr = db_pool_->acquire();
+            mysqlx::RowResult row_result = connection_ptr->user_password_lookup
+                .bind("username", username)
+                .execute();
+            std::vector<mysqlx::Row> rows = row_result.fetchAll();
+            if (!rows.empty()) {
+                loaded.exists = true;
+                loaded.user_id = static_cast<UserId>(rows[0][0].get<int64_t>());
+                loaded.password = rows[0][1].get<std::string>();
+            }
+            return loaded;
+        });
+        if (!user.exists) {
+            CHAT_LOG_WARN("Login failed - no such user (DB)", { {"username", username} });
+            return 0;
         }
-        bool is_success = rows[0][0].get<std::string>() == password;
-        Logger::instance().info("Login attempt (DB)", { {"username", username}, {"ok", is_success} });
-        return is_success;
+        bool is_success = constant_time_equals(user.password, password);
+        CHAT_LOG_INFO("Login attempt (DB)", { {"username", username}, {"ok", is_success} });
+        return is_success ? user.user_id : 0;
+    } catch (const DBUnavailable&) {
+        throw;
     } catch (const mysqlx::Error& ex) {
-        Logger::instance().warn("Login failed (DB)", { {"username", username}, {"error", ex.what()} });
-        return false;
+        CHAT_LOG_WARN("Login failed (DB)", { {"username", username}, {"error", ex.what()} });
+        return 0;
     } catch (const std::exception& ex) {
-        Logger::instance().error("Login fatal exception (DB)", { {"username", username}, {"error", ex.what()} });
-        return false;
+        CHAT_LOG_ERROR("Login fatal exception (DB)", { {"username", username}, {"error", ex.what()} });
+        return 0;
     } catch (...) {
-        Logger::instance().error("Login fatal unknown exception (DB)", { {"username", username} });
-        return false;
+        CHAT_LOG_ERROR("Login fatal unknown exception (DB)", { {"username", username} });
+        return 0;
     }
 }
\ No newline at end of file
@@ -1,13 +1,25 @@
 ﻿#pragma once
 #include <string>
+#include "user_directory.hpp"
+#include "user_names.hpp"
 class DBPool;
 
 class UserStore {
 public:
-    UserStore(DBPool* db_pool): db_pool_(db_pool) {}
+    UserStore(DBPool* db_pool, UserNames* user_names, BlockingExecutor* hash_executor,
+              const UserDirectoryOptions& directory_options = UserDirectoryOptions())
+        : db_pool_(db_pool), user_names_(user_names), directory_(hash_executor, directory_options) {}
+    // 连接池给不出连接时抛 DBUnavailable，其余错误按失败返回
     bool register_user(const std::string& username, const std::string& password);
-    bool check_login(const std::string& username, const std::string& password);
+    // 目录缓存未命中时调用：会访问 DB，只能在 DB 执行器上跑。成功返回 users.id，失败返回 0
+    UserId check_login(const std::string& username, const std::string& password);
+    // 只查内存，可在 I/O 线程上调用；命中正缓存后用 check_password 校验（派生开销大，放到哈希线程池）
+    UserCredentialPtr find_credential(const std::string& username) { return directory_.find(username); }
+    UserDirectoryStats directory_stats() const { return directory_.stats(); }
+    UserNames& names() { return *user_names_; }
 
 private:
     DBPool* db_pool_;
-};
\ No newline at end of file
+    UserNames* user_names_;
+    UserDirectory directory_;
+};